@@ -0,0 +1,180 @@
+/* Batched datagram I/O for the CoAP server
+ *
+ * Copyright (c) 2026
+ * Contributors to the EdgeX Foundry
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "coap-batch.h"
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "coap-metrics.h"
+
+/* room for the packet info of both address families, as on an IPv6 socket */
+#define BATCH_CONTROL_MAX                   \
+  (CMSG_SPACE(sizeof(struct in6_pktinfo)) + \
+   CMSG_SPACE(sizeof(struct in_pktinfo)))
+
+/* A datagram and its addresses, as received or to send */
+typedef struct {
+  uint8_t data[BATCH_DATAGRAM_MAX];
+  coap_address_t peer;
+  union {
+    struct cmsghdr align;
+    uint8_t buf[BATCH_CONTROL_MAX];
+  } control;
+  struct iovec iov;
+} batch_slot;
+
+struct batch_io {
+  int fd;
+  uint32_t size;
+  batch_slot *rx;
+  struct mmsghdr *rx_msgs;
+  uint32_t rx_count;
+  batch_slot *tx;
+  struct mmsghdr *tx_msgs;
+  uint32_t tx_count;
+};
+
+batch_io *batch_new(int fd, uint32_t size) {
+  batch_io *io = calloc(1, sizeof(*io));
+  if (io == NULL) {
+    return NULL;
+  }
+  io->fd = fd;
+  io->size = size;
+  io->rx = calloc(size, sizeof(batch_slot));
+  io->rx_msgs = calloc(size, sizeof(struct mmsghdr));
+  io->tx = calloc(size, sizeof(batch_slot));
+  io->tx_msgs = calloc(size, sizeof(struct mmsghdr));
+  if (!io->rx || !io->rx_msgs || !io->tx || !io->tx_msgs) {
+    batch_free(io);
+    return NULL;
+  }
+  return io;
+}
+
+void batch_free(batch_io *io) {
+  if (io == NULL) {
+    return;
+  }
+  free(io->rx);
+  free(io->rx_msgs);
+  free(io->tx);
+  free(io->tx_msgs);
+  free(io);
+}
+
+uint32_t batch_recv(batch_io *io) {
+  for (uint32_t i = 0; i < io->size; i++) {
+    batch_slot *slot = &io->rx[i];
+    struct msghdr *hdr = &io->rx_msgs[i].msg_hdr;
+    slot->iov.iov_base = slot->data;
+    slot->iov.iov_len = sizeof(slot->data);
+    hdr->msg_name = &slot->peer.addr;
+    hdr->msg_namelen = sizeof(slot->peer.addr);
+    hdr->msg_iov = &slot->iov;
+    hdr->msg_iovlen = 1;
+    hdr->msg_control = slot->control.buf;
+    hdr->msg_controllen = sizeof(slot->control.buf);
+    hdr->msg_flags = 0;
+  }
+  int n = recvmmsg(io->fd, io->rx_msgs, io->size, MSG_DONTWAIT, NULL);
+  metric_add(METRIC_SERVER_RECV_CALLS, 1);
+  io->rx_count = n > 0 ? (uint32_t)n : 0;
+  for (uint32_t i = 0; i < io->rx_count; i++) {
+    io->rx[i].peer.size = io->rx_msgs[i].msg_hdr.msg_namelen;
+  }
+  metric_add(METRIC_SERVER_DATAGRAMS_IN, io->rx_count);
+  return io->rx_count;
+}
+
+uint8_t *batch_datagram(batch_io *io, uint32_t i, size_t *len,
+                        const coap_address_t **peer) {
+  if (io->rx_msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+    return NULL;
+  }
+  *len = io->rx_msgs[i].msg_len;
+  *peer = &io->rx[i].peer;
+  return io->rx[i].data;
+}
+
+/*
+ * Sets the source address of a reply to the destination of the datagram
+ * received, so a server bound to a wildcard address replies from the address
+ * the peer sent to.
+ */
+static size_t reply_control(struct msghdr *received, batch_slot *slot) {
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(received); cmsg;
+       cmsg = CMSG_NXTHDR(received, cmsg)) {
+    struct cmsghdr *out = &slot->control.align;
+    if (cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_PKTINFO) {
+      struct in6_pktinfo info;
+      memcpy(&info, CMSG_DATA(cmsg), sizeof(info));
+      out->cmsg_level = IPPROTO_IPV6;
+      out->cmsg_type = IPV6_PKTINFO;
+      out->cmsg_len = CMSG_LEN(sizeof(info));
+      memcpy(CMSG_DATA(out), &info, sizeof(info));
+      return CMSG_SPACE(sizeof(info));
+    }
+    if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO) {
+      struct in_pktinfo info;
+      memcpy(&info, CMSG_DATA(cmsg), sizeof(info));
+      info.ipi_spec_dst = info.ipi_addr;
+      out->cmsg_level = IPPROTO_IP;
+      out->cmsg_type = IP_PKTINFO;
+      out->cmsg_len = CMSG_LEN(sizeof(info));
+      memcpy(CMSG_DATA(out), &info, sizeof(info));
+      return CMSG_SPACE(sizeof(info));
+    }
+  }
+  return 0;
+}
+
+void batch_reply(batch_io *io, uint32_t i, const uint8_t *data, size_t len) {
+  if (len > BATCH_DATAGRAM_MAX) {
+    return;
+  }
+  if (io->tx_count == io->size) {
+    batch_flush(io);
+  }
+  batch_slot *slot = &io->tx[io->tx_count];
+  struct msghdr *hdr = &io->tx_msgs[io->tx_count].msg_hdr;
+  memcpy(slot->data, data, len);
+  slot->peer = io->rx[i].peer;
+  slot->iov.iov_base = slot->data;
+  slot->iov.iov_len = len;
+  memset(hdr, 0, sizeof(*hdr));
+  hdr->msg_name = &slot->peer.addr;
+  hdr->msg_namelen = slot->peer.size;
+  hdr->msg_iov = &slot->iov;
+  hdr->msg_iovlen = 1;
+  hdr->msg_controllen = reply_control(&io->rx_msgs[i].msg_hdr, slot);
+  hdr->msg_control = hdr->msg_controllen ? slot->control.buf : NULL;
+  io->tx_count++;
+}
+
+void batch_flush(batch_io *io) {
+  uint32_t done = 0;
+  uint32_t sent = 0;
+  while (done < io->tx_count) {
+    int n = sendmmsg(io->fd, io->tx_msgs + done, io->tx_count - done, 0);
+    metric_add(METRIC_SERVER_SEND_CALLS, 1);
+    if (n > 0) {
+      done += n;
+      sent += n;
+    } else if (errno != EINTR) {
+      /* socket buffer full, or peer unreachable; drop the reply, as UDP */
+      done++;
+    }
+  }
+  metric_add(METRIC_SERVER_DATAGRAMS_OUT, sent);
+  io->tx_count = 0;
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2026
+ * Contributors to the EdgeX Foundry
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef _COAP_BATCH_H_
+#define _COAP_BATCH_H_ 1
+
+/**
+ * @file
+ * @brief Defines batched datagram I/O for the CoAP server, which receives and
+ * sends many datagrams per system call.
+ */
+
+#include <coap2/coap.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Largest datagram received; a longer one is dropped */
+#define BATCH_DATAGRAM_MAX 1500
+/** Most datagrams in a batch, as the kernel limits one call */
+#define BATCH_SIZE_MAX 1024
+
+/**
+ * Buffers for a batch of datagrams received on a socket, and the replies to
+ * them. Not thread safe; each is used by one server thread.
+ */
+typedef struct batch_io batch_io;
+
+/**
+ * Creates buffers for batches on a socket. The socket must be non-blocking,
+ * with packet info enabled, as libcoap creates it.
+ *
+ * @param fd UDP socket
+ * @param size Maximum datagrams in a batch
+ * @return new batch buffers; NULL if out of memory
+ */
+extern batch_io *batch_new(int fd, uint32_t size);
+
+/** Frees batch buffers, dropping any replies not yet sent. */
+extern void batch_free(batch_io *io);
+
+/**
+ * Receives the datagrams waiting on the socket, up to the batch size, with
+ * one system call. Replaces the previous batch, so replies to it must have
+ * been sent.
+ *
+ * @return number of datagrams received; 0 if none are waiting, or on error
+ */
+extern uint32_t batch_recv(batch_io *io);
+
+/**
+ * Returns a datagram of the batch received.
+ *
+ * @param i Index of datagram in the batch
+ * @param len Set to the length of the datagram
+ * @param peer Set to the address of the sender
+ * @return datagram, valid until the next batch is received; NULL if it was
+ *         truncated
+ */
+extern uint8_t *batch_datagram(batch_io *io, uint32_t i, size_t *len,
+                               const coap_address_t **peer);
+
+/**
+ * Queues a reply to a datagram of the batch received, sent from the address
+ * the datagram was sent to. Sends the queued replies if the queue is full.
+ *
+ * @param i Index of datagram in the batch
+ * @param data Reply, copied
+ * @param len Length of reply; at most BATCH_DATAGRAM_MAX
+ */
+extern void batch_reply(batch_io *io, uint32_t i, const uint8_t *data,
+                        size_t len);
+
+/** Sends the queued replies, with as few system calls as the socket allows. */
+extern void batch_flush(batch_io *io);
+#ifdef __cplusplus
+}
+#endif
+#endif
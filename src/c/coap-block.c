@@ -0,0 +1,300 @@
+/* Reassembly of bodies transferred in blocks
+ *
+ * Copyright (c) 2026
+ * Contributors to the EdgeX Foundry
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "coap-block.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "coap-util.h"
+
+/* spare transfers kept for reuse, and largest buffer kept with one */
+#define BLOCK_MAX_SPARES 8
+#define BLOCK_SPARE_MAX_CAPACITY 16384
+
+struct block_transfer {
+  const void *peer;
+  uint8_t key[BLOCK_KEY_MAXLEN];
+  size_t key_len;
+  uint8_t *data;        /**< capacity + 1 bytes, for a null terminator */
+  size_t capacity;
+  size_t len;
+  uint64_t last_used;   /**< msecs when last block was received */
+  struct block_transfer *next;
+};
+
+struct block_pool {
+  size_t max_body;
+  size_t max_peer;
+  block_transfer *active;
+  uint32_t nactive;
+  block_transfer *spares;
+  uint32_t nspares;
+};
+
+block_pool *block_pool_new(size_t max_body, size_t max_peer) {
+  block_pool *pool = calloc(1, sizeof(*pool));
+  pool->max_body = max_body;
+  pool->max_peer = max_peer;
+  return pool;
+}
+
+static void transfer_free(block_transfer *transfer) {
+  free(transfer->data);
+  free(transfer);
+}
+
+void block_pool_free(block_pool *pool) {
+  if (pool == NULL) {
+    return;
+  }
+  while (pool->active) {
+    block_transfer *transfer = pool->active;
+    pool->active = transfer->next;
+    transfer_free(transfer);
+  }
+  while (pool->spares) {
+    block_transfer *transfer = pool->spares;
+    pool->spares = transfer->next;
+    transfer_free(transfer);
+  }
+  free(pool);
+}
+
+void block_release(block_pool *pool, block_transfer *transfer) {
+  if (pool->nspares >= BLOCK_MAX_SPARES) {
+    transfer_free(transfer);
+    return;
+  }
+  if (transfer->capacity > BLOCK_SPARE_MAX_CAPACITY) {
+    free(transfer->data);
+    transfer->data = NULL;
+    transfer->capacity = 0;
+  }
+  transfer->len = 0;
+  transfer->next = pool->spares;
+  pool->spares = transfer;
+  pool->nspares++;
+}
+
+/* Removes a transfer from the active list */
+static void unlink_transfer(block_pool *pool, block_transfer *transfer) {
+  block_transfer **link = &pool->active;
+  while (*link != transfer) {
+    link = &(*link)->next;
+  }
+  *link = transfer->next;
+  pool->nactive--;
+}
+
+static void drop_transfer(block_pool *pool, block_transfer *transfer) {
+  unlink_transfer(pool, transfer);
+  block_release(pool, transfer);
+}
+
+static void expire_transfers(block_pool *pool, uint64_t now) {
+  block_transfer *transfer = pool->active;
+  while (transfer) {
+    block_transfer *next = transfer->next;
+    if (now - transfer->last_used > BLOCK_TRANSFER_TIMEOUT_MSECS) {
+      drop_transfer(pool, transfer);
+    }
+    transfer = next;
+  }
+}
+
+static block_transfer *find_transfer(block_pool *pool, const void *peer,
+                                     const uint8_t *key, size_t key_len) {
+  for (block_transfer *transfer = pool->active; transfer;
+       transfer = transfer->next) {
+    if (transfer->peer == peer && transfer->key_len == key_len &&
+        !memcmp(transfer->key, key, key_len)) {
+      return transfer;
+    }
+  }
+  return NULL;
+}
+
+/* Buffer memory held by the transfers of a peer */
+static size_t peer_usage(const block_pool *pool, const void *peer) {
+  size_t usage = 0;
+  for (const block_transfer *transfer = pool->active; transfer;
+       transfer = transfer->next) {
+    if (transfer->peer == peer) {
+      usage += transfer->capacity;
+    }
+  }
+  return usage;
+}
+
+/*
+ * Ensures the buffer holds needed bytes. Grows by doubling, so a body of
+ * unknown size takes few reallocations, within the limit for the peer.
+ */
+static bool reserve(block_pool *pool, block_transfer *transfer,
+                    size_t needed) {
+  if (transfer->data && needed <= transfer->capacity) {
+    return true;
+  }
+  size_t capacity = transfer->capacity * 2;
+  if (capacity > pool->max_body) {
+    capacity = pool->max_body;
+  }
+  if (capacity < needed) {
+    capacity = needed;
+  }
+  size_t others = peer_usage(pool, transfer->peer) - transfer->capacity;
+  if (others + capacity > pool->max_peer) {
+    capacity = needed;
+    if (others + capacity > pool->max_peer) {
+      return false;
+    }
+  }
+  uint8_t *data = realloc(transfer->data, capacity + 1);
+  if (data == NULL) {
+    return false;
+  }
+  transfer->data = data;
+  transfer->capacity = capacity;
+  return true;
+}
+
+/* Starts a transfer, reusing a spare if available */
+static block_transfer *start_transfer(block_pool *pool, const void *peer,
+                                      const uint8_t *key, size_t key_len) {
+  block_transfer *transfer = pool->spares;
+  if (transfer) {
+    pool->spares = transfer->next;
+    pool->nspares--;
+  } else {
+    transfer = calloc(1, sizeof(*transfer));
+  }
+  transfer->peer = peer;
+  memcpy(transfer->key, key, key_len);
+  transfer->key_len = key_len;
+  transfer->len = 0;
+  transfer->next = pool->active;
+  pool->active = transfer;
+  pool->nactive++;
+  return transfer;
+}
+
+block_status block_pool_put(block_pool *pool, const void *peer,
+                            const uint8_t *key, size_t key_len,
+                            const coap_block_t *block, size_t size_hint,
+                            const uint8_t *data, size_t len,
+                            block_transfer **done) {
+  uint64_t now = monotonic_msecs();
+  expire_transfers(pool, now);
+
+  block_transfer *transfer = find_transfer(pool, peer, key, key_len);
+  size_t block_size = (size_t)16 << block->szx;
+  size_t offset = (size_t)block->num * block_size;
+
+  /* only the last block may be short; size exponent 7 is reserved */
+  if (key_len > BLOCK_KEY_MAXLEN || block->szx == 7 || len > block_size ||
+      (block->m && len != block_size)) {
+    goto incomplete;
+  }
+  if (block->num == 0) {
+    if (transfer == NULL) {
+      if (pool->nactive >= BLOCK_MAX_TRANSFERS) {
+        return BLOCK_BUSY;
+      }
+      transfer = start_transfer(pool, peer, key, key_len);
+    }
+    transfer->len = 0;
+  } else if (transfer && block->m && offset + len == transfer->len) {
+    /* repeat of the last block received */
+    transfer->last_used = now;
+    return BLOCK_MORE;
+  } else if (transfer == NULL || offset != transfer->len) {
+    goto incomplete;
+  }
+
+  if (offset + len > pool->max_body || size_hint > pool->max_body) {
+    drop_transfer(pool, transfer);
+    return BLOCK_TOO_LARGE;
+  }
+  size_t needed = offset + len;
+  if (block->num == 0 && size_hint > needed) {
+    needed = size_hint;
+  }
+  if (!reserve(pool, transfer, needed)) {
+    drop_transfer(pool, transfer);
+    return BLOCK_BUSY;
+  }
+  if (len) {
+    memcpy(transfer->data + offset, data, len);
+  }
+  transfer->len = offset + len;
+  transfer->data[transfer->len] = '\0';
+  transfer->last_used = now;
+
+  if (block->m) {
+    return BLOCK_MORE;
+  }
+  unlink_transfer(pool, transfer);
+  *done = transfer;
+  return BLOCK_DONE;
+
+incomplete:
+  if (transfer) {
+    drop_transfer(pool, transfer);
+  }
+  return BLOCK_INCOMPLETE;
+}
+
+void block_pool_cancel(block_pool *pool, const void *peer, const uint8_t *key,
+                       size_t key_len) {
+  block_transfer *transfer = find_transfer(pool, peer, key, key_len);
+  if (transfer) {
+    drop_transfer(pool, transfer);
+  }
+}
+
+void block_pool_cancel_peer(block_pool *pool, const void *peer) {
+  block_transfer *transfer = pool->active;
+  while (transfer) {
+    block_transfer *next = transfer->next;
+    if (transfer->peer == peer) {
+      drop_transfer(pool, transfer);
+    }
+    transfer = next;
+  }
+}
+
+const uint8_t *block_body(const block_transfer *transfer, size_t *len) {
+  *len = transfer->len;
+  return transfer->data;
+}
+
+uint8_t *block_take_body(block_transfer *transfer, size_t *len) {
+  uint8_t *data = transfer->data;
+  *len = transfer->len;
+  transfer->data = NULL;
+  transfer->capacity = 0;
+  transfer->len = 0;
+  return data;
+}
+
+unsigned int block_szx(size_t max_pdu, size_t overhead) {
+  unsigned int szx = 6;
+  while (szx > 0 && ((size_t)16 << szx) + overhead > max_pdu) {
+    szx--;
+  }
+  return szx;
+}
+
+bool block_add_option(coap_pdu_t *pdu, uint16_t type, unsigned int num,
+                      bool more, unsigned int szx) {
+  unsigned char buf[4];
+  unsigned int value = (num << 4) | (more ? 0x08 : 0) | (szx & 0x07);
+  return coap_add_option(pdu, type,
+                         coap_encode_var_safe(buf, sizeof(buf), value), buf);
+}
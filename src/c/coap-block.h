@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2026
+ * Contributors to the EdgeX Foundry
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef _COAP_BLOCK_H_
+#define _COAP_BLOCK_H_ 1
+
+/**
+ * @file
+ * @brief Defines reassembly of bodies transferred in blocks (RFC 7959).
+ */
+
+#include <coap2/coap.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Default maximum size of a body reassembled from blocks */
+#define BLOCK_DEFAULT_MAX_BODY 65536
+/** Default maximum reassembly memory held for one peer */
+#define BLOCK_DEFAULT_MAX_PEER 131072
+/** Maximum number of transfers in progress in a pool */
+#define BLOCK_MAX_TRANSFERS 64
+/** Maximum length of a transfer key */
+#define BLOCK_KEY_MAXLEN 256
+/** Msecs without a block after which a transfer is dropped */
+#define BLOCK_TRANSFER_TIMEOUT_MSECS 60000
+
+/** Outcome of adding a block to a transfer */
+typedef enum {
+  BLOCK_MORE,        /**< block stored; more blocks expected */
+  BLOCK_DONE,        /**< last block stored; body is complete */
+  BLOCK_INCOMPLETE,  /**< block out of sequence, or transfer not started */
+  BLOCK_TOO_LARGE,   /**< body exceeds the maximum size */
+  BLOCK_BUSY         /**< no memory for the transfer within limits */
+} block_status;
+
+/** A body being reassembled */
+typedef struct block_transfer block_transfer;
+
+/**
+ * Transfers in progress, with spare buffers kept for reuse. Not thread safe;
+ * each pool must be used only from the thread that runs its context.
+ */
+typedef struct block_pool block_pool;
+
+/**
+ * Creates a pool.
+ *
+ * @param max_body Maximum size of a body
+ * @param max_peer Maximum buffer memory for the transfers of one peer
+ * @return new pool
+ */
+extern block_pool *block_pool_new(size_t max_body, size_t max_peer);
+
+/** Frees a pool and any transfers in progress. */
+extern void block_pool_free(block_pool *pool);
+
+/**
+ * Adds a block to the transfer with a key. Block 0 starts a new transfer,
+ * replacing any with the same key. Other blocks must follow the data
+ * received so far. Transfers idle for longer than the timeout are dropped.
+ *
+ * @param pool Pool
+ * @param peer Peer the transfer is from, like a session; compared only
+ * @param key Key of the transfer with the peer, like a token or URI path
+ * @param key_len Length of key
+ * @param block Block number, more flag and size exponent
+ * @param size_hint Expected size of body, from Size1 or Size2; 0 if unknown
+ * @param data Block data
+ * @param len Length of block data
+ * @param done Completed transfer, if BLOCK_DONE; removed from the pool, and
+ *             must be released with block_release()
+ * @return outcome; on error the transfer is dropped
+ */
+extern block_status block_pool_put(block_pool *pool, const void *peer,
+                                   const uint8_t *key, size_t key_len,
+                                   const coap_block_t *block, size_t size_hint,
+                                   const uint8_t *data, size_t len,
+                                   block_transfer **done);
+
+/** Drops the transfer with a key, if in progress. */
+extern void block_pool_cancel(block_pool *pool, const void *peer,
+                              const uint8_t *key, size_t key_len);
+
+/** Drops all transfers from a peer, as when the peer is forgotten. */
+extern void block_pool_cancel_peer(block_pool *pool, const void *peer);
+
+/**
+ * Returns the body of a completed transfer, which is null-terminated so it
+ * may be parsed as text in place.
+ */
+extern const uint8_t *block_body(const block_transfer *transfer, size_t *len);
+
+/**
+ * Takes the body of a completed transfer, null-terminated, to avoid a copy.
+ *
+ * @return body, to free with free()
+ */
+extern uint8_t *block_take_body(block_transfer *transfer, size_t *len);
+
+/** Returns a completed transfer to the pool, keeping any buffer for reuse. */
+extern void block_release(block_pool *pool, block_transfer *transfer);
+
+/**
+ * Returns the largest block size exponent (size is 2**(szx + 4)) for blocks
+ * that fit in a PDU, less space for header, token and options.
+ *
+ * @param max_pdu Maximum PDU size for the session
+ * @param overhead Space reserved for all but the payload
+ * @return size exponent, 0 to 6
+ */
+extern unsigned int block_szx(size_t max_pdu, size_t overhead);
+
+/** Adds a Block1 or Block2 option to a PDU. */
+extern bool block_add_option(coap_pdu_t *pdu, uint16_t type,
+                             unsigned int num, bool more, unsigned int szx);
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,111 @@
+/* Last value of each device resource
+ *
+ * Copyright (c) 2026
+ * Contributors to the EdgeX Foundry
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "coap-cache.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* values are locked in stripes, as they are updated from many threads */
+#define CACHE_LOCKS 64
+
+static struct {
+  bool enabled;
+  pthread_mutex_t locks[CACHE_LOCKS];
+  uint64_t next_version;
+  uint64_t generation;
+} cache;
+
+/* Descriptors for the same resource share a lock, as they share a hash */
+static pthread_mutex_t *desc_lock(const resource_desc *desc) {
+  return &cache.locks[desc->hash % CACHE_LOCKS];
+}
+
+void cache_init(coap_driver *driver) {
+  cache.enabled = driver->serve_values;
+  for (int i = 0; i < CACHE_LOCKS; i++) {
+    pthread_mutex_init(&cache.locks[i], NULL);
+  }
+  /* versions start from the clock, so a version held by a client across a
+   * restart is not taken as current */
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  cache.next_version = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+bool cache_enabled(void) {
+  return cache.enabled;
+}
+
+void cache_update(resource_desc *desc, const iot_data_t *value) {
+  if (!cache.enabled || value == NULL) {
+    return;
+  }
+  iot_data_t *held = iot_data_type(value) == IOT_DATA_STRING
+                         ? iot_data_alloc_string(iot_data_string(value),
+                                                 IOT_DATA_COPY)
+                         : iot_data_add_ref(value);
+
+  pthread_mutex_lock(desc_lock(desc));
+  iot_data_t *old = desc->value;
+  desc->value = held;
+  desc->version = __atomic_add_fetch(&cache.next_version, 1, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(desc_lock(desc));
+
+  __atomic_add_fetch(&cache.generation, 1, __ATOMIC_RELEASE);
+  iot_data_free(old);
+}
+
+iot_data_t *cache_get(resource_desc *desc, uint64_t *version) {
+  if (!cache.enabled) {
+    return NULL;
+  }
+  pthread_mutex_lock(desc_lock(desc));
+  iot_data_t *value = desc->value ? iot_data_add_ref(desc->value) : NULL;
+  if (version) {
+    *version = desc->version;
+  }
+  pthread_mutex_unlock(desc_lock(desc));
+  return value;
+}
+
+uint64_t cache_version(resource_desc *desc) {
+  if (!cache.enabled) {
+    return 0;
+  }
+  pthread_mutex_lock(desc_lock(desc));
+  uint64_t version = desc->version;
+  pthread_mutex_unlock(desc_lock(desc));
+  return version;
+}
+
+void cache_carry(resource_desc *from, resource_desc *to) {
+  if (!cache.enabled) {
+    return;
+  }
+  iot_data_t *value = NULL;
+  pthread_mutex_lock(desc_lock(from));
+  /* a value set on the new descriptor already is newer */
+  if (to->value == NULL && from->type.type == to->type.type &&
+      from->type.element_type == to->type.element_type) {
+    to->value = from->value;
+    to->version = from->version;
+  } else {
+    value = from->value;
+  }
+  from->value = NULL;
+  from->version = 0;
+  pthread_mutex_unlock(desc_lock(from));
+  iot_data_free(value);
+}
+
+uint64_t cache_generation(void) {
+  return __atomic_load_n(&cache.generation, __ATOMIC_ACQUIRE);
+}
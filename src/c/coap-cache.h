@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2026
+ * Contributors to the EdgeX Foundry
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef _COAP_CACHE_H_
+#define _COAP_CACHE_H_ 1
+
+/**
+ * @file
+ * @brief Defines the last value of each device resource, served to CoAP
+ * clients of the server. Values are held on the resource descriptors of the
+ * index, so go with them when a device is removed.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "coap-index.h"
+#include "device-coap.h"
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Initializes the cache, enabled from the driver configuration. While
+ * disabled, updates are ignored and nothing is found.
+ *
+ * @param driver Driver configuration
+ */
+extern void cache_init(coap_driver *driver);
+
+/** Returns true if the cache is enabled. */
+extern bool cache_enabled(void);
+
+/**
+ * Sets the last value of a resource, as posted to EdgeX or read from the
+ * device. The value is referenced, but a string is copied, as it may
+ * reference a request buffer (ReferenceStringPayloads).
+ *
+ * @param desc Resource
+ * @param value Value; not taken
+ */
+extern void cache_update(resource_desc *desc, const iot_data_t *value);
+
+/**
+ * Finds the last value of a resource.
+ *
+ * @param desc Resource
+ * @param version Set to the version of the value, which changes with each
+ *        update, and across restarts; may be NULL
+ * @return referenced value, which the caller must free; NULL if none
+ */
+extern iot_data_t *cache_get(resource_desc *desc, uint64_t *version);
+
+/**
+ * Returns the version of the last value of a resource, as for cache_get(),
+ * without the value; 0 if none.
+ */
+extern uint64_t cache_version(resource_desc *desc);
+
+/**
+ * Moves the last value of a resource to the descriptor that replaces its
+ * own, when the device is reloaded into the index. The value is dropped if
+ * the resource type changed.
+ *
+ * @param from Descriptor dropped from the index
+ * @param to Descriptor for the same resource
+ */
+extern void cache_carry(resource_desc *from, resource_desc *to);
+
+/**
+ * Returns a count of all updates, to check cheaply whether any value has
+ * changed.
+ */
+extern uint64_t cache_generation(void);
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,487 @@
+/* CBOR (RFC 8949) encoding of resource values
+ *
+ * Copyright (c) 2026
+ * Contributors to the EdgeX Foundry
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "coap-cbor.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "coap-util.h"
+
+/* additional info values for multi-byte arguments and simple values */
+#define CBOR_INFO_UINT8 24
+#define CBOR_INFO_UINT64 27
+#define CBOR_FALSE 20
+#define CBOR_TRUE 21
+#define CBOR_FLOAT16 25
+#define CBOR_FLOAT32 26
+#define CBOR_FLOAT64 27
+
+/* nesting limit when skipping items */
+#define CBOR_MAX_DEPTH 8
+
+/* A numeric or bool item */
+typedef struct {
+  uint8_t kind;  /**< CBOR_UINT, CBOR_NEGINT, or CBOR_SIMPLE for f and b */
+  bool is_bool;
+  uint64_t u;    /**< for CBOR_NEGINT, value is -1 - u */
+  double f;
+  bool b;
+} cbor_number;
+
+void cbor_reader_init(cbor_reader *reader, const uint8_t *data, size_t len) {
+  reader->pos = data;
+  reader->end = data + len;
+  reader->info = 0;
+}
+
+static size_t remaining(const cbor_reader *reader) {
+  return (size_t)(reader->end - reader->pos);
+}
+
+bool cbor_read_head(cbor_reader *reader, uint8_t *major, uint64_t *arg) {
+  if (reader->pos >= reader->end) {
+    return false;
+  }
+  uint8_t initial = *reader->pos++;
+  *major = initial >> 5;
+  reader->info = initial & 0x1f;
+  if (reader->info < CBOR_INFO_UINT8) {
+    *arg = reader->info;
+    return true;
+  }
+  /* reserved values, and indefinite length */
+  if (reader->info > CBOR_INFO_UINT64) {
+    return false;
+  }
+  size_t nbytes = (size_t)1 << (reader->info - CBOR_INFO_UINT8);
+  if (remaining(reader) < nbytes) {
+    return false;
+  }
+  uint64_t val = 0;
+  for (size_t i = 0; i < nbytes; i++) {
+    val = (val << 8) | reader->pos[i];
+  }
+  reader->pos += nbytes;
+  *arg = val;
+  return true;
+}
+
+static bool skip_item(cbor_reader *reader, int depth) {
+  uint8_t major;
+  uint64_t arg;
+
+  if (depth > CBOR_MAX_DEPTH || !cbor_read_head(reader, &major, &arg)) {
+    return false;
+  }
+  switch (major) {
+    case CBOR_BYTES:
+    case CBOR_TEXT:
+      if (arg > remaining(reader)) {
+        return false;
+      }
+      reader->pos += arg;
+      return true;
+
+    case CBOR_MAP:
+      if (arg > remaining(reader) / 2) {
+        return false;
+      }
+      arg *= 2;
+      /* fall through */
+    case CBOR_ARRAY:
+      /* each item takes at least a byte */
+      if (arg > remaining(reader)) {
+        return false;
+      }
+      for (uint64_t i = 0; i < arg; i++) {
+        if (!skip_item(reader, depth + 1)) {
+          return false;
+        }
+      }
+      return true;
+
+    case CBOR_TAG:
+      return skip_item(reader, depth + 1);
+
+    default:
+      return true;
+  }
+}
+
+bool cbor_skip(cbor_reader *reader) { return skip_item(reader, 0); }
+
+static double half_to_double(uint16_t half) {
+  int exp = (half >> 10) & 0x1f;
+  int mant = half & 0x3ff;
+  double val;
+  if (exp == 0) {
+    val = ldexp(mant, -24);
+  } else if (exp != 31) {
+    val = ldexp(mant + 1024, exp - 25);
+  } else {
+    val = mant == 0 ? INFINITY : NAN;
+  }
+  return (half & 0x8000) ? -val : val;
+}
+
+/* Interprets an item head as a number or bool, if it is one */
+static bool head_number(const cbor_reader *reader, uint8_t major,
+                        uint64_t arg, cbor_number *num) {
+  memset(num, 0, sizeof(*num));
+  num->kind = major;
+  switch (major) {
+    case CBOR_UINT:
+    case CBOR_NEGINT:
+      num->u = arg;
+      return true;
+
+    case CBOR_SIMPLE:
+      switch (reader->info) {
+        case CBOR_FALSE:
+        case CBOR_TRUE:
+          num->is_bool = true;
+          num->b = reader->info == CBOR_TRUE;
+          return true;
+        case CBOR_FLOAT16:
+          num->f = half_to_double((uint16_t)arg);
+          return true;
+        case CBOR_FLOAT32: {
+          uint32_t bits = (uint32_t)arg;
+          float f;
+          memcpy(&f, &bits, sizeof(f));
+          num->f = f;
+          return true;
+        }
+        case CBOR_FLOAT64:
+          memcpy(&num->f, &arg, sizeof(num->f));
+          return true;
+        default:
+          return false;
+      }
+
+    default:
+      return false;
+  }
+}
+
+/* Converts a number to the type, checking range; false if not valid */
+static bool number_as(const cbor_number *num, iot_data_type_t type,
+                      scalar_value *out) {
+  scalar_value src;
+  switch (num->kind) {
+    case CBOR_UINT:
+      return scalar_from_int(type, false, num->u, out);
+    case CBOR_NEGINT:
+      /* value is -1 - u */
+      return num->u < UINT64_MAX && scalar_from_int(type, true, num->u + 1, out);
+    default:
+      if (num->is_bool) {
+        src.b = num->b;
+        return scalar_convert(IOT_DATA_BOOL, &src, type, out);
+      }
+      src.f64 = num->f;
+      return scalar_convert(IOT_DATA_FLOAT64, &src, type, out);
+  }
+}
+
+bool cbor_supports(const iot_typecode_t *type) {
+  switch (type->type) {
+    case IOT_DATA_STRING:
+    case IOT_DATA_BINARY:
+      return true;
+    case IOT_DATA_ARRAY:
+      return scalar_size(type->element_type) != 0;
+    default:
+      return scalar_size(type->type) != 0;
+  }
+}
+
+/* Reads string content of length len; caller must free result */
+static iot_data_t *read_string(cbor_reader *reader, uint64_t len) {
+  if (len > remaining(reader)) {
+    return NULL;
+  }
+  char *str = malloc(len + 1);
+  memcpy(str, reader->pos, len);
+  str[len] = '\0';
+  reader->pos += len;
+  return iot_data_alloc_string(str, IOT_DATA_TAKE);
+}
+
+static iot_data_t *read_binary(cbor_reader *reader, uint64_t len) {
+  if (len > remaining(reader)) {
+    return NULL;
+  }
+  iot_data_t *value =
+      iot_data_alloc_binary((void *)reader->pos, len, IOT_DATA_COPY);
+  reader->pos += len;
+  return value;
+}
+
+/* Reads array content of count items as elements of the type */
+static iot_data_t *read_array(cbor_reader *reader, uint64_t count,
+                              iot_data_type_t type) {
+  size_t size = scalar_size(type);
+  /* each item takes at least a byte */
+  if (size == 0 || count > remaining(reader)) {
+    return NULL;
+  }
+  uint8_t *elements = malloc(count ? count * size : 1);
+  for (uint64_t i = 0; i < count; i++) {
+    uint8_t major;
+    uint64_t arg;
+    cbor_number num;
+    scalar_value v;
+    if (!cbor_read_head(reader, &major, &arg) ||
+        !head_number(reader, major, arg, &num) || !number_as(&num, type, &v)) {
+      free(elements);
+      return NULL;
+    }
+    memcpy(elements + i * size, &v, size);
+  }
+  return iot_data_alloc_array(elements, count, type, IOT_DATA_TAKE);
+}
+
+iot_data_t *cbor_read_scalar(cbor_reader *reader) {
+  uint8_t major;
+  uint64_t arg;
+  cbor_number num;
+
+  if (!cbor_read_head(reader, &major, &arg)) {
+    return NULL;
+  }
+  switch (major) {
+    case CBOR_TEXT:
+      return read_string(reader, arg);
+    case CBOR_BYTES:
+      return read_binary(reader, arg);
+    default:
+      break;
+  }
+  if (!head_number(reader, major, arg, &num)) {
+    return NULL;
+  }
+  if (num.is_bool) {
+    return iot_data_alloc_bool(num.b);
+  }
+  switch (num.kind) {
+    case CBOR_UINT:
+      return num.u > INT64_MAX ? iot_data_alloc_ui64(num.u)
+                               : iot_data_alloc_i64((int64_t)num.u);
+    case CBOR_NEGINT:
+      return num.u > INT64_MAX ? NULL
+                               : iot_data_alloc_i64(-1 - (int64_t)num.u);
+    default:
+      return iot_data_alloc_f64(num.f);
+  }
+}
+
+iot_data_t *cbor_read_value(const uint8_t *data, size_t len,
+                            const iot_typecode_t *type) {
+  cbor_reader reader;
+  uint8_t major;
+  uint64_t arg;
+  iot_data_t *value = NULL;
+
+  cbor_reader_init(&reader, data, len);
+  if (!cbor_read_head(&reader, &major, &arg)) {
+    return NULL;
+  }
+  switch (type->type) {
+    case IOT_DATA_STRING:
+      if (major == CBOR_TEXT) {
+        value = read_string(&reader, arg);
+      }
+      break;
+
+    case IOT_DATA_BINARY:
+      if (major == CBOR_BYTES) {
+        value = read_binary(&reader, arg);
+      }
+      break;
+
+    case IOT_DATA_ARRAY:
+      if (major == CBOR_ARRAY) {
+        value = read_array(&reader, arg, type->element_type);
+      } else if (major == CBOR_BYTES && arg <= remaining(&reader) &&
+                 (type->element_type == IOT_DATA_UINT8 ||
+                  type->element_type == IOT_DATA_INT8)) {
+        value = iot_data_alloc_array((void *)reader.pos, arg,
+                                     type->element_type, IOT_DATA_COPY);
+        reader.pos += arg;
+      }
+      break;
+
+    default: {
+      cbor_number num;
+      scalar_value v;
+      if (head_number(&reader, major, arg, &num) &&
+          number_as(&num, type->type, &v)) {
+        value = scalar_alloc(type->type, &v);
+      }
+      break;
+    }
+  }
+
+  /* payload must hold exactly one item */
+  if (value && reader.pos != reader.end) {
+    iot_data_free(value);
+    value = NULL;
+  }
+  return value;
+}
+
+/* Encoder; counts the full length even if the buffer is too small */
+typedef struct {
+  uint8_t *buf;
+  size_t size;
+  size_t len;
+} cbor_writer;
+
+static void put_bytes(cbor_writer *writer, const void *bytes, size_t n) {
+  if (writer->len + n <= writer->size) {
+    memcpy(writer->buf + writer->len, bytes, n);
+  }
+  writer->len += n;
+}
+
+/* Writes initial byte and argument in network byte order */
+static void put_head(cbor_writer *writer, uint8_t major, uint8_t info,
+                     uint64_t arg, size_t nbytes) {
+  uint8_t head[9];
+  head[0] = (uint8_t)((major << 5) | info);
+  for (size_t i = 0; i < nbytes; i++) {
+    head[nbytes - i] = (uint8_t)(arg >> (8 * i));
+  }
+  put_bytes(writer, head, nbytes + 1);
+}
+
+/* Writes head with the shortest encoding of the argument */
+static void put_arg(cbor_writer *writer, uint8_t major, uint64_t arg) {
+  if (arg < CBOR_INFO_UINT8) {
+    put_head(writer, major, (uint8_t)arg, 0, 0);
+  } else if (arg <= UINT8_MAX) {
+    put_head(writer, major, CBOR_INFO_UINT8, arg, 1);
+  } else if (arg <= UINT16_MAX) {
+    put_head(writer, major, CBOR_INFO_UINT8 + 1, arg, 2);
+  } else if (arg <= UINT32_MAX) {
+    put_head(writer, major, CBOR_INFO_UINT8 + 2, arg, 4);
+  } else {
+    put_head(writer, major, CBOR_INFO_UINT64, arg, 8);
+  }
+}
+
+static void put_int(cbor_writer *writer, int64_t val) {
+  if (val < 0) {
+    put_arg(writer, CBOR_NEGINT, (uint64_t)(-(val + 1)));
+  } else {
+    put_arg(writer, CBOR_UINT, (uint64_t)val);
+  }
+}
+
+/* Writes a scalar of the type from its storage; false if not supported */
+static bool put_scalar(cbor_writer *writer, iot_data_type_t type,
+                       const void *ptr) {
+  scalar_value v;
+  size_t size = scalar_size(type);
+  if (size == 0) {
+    return false;
+  }
+  memcpy(&v, ptr, size);
+
+  switch (type) {
+    case IOT_DATA_INT8:
+      put_int(writer, v.i8);
+      break;
+    case IOT_DATA_UINT8:
+      put_arg(writer, CBOR_UINT, v.ui8);
+      break;
+    case IOT_DATA_INT16:
+      put_int(writer, v.i16);
+      break;
+    case IOT_DATA_UINT16:
+      put_arg(writer, CBOR_UINT, v.ui16);
+      break;
+    case IOT_DATA_INT32:
+      put_int(writer, v.i32);
+      break;
+    case IOT_DATA_UINT32:
+      put_arg(writer, CBOR_UINT, v.ui32);
+      break;
+    case IOT_DATA_INT64:
+      put_int(writer, v.i64);
+      break;
+    case IOT_DATA_UINT64:
+      put_arg(writer, CBOR_UINT, v.ui64);
+      break;
+    case IOT_DATA_FLOAT32: {
+      uint32_t bits;
+      memcpy(&bits, &v.f32, sizeof(bits));
+      put_head(writer, CBOR_SIMPLE, CBOR_FLOAT32, bits, 4);
+      break;
+    }
+    case IOT_DATA_FLOAT64: {
+      uint64_t bits;
+      memcpy(&bits, &v.f64, sizeof(bits));
+      put_head(writer, CBOR_SIMPLE, CBOR_FLOAT64, bits, 8);
+      break;
+    }
+    case IOT_DATA_BOOL:
+      put_head(writer, CBOR_SIMPLE, v.b ? CBOR_TRUE : CBOR_FALSE, 0, 0);
+      break;
+    default:
+      return false;
+  }
+  return true;
+}
+
+size_t cbor_write_value(const iot_data_t *value, uint8_t *buf, size_t size) {
+  cbor_writer writer = {.buf = buf, .size = size, .len = 0};
+  scalar_value v;
+
+  switch (iot_data_type(value)) {
+    case IOT_DATA_STRING: {
+      const char *str = iot_data_string(value);
+      size_t len = strlen(str);
+      put_arg(&writer, CBOR_TEXT, len);
+      put_bytes(&writer, str, len);
+      break;
+    }
+
+    case IOT_DATA_BINARY:
+    case IOT_DATA_ARRAY: {
+      iot_data_type_t type = iot_data_array_type(value);
+      uint32_t len = iot_data_array_length(value);
+      bool binary = iot_data_type(value) == IOT_DATA_BINARY;
+      if (!binary && scalar_size(type) == 0) {
+        return 0;
+      }
+      put_arg(&writer, binary ? CBOR_BYTES : CBOR_ARRAY, len);
+      iot_data_array_iter_t iter;
+      iot_data_array_iter(value, &iter);
+      while (iot_data_array_iter_next(&iter)) {
+        if (binary) {
+          put_bytes(&writer, iot_data_array_iter_value(&iter), 1);
+        } else {
+          put_scalar(&writer, type, iot_data_array_iter_value(&iter));
+        }
+      }
+      break;
+    }
+
+    default:
+      if (!scalar_load(value, &v)) {
+        return 0;
+      }
+      put_scalar(&writer, iot_data_type(value), &v);
+      break;
+  }
+  return writer.len;
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2026
+ * Contributors to the EdgeX Foundry
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef _COAP_CBOR_H_
+#define _COAP_CBOR_H_ 1
+
+/**
+ * @file
+ * @brief Defines decoding and encoding of CBOR (RFC 8949) resource values.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "device-coap.h"
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** CBOR major types */
+#define CBOR_UINT 0
+#define CBOR_NEGINT 1
+#define CBOR_BYTES 2
+#define CBOR_TEXT 3
+#define CBOR_ARRAY 4
+#define CBOR_MAP 5
+#define CBOR_TAG 6
+#define CBOR_SIMPLE 7
+
+/** Cursor over an encoded CBOR buffer */
+typedef struct {
+  const uint8_t *pos;
+  const uint8_t *end;
+  uint8_t info;   /**< additional info of the last head read */
+} cbor_reader;
+
+/** Initializes a reader over a buffer. */
+extern void cbor_reader_init(cbor_reader *reader, const uint8_t *data,
+                             size_t len);
+
+/**
+ * Reads the head of the next data item. For byte and text strings, arrays
+ * and maps, arg is the length; the content follows. Indefinite lengths are
+ * not supported.
+ *
+ * @param reader Reader
+ * @param major Major type of item
+ * @param arg Argument of item
+ * @return true if a well-formed head was read
+ */
+extern bool cbor_read_head(cbor_reader *reader, uint8_t *major, uint64_t *arg);
+
+/** Skips the next data item, including any content. */
+extern bool cbor_skip(cbor_reader *reader);
+
+/**
+ * Reads the next data item as a scalar value: integer, float, bool, text or
+ * byte string. Integers are read as Int64, or UInt64 if too large; floats as
+ * Float64.
+ *
+ * @return value, to free with iot_data_free(); NULL if not a scalar
+ */
+extern iot_data_t *cbor_read_scalar(cbor_reader *reader);
+
+/**
+ * Decodes a payload holding a single data item as a resource value. Integers
+ * must fit the resource type, and integral values are accepted for floats.
+ * Arrays must hold numeric or bool elements of the resource element type; a
+ * byte string also is accepted for an Int8 or UInt8 array.
+ *
+ * @param data Payload
+ * @param len Length of payload
+ * @param type Resource value type
+ * @return value, to free with iot_data_free(); NULL if not valid
+ */
+extern iot_data_t *cbor_read_value(const uint8_t *data, size_t len,
+                                   const iot_typecode_t *type);
+
+/** Returns true if cbor_read_value() supports the resource type. */
+extern bool cbor_supports(const iot_typecode_t *type);
+
+/**
+ * Encodes a value. Supports the numeric types, bool, string, binary and
+ * arrays of numeric or bool elements.
+ *
+ * @param value Value to encode
+ * @param buf Buffer for encoding; may be NULL if size is 0
+ * @param size Size of buffer
+ * @return length of encoding, which is written only if it fits in size; 0 if
+ *         the value type is not supported
+ */
+extern size_t cbor_write_value(const iot_data_t *value, uint8_t *buf,
+                               size_t size);
+#ifdef __cplusplus
+}
+#endif
+#endif
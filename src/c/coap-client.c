@@ -11,7 +11,10 @@
 #include <coap2/coap.h>
 #include <errno.h>
 #include <float.h>
+#include <inttypes.h>
 #include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stddef.h>
@@ -19,17 +22,160 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <unistd.h>
 
+#include "coap-block.h"
+#include "coap-cache.h"
+#include "coap-cbor.h"
+#include "coap-health.h"
+#include "coap-mcast.h"
+#include "coap-metrics.h"
+#include "coap-pool.h"
+#include "coap-publish.h"
 #include "coap-util.h"
 #include "device-coap.h"
 #include "edgex/devices.h"
 
-/* controls input loop */
-extern volatile sig_atomic_t quit;
-iot_data_t *coap_resp_data = NULL;
-static bool coap_resp_rcvd = false;
+/* longest wait for I/O; observations and idle sessions are checked as often */
+#define CLIENT_IO_IDLE_MSECS 1000
+/* libcoap sockets waited on besides one per pooled session */
+#define CLIENT_IO_EXTRA_SOCKETS 8
+#define CLIENT_TOKEN_LEN 8
+/* PDU space for header, token and options; the rest may carry a block */
+#define CLIENT_PDU_OVERHEAD 64
+/*
+ * NON requests are not retransmitted, so one without a response by this time
+ * is counted lost; as the first CON retransmission (RFC 7252, sec 4.8)
+ */
+#define CLIENT_NON_TIMEOUT_MSECS 3000
+/* deadline for a request, unless set by ED_Timeout */
+#define CLIENT_DEFAULT_TIMEOUT_MSECS 10000
+/* transmission parameters, unless set for the device (RFC 7252, sec 4.8) */
+#define CLIENT_DEFAULT_MAX_RETRANSMIT 4
+#define CLIENT_DEFAULT_ACK_TIMEOUT {2, 0}
+#define CLIENT_DEFAULT_ACK_RANDOM_FACTOR {1, 500}
+/* interval between logs of NON request counts, when changed */
+#define CLIENT_STATS_LOG_MSECS 60000
+/* Resource attribute to choose the message type for reads */
+#define MESSAGE_TYPE_ATTR "messageType"
+
+/* Max-Age assumed for a notification without the option (RFC 7252) */
+#define OBSERVE_DEFAULT_MAX_AGE 60
+/* allowance past Max-Age for the next notification to arrive */
+#define OBSERVE_MAX_AGE_MARGIN_MSECS 5000
+/* delay before registering again after failure, doubled up to the max */
+#define OBSERVE_RETRY_MSECS 5000
+#define OBSERVE_RETRY_MAX_MSECS 300000
+/* interval between checks for expired or broken observations */
+#define OBSERVE_CHECK_MSECS 1000
+/* notifications older than this need not be ordered (RFC 7641, sec 3.4) */
+#define OBSERVE_FRESHNESS_MSECS 128000
+
+/* Signalled when all requests sharing it have completed */
+typedef struct {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  uint32_t remaining;
+} client_completion;
+
+/*
+ * A request to an end device. Owned by the submitting handler thread, which
+ * blocks on the completion until the I/O thread has finished with it.
+ */
+typedef struct client_request {
+  uint8_t method;
+  char *uri;                     /**< allocated "/a1r/device/resource" */
+  const end_dev_params *params;
+  const uint8_t *data;           /**< PUT payload */
+  size_t len;
+  uint16_t format;               /**< PUT payload content format */
+  iot_typecode_t type;           /**< GET expected value type */
+  bool non;                      /**< sent as NON rather than CON */
+  uint64_t deadline;             /**< msecs to give up; 0 for none */
+  uint64_t non_deadline;         /**< msecs to give up on a NON response */
+  uint64_t sent_at;              /**< usecs when last sent, for round trip */
+  bool probe;                    /**< any response will do; value unused */
+  bool from_group;               /**< value read from a group; not sent */
+  bool responded;                /**< device responded, or reset */
+  bool unreachable;              /**< device did not respond */
+  uint8_t token[CLIENT_TOKEN_LEN];
+  pool_entry *entry;             /**< session the request was sent on */
+  bool blockwise;                /**< PUT payload is sent in blocks */
+  size_t offset;                 /**< PUT payload acknowledged so far */
+  size_t sent;                   /**< PUT payload in current block */
+  coap_block_t block2;           /**< next GET response block, if num > 0 */
+  unsigned int szx;              /**< block size exponent */
+  iot_data_t *value;             /**< GET result */
+  bool success;
+  client_completion *completion;
+  struct client_request *next;
+} client_request;
+
+typedef enum {
+  OBSERVE_IDLE,     /**< not registered; register at deadline */
+  OBSERVE_PENDING,  /**< registration sent */
+  OBSERVE_ACTIVE    /**< notifications expected until deadline */
+} observe_state;
+
+/*
+ * Observation (RFC 7641) of an end device resource. Registered on the pooled
+ * session to the device, which it keeps open, and registered again when the
+ * session is lost or no notification arrives within Max-Age.
+ */
+typedef struct observation {
+  char *device_name;
+  char *resource_name;
+  char *uri;                     /**< allocated "/a1r/device/resource" */
+  end_dev_params params;         /**< copy; device address may be freed */
+  iot_typecode_t type;
+  observe_state state;
+  uint8_t token[CLIENT_TOKEN_LEN];
+  pool_entry *entry;             /**< held while registered */
+  uint64_t deadline;             /**< msecs, per state */
+  uint32_t backoff;              /**< msecs before next retry */
+  bool has_seq;
+  uint32_t seq;                  /**< last Observe sequence number */
+  uint64_t seq_time;             /**< msecs when seq was received */
+  struct observation *next;
+} observation;
+
+/* Change to observations, applied by the I/O thread in order */
+typedef struct observe_op {
+  observation *add;              /**< to register, or NULL */
+  char *cancel_device;           /**< device to cancel, or NULL */
+  struct observe_op *next;
+} observe_op;
+
+/*
+ * Request engine. A single I/O thread owns the shared context, the session
+ * pool and the in-flight list, so libcoap is never entered concurrently.
+ * Handler threads only touch the submit queue, under the mutex.
+ */
+static struct {
+  coap_driver *driver;
+  coap_context_t *ctx;
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  bool running;
+  int wake_fd;                   /**< eventfd written to wake the I/O thread */
+  client_request *submit_head;
+  client_request *submit_tail;
+  observe_op *ops_head;
+  observe_op *ops_tail;
+  client_request *inflight;      /**< I/O thread only */
+  observation *observations;     /**< I/O thread only */
+  block_pool *blocks;            /**< I/O thread only; GET response blocks */
+  uint64_t next_observe_check;   /**< I/O thread only */
+  uint64_t non_sent;             /**< I/O thread only; NON requests sent */
+  uint64_t non_lost;             /**< I/O thread only; NON without response */
+  uint64_t logged_non_lost;      /**< I/O thread only */
+  uint64_t last_stats_log;       /**< I/O thread only */
+  coap_socket_t **sockets;       /**< I/O thread only; libcoap's to wait on */
+  unsigned int max_sockets;
+} engine;
 
 /*
  * Get End device protocol property, expect 5 arguments:
@@ -99,310 +245,1295 @@ bool GetEndDeviceProtocolProperties(const devsdk_protocols *protocols,
     default:
       break;
   }
+
+  /* optional; values are exchanged as text by default */
+  params_ptr = iot_data_string_map_get_string(props, "ED_ContentFormat");
+  end_dev_params_ptr->cbor = params_ptr && !strcmp(params_ptr, "CBOR");
+  /* optional; reads are confirmable by default */
+  params_ptr = iot_data_string_map_get_string(props, "ED_MessageType");
+  end_dev_params_ptr->non = params_ptr && !strcmp(params_ptr, "NON");
+
+  /* optional; shorter times fail a dead device sooner */
+  const coap_fixed_point_t ack_timeout = CLIENT_DEFAULT_ACK_TIMEOUT;
+  const coap_fixed_point_t ack_random_factor = CLIENT_DEFAULT_ACK_RANDOM_FACTOR;
+  end_dev_params_ptr->timeout_msecs =
+      config_get_uint(props, "ED_Timeout", CLIENT_DEFAULT_TIMEOUT_MSECS);
+  end_dev_params_ptr->max_retransmit =
+      config_get_uint(props, "ED_MaxRetransmit", CLIENT_DEFAULT_MAX_RETRANSMIT);
+  end_dev_params_ptr->ack_timeout =
+      config_get_fixed(props, "ED_AckTimeout", ack_timeout);
+  end_dev_params_ptr->ack_random_factor =
+      config_get_fixed(props, "ED_AckRandomFactor", ack_random_factor);
+  if (end_dev_params_ptr->ack_random_factor.integer_part < 1) {
+    iot_log_warn(sdk_ctx->lc, "COAP:ED_AckRandomFactor must be at least 1");
+    end_dev_params_ptr->ack_random_factor = ack_random_factor;
+  }
+  if (end_dev_params_ptr->ack_timeout.integer_part == 0 &&
+      end_dev_params_ptr->ack_timeout.fractional_part == 0) {
+    iot_log_warn(sdk_ctx->lc, "COAP:ED_AckTimeout must be more than 0");
+    end_dev_params_ptr->ack_timeout = ack_timeout;
+  }
+
+  /* optional; reads by multicast are not secured, so NoSec only */
+  params_ptr = iot_data_string_map_get_string(props, "ED_McastGroup");
+  if (params_ptr && *params_ptr) {
+    if (end_dev_params_ptr->security_mode != SECURITY_MODE_NOSEC) {
+      iot_log_warn(sdk_ctx->lc, "COAP:ED_McastGroup is ignored without NoSec");
+    } else if (strlen(params_ptr) >= sizeof(end_dev_params_ptr->mcast_group)) {
+      iot_log_warn(sdk_ctx->lc, "COAP:ED_McastGroup %s too long", params_ptr);
+    } else {
+      strcpy(end_dev_params_ptr->mcast_group, params_ptr);
+    }
+  }
+  end_dev_params_ptr->mcast_leisure_msecs = config_get_uint(
+      props, "ED_McastLeisure", MCAST_DEFAULT_LEISURE_MSECS);
   return true;
 }
 /*
- * coap get request callback handler. Get coap data from the coap pdu and update
- * it to coap_resp_data
+compare the properties of two end devices, as parsed by
+GetEndDeviceProtocolProperties(); the resolved address is not compared
+*/
+bool EndDeviceParamsEqual(const end_dev_params *a, const end_dev_params *b) {
+  return !strcmp(a->end_dev_addr, b->end_dev_addr) &&
+         a->security_mode == b->security_mode &&
+         !strncmp(a->psk_key, b->psk_key, sizeof(a->psk_key)) &&
+         a->cbor == b->cbor && a->non == b->non &&
+         a->timeout_msecs == b->timeout_msecs &&
+         a->max_retransmit == b->max_retransmit &&
+         a->ack_timeout.integer_part == b->ack_timeout.integer_part &&
+         a->ack_timeout.fractional_part == b->ack_timeout.fractional_part &&
+         a->ack_random_factor.integer_part ==
+             b->ack_random_factor.integer_part &&
+         a->ack_random_factor.fractional_part ==
+             b->ack_random_factor.fractional_part &&
+         !strcmp(a->mcast_group, b->mcast_group) &&
+         a->mcast_leisure_msecs == b->mcast_leisure_msecs;
+}
+static void completion_init(client_completion *completion, uint32_t count) {
+  pthread_mutex_init(&completion->mutex, NULL);
+  pthread_cond_init(&completion->cond, NULL);
+  completion->remaining = count;
+}
+
+static void completion_wait(client_completion *completion) {
+  pthread_mutex_lock(&completion->mutex);
+  while (completion->remaining) {
+    pthread_cond_wait(&completion->cond, &completion->mutex);
+  }
+  pthread_mutex_unlock(&completion->mutex);
+  pthread_cond_destroy(&completion->cond);
+  pthread_mutex_destroy(&completion->mutex);
+}
+
+/*
+ * Finishes a request. The submitting thread may release the request as soon
+ * as the completion is signalled, so it must not be used after this call.
  */
-static void message_handler(struct coap_context_t *ctx, coap_session_t *session,
-                            coap_pdu_t *sent, coap_pdu_t *received,
-                            const coap_tid_t id) {
-  edgex_device *device = NULL;
-  edgex_deviceresource *resource = NULL;
+static void request_complete(client_request *req, bool success) {
+  client_completion *completion = req->completion;
+  req->success = success;
+  pthread_mutex_lock(&completion->mutex);
+  if (--completion->remaining == 0) {
+    pthread_cond_signal(&completion->cond);
+  }
+  pthread_mutex_unlock(&completion->mutex);
+}
+
+/* Removes and returns the in-flight request matching token, or NULL */
+static client_request *take_inflight(const uint8_t *token, size_t token_len) {
+  if (token_len != CLIENT_TOKEN_LEN) {
+    return NULL;
+  }
+  client_request **link = &engine.inflight;
+  for (; *link; link = &(*link)->next) {
+    if (!memcmp((*link)->token, token, CLIENT_TOKEN_LEN)) {
+      client_request *req = *link;
+      *link = req->next;
+      return req;
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Reads response payload as the expected type; caller must free result. For
+ * a payload reassembled from blocks, data is from transfer, and a text
+ * payload is taken over rather than copied.
+ */
+static iot_data_t *read_response_value(const iot_typecode_t *type,
+                                       uint16_t format, const uint8_t *data,
+                                       size_t len, block_transfer *transfer) {
+  coap_driver *sdk_ctx = engine.driver;
+
+  if (format == COAP_MEDIATYPE_APPLICATION_CBOR) {
+    iot_log_debug(sdk_ctx->lc, "COAP:coap cbor data len = %zu", len);
+    return cbor_read_value(data, len, type);
+  }
+
+  const value_codec *codec = codec_for_type(type->type);
+  if (codec == NULL) {
+    iot_log_error(sdk_ctx->lc, "COAP:unsupported resource type %s",
+                  iot_data_type_string(type->type));
+    return NULL;
+  }
+  if (LOG_DEBUG_ENABLED(sdk_ctx->lc)) {
+    iot_log_debug(sdk_ctx->lc, "COAP:coap %s data len = %zu",
+                  iot_data_type_string(type->type), len);
+  }
+  if (transfer) {
+    uint8_t *body = block_take_body(transfer, &len);
+    return codec_take(codec, body, len, type);
+  }
+  return codec->read(data, len, type);
+}
+
+/*
+ * Builds a request PDU of the message type, with the token. Adds an Observe
+ * option if observe is not negative. For a payload, adds its content format;
+ * otherwise asks for CBOR if the device exchanges values as CBOR. Any block
+ * options and the payload are for the caller to add.
+ */
+static coap_pdu_t *request_pdu(coap_session_t *session, uint8_t type,
+                               uint8_t method, const uint8_t *token,
+                               const char *uri, int32_t observe,
+                               const end_dev_params *params, bool payload,
+                               uint16_t format) {
+  coap_driver *sdk_ctx = engine.driver;
+  unsigned char optbuf[4];
+
+  /* each path segment takes at most 5 bytes of option header */
+  size_t uri_len = strlen(uri);
+  size_t buflen = uri_len + 5;
+  for (const char *c = uri; *c; c++) {
+    buflen += *c == '/' ? 5 : 0;
+  }
+  unsigned char _buf[buflen];
+
+  /* construct CoAP message */
+  coap_pdu_t *pdu = coap_pdu_init(type, method,
+                                  coap_new_message_id(session) /* message id */,
+                                  coap_session_max_pdu_size(session));
+  if (!pdu) {
+    coap_log(LOG_EMERG, "COAP:cannot create PDU\n");
+    return NULL;
+  }
+  if (!coap_add_token(pdu, CLIENT_TOKEN_LEN, token)) {
+    goto fail;
+  }
+
+  /* options must be added in order of option number */
+  if (observe >= 0 &&
+      !coap_add_option(pdu, COAP_OPTION_OBSERVE,
+                       coap_encode_var_safe(optbuf, sizeof(optbuf), observe),
+                       optbuf)) {
+    goto fail;
+  }
+
+  unsigned char *buf = _buf;
+  int res = coap_split_path((const uint8_t *)uri, uri_len, buf, &buflen);
+  while (res--) {
+    if (!coap_add_option(pdu, COAP_OPTION_URI_PATH, coap_opt_length(buf),
+                         coap_opt_value(buf))) {
+      goto fail;
+    }
+    if (LOG_DEBUG_ENABLED(sdk_ctx->lc)) {
+      iot_log_debug(sdk_ctx->lc, "uri.path_val = %.*s", coap_opt_length(buf),
+                    (const char *)coap_opt_value(buf));
+    }
+
+    buf += coap_opt_size(buf);
+  }
+  if (payload || params->cbor) {
+    uint16_t option = payload ? COAP_OPTION_CONTENT_FORMAT : COAP_OPTION_ACCEPT;
+    uint16_t value = payload ? format : COAP_MEDIATYPE_APPLICATION_CBOR;
+    if (!coap_add_option(pdu, option,
+                         coap_encode_var_safe(optbuf, sizeof(optbuf), value),
+                         optbuf)) {
+      goto fail;
+    }
+  }
+  return pdu;
+
+fail:
+  coap_delete_pdu(pdu);
+  return NULL;
+}
+
+static observation *find_observation(const uint8_t *token, size_t token_len) {
+  if (token_len != CLIENT_TOKEN_LEN) {
+    return NULL;
+  }
+  for (observation *obs = engine.observations; obs; obs = obs->next) {
+    if (obs->state != OBSERVE_IDLE &&
+        !memcmp(obs->token, token, CLIENT_TOKEN_LEN)) {
+      return obs;
+    }
+  }
+  return NULL;
+}
+
+/* Releases the session and schedules registration after delay msecs */
+static void observe_idle(observation *obs, bool failed, uint64_t delay) {
+  if (obs->entry) {
+    client_pool_release(obs->entry, failed);
+    obs->entry = NULL;
+  }
+  obs->state = OBSERVE_IDLE;
+  obs->deadline = monotonic_msecs() + delay;
+}
+
+/* Schedules registration after the retry backoff, and extends it */
+static void observe_retry(observation *obs, bool failed) {
+  observe_idle(obs, failed, obs->backoff);
+  obs->backoff *= 2;
+  if (obs->backoff > OBSERVE_RETRY_MAX_MSECS) {
+    obs->backoff = OBSERVE_RETRY_MAX_MSECS;
+  }
+}
+
+/*
+ * Sends a registration, or a deregistration, for an observation. A
+ * deregistration reuses the token of the registration.
+ */
+static bool observe_send(observation *obs, bool deregister) {
+  coap_driver *sdk_ctx = engine.driver;
+
+  if (obs->entry == NULL) {
+    obs->entry = client_pool_acquire(&obs->params);
+    if (obs->entry == NULL) {
+      return false;
+    }
+  }
+  coap_pdu_t *pdu =
+      request_pdu(obs->entry->session, COAP_MESSAGE_CON, COAP_REQUEST_GET,
+                  obs->token, obs->uri,
+                  deregister ? COAP_OBSERVE_CANCEL : COAP_OBSERVE_ESTABLISH,
+                  &obs->params, false, 0);
+  if (pdu == NULL || coap_send(obs->entry->session, pdu) == COAP_INVALID_TID) {
+    iot_log_error(sdk_ctx->lc, "COAP:cannot send observe request for %s",
+                  obs->uri);
+    return false;
+  }
+  return true;
+}
+
+static void observe_register(observation *obs) {
+  coap_driver *sdk_ctx = engine.driver;
+
+  /* a broken session must be replaced */
+  if (obs->entry && obs->entry->broken) {
+    client_pool_release(obs->entry, true);
+    obs->entry = NULL;
+  }
+  random_token(obs->token, CLIENT_TOKEN_LEN);
+  if (!observe_send(obs, false)) {
+    observe_retry(obs, true);
+    return;
+  }
+  iot_log_debug(sdk_ctx->lc, "COAP:registered observe for %s", obs->uri);
+  obs->state = OBSERVE_PENDING;
+  obs->has_seq = false;
+  /* NACK handler reschedules if the request fails */
+  obs->deadline = monotonic_msecs() + OBSERVE_RETRY_MAX_MSECS;
+}
+
+/* True if a notification is newer than the last one (RFC 7641, sec 3.4) */
+static bool observe_is_fresh(const observation *obs, uint32_t seq,
+                             uint64_t now) {
+  uint32_t last = obs->seq;
+  return !obs->has_seq || (last < seq && seq - last < (1u << 23)) ||
+         (last > seq && last - seq > (1u << 23)) ||
+         now > obs->seq_time + OBSERVE_FRESHNESS_MSECS;
+}
+
+/* Posts a notification value via the publisher; takes ownership of value */
+static void observe_post(const observation *obs, iot_data_t *value) {
+  coap_driver *sdk_ctx = engine.driver;
+  resource_desc *desc =
+      index_lookup(obs->device_name, strlen(obs->device_name),
+                   obs->resource_name, strlen(obs->resource_name));
+  if (desc == NULL) {
+    iot_log_warn(sdk_ctx->lc, "COAP:observed resource not found: %s",
+                 obs->uri);
+    iot_data_free(value);
+    return;
+  }
+  if (!publish_reading(desc, value)) {
+    iot_log_warn(sdk_ctx->lc,
+                 "publish queue full; dropping notification for %s", obs->uri);
+    iot_data_free(value);
+  }
+  index_release(desc);
+}
+
+/* Handles a response to registration, or a notification */
+static void observe_notification(observation *obs, coap_pdu_t *received) {
+  coap_driver *sdk_ctx = engine.driver;
+  coap_opt_iterator_t it;
+  uint64_t now = monotonic_msecs();
+
+  if (COAP_RESPONSE_CLASS(received->code) != 2) {
+    iot_log_error(sdk_ctx->lc, "COAP:observe %s failed with code %d.%02d",
+                  obs->uri, COAP_RESPONSE_CLASS(received->code),
+                  received->code & 0x1F);
+    observe_retry(obs, false);
+    return;
+  }
+
+  uint32_t max_age = OBSERVE_DEFAULT_MAX_AGE;
+  coap_opt_t *opt = coap_check_option(received, COAP_OPTION_MAXAGE, &it);
+  if (opt) {
+    max_age = coap_decode_var_bytes(coap_opt_value(opt), coap_opt_length(opt));
+  }
+
+  opt = coap_check_option(received, COAP_OPTION_OBSERVE, &it);
+  if (opt) {
+    uint32_t seq =
+        coap_decode_var_bytes(coap_opt_value(opt), coap_opt_length(opt));
+    if (!observe_is_fresh(obs, seq, now)) {
+      iot_log_debug(sdk_ctx->lc, "COAP:stale notification for %s", obs->uri);
+      return;
+    }
+    obs->has_seq = true;
+    obs->seq = seq;
+    obs->seq_time = now;
+    obs->state = OBSERVE_ACTIVE;
+    obs->backoff = OBSERVE_RETRY_MSECS;
+    obs->deadline = now + max_age * 1000ULL + OBSERVE_MAX_AGE_MARGIN_MSECS;
+  } else {
+    /* not observable, or no longer observed; try again when value expires */
+    iot_log_debug(sdk_ctx->lc, "COAP:%s not observed; retry in %u s",
+                  obs->uri, max_age);
+    observe_idle(obs, false, max_age * 1000ULL);
+  }
+
+  /* the rest of a notification in blocks would need a separate GET */
+  coap_block_t block;
+  if (coap_get_block(received, COAP_OPTION_BLOCK2, &block) && block.m) {
+    iot_log_warn(sdk_ctx->lc, "COAP:notification for %s exceeds a block",
+                 obs->uri);
+    return;
+  }
+
   uint8_t *data = NULL;
   size_t len = 0;
-  coap_driver *sdk_ctx = (coap_driver *)impl;
-  coap_resp_data = NULL;
-  coap_show_pdu(LOG_WARNING, received);
-  switch (sent->code) {
-    case COAP_REQUEST_GET: {
-      /* Validate URI, expect 3 segments: /a1r/{device-name}/{resource-name} */
-      if (!parse_path(sent, &device, &resource)) {
-        goto finish;
+  uint16_t format = COAP_MEDIATYPE_TEXT_PLAIN;
+  coap_get_data(received, &len, &data);
+  opt = coap_check_option(received, COAP_OPTION_CONTENT_FORMAT, &it);
+  if (opt) {
+    format = coap_decode_var_bytes(coap_opt_value(opt), coap_opt_length(opt));
+  }
+  iot_data_t *value =
+      read_response_value(&obs->type, format, data, len, NULL);
+  if (value) {
+    observe_post(obs, value);
+  }
+}
+
+static void observation_free(observation *obs) {
+  if (obs->entry) {
+    client_pool_release(obs->entry, false);
+  }
+  free(obs->device_name);
+  free(obs->resource_name);
+  free(obs->uri);
+  free(obs);
+}
+
+/* Applies queued changes to observations */
+static void observe_apply(observe_op *op) {
+  while (op) {
+    observe_op *next = op->next;
+    if (op->cancel_device) {
+      observation **link = &engine.observations;
+      while (*link) {
+        observation *obs = *link;
+        if (strcmp(obs->device_name, op->cancel_device)) {
+          link = &obs->next;
+          continue;
+        }
+        /* let the device stop notifications; the response is ignored */
+        if (obs->state != OBSERVE_IDLE && !obs->entry->broken) {
+          observe_send(obs, true);
+        }
+        *link = obs->next;
+        observation_free(obs);
+      }
+      free(op->cancel_device);
+    }
+    if (op->add) {
+      observation *obs = engine.observations;
+      for (; obs; obs = obs->next) {
+        if (!strcmp(obs->uri, op->add->uri)) {
+          break;
+        }
+      }
+      if (obs) {
+        observation_free(op->add);
+      } else {
+        op->add->next = engine.observations;
+        engine.observations = op->add;
+        observe_register(op->add);
       }
+    }
+    free(op);
+    op = next;
+  }
+}
+
+/* Registers observations that are due, expired or on a broken session */
+static void observe_check(void) {
+  uint64_t now = monotonic_msecs();
+  if (now < engine.next_observe_check) {
+    return;
+  }
+  engine.next_observe_check = now + OBSERVE_CHECK_MSECS;
 
-      if (!coap_get_data(received, &len, &data)) {
-        iot_log_error(sdk_ctx->lc, "COAP:invalid data of len %zu", len);
+  for (observation *obs = engine.observations; obs; obs = obs->next) {
+    bool broken = obs->entry && obs->entry->broken;
+    if (broken || now >= obs->deadline) {
+      if (obs->state == OBSERVE_ACTIVE) {
+        iot_log_debug(engine.driver->lc, "COAP:observe %s %s; re-registering",
+                      obs->uri, broken ? "session lost" : "expired");
       }
+      if (broken || obs->state != OBSERVE_IDLE) {
+        observe_idle(obs, broken, 0);
+      }
+      observe_register(obs);
+    }
+  }
+}
 
-      iot_log_debug(sdk_ctx->lc, "COAP: coap device resource type %s",
-                    iot_data_type_string (resource->properties->type.type));
+/*
+ * Finishes a request sent on a session. Drops any response blocks received,
+ * and returns the session to the pool.
+ */
+static void request_end(client_request *req, bool success, bool failed) {
+  block_pool_cancel(engine.blocks, req->entry, (const uint8_t *)&req,
+                    sizeof(req));
+  client_pool_release(req->entry, failed);
+  request_complete(req, success);
+}
 
-      /* Validate and read payload. Content format from option must be
-       * acceptable for resource value type. */
+/*
+ * Adds the payload, or its next block (RFC 7959) if sent in blocks, and asks
+ * for the next response block if one is due.
+ */
+static bool add_request_payload(coap_pdu_t *pdu, client_request *req) {
+  unsigned char optbuf[4];
 
-      switch (resource->properties->type.type) {
-        case IOT_DATA_FLOAT64:
-          /* data conversion requires a null terminated string */
-          coap_resp_data = read_data_float64(data, len);
-          iot_log_debug(sdk_ctx->lc, "COAP:coap float data=%s, len = %zu", data,
-                        len);
-          break;
+  if (req->block2.num > 0 &&
+      !block_add_option(pdu, COAP_OPTION_BLOCK2, req->block2.num, false,
+                        req->block2.szx)) {
+    return false;
+  }
+  if (req->data == NULL) {
+    return true;
+  }
+  if (!req->blockwise) {
+    req->sent = req->len;
+    return coap_add_data(pdu, req->len, req->data);
+  }
 
-        case IOT_DATA_INT32:
-          iot_log_debug(sdk_ctx->lc, "COAP:coap int32 data=%s, len = %zu", data,
-                        len);
-          coap_resp_data = read_data_int32(data, len);
-          break;
+  size_t block_size = (size_t)16 << req->szx;
+  unsigned int num = req->offset / block_size;
+  req->sent = req->len - req->offset;
+  if (req->sent > block_size) {
+    req->sent = block_size;
+  }
+  if (!block_add_option(pdu, COAP_OPTION_BLOCK1, num,
+                        req->offset + req->sent < req->len, req->szx)) {
+    return false;
+  }
+  /* total size lets the device reject the payload at the first block */
+  if (num == 0 &&
+      !coap_add_option(pdu, COAP_OPTION_SIZE1,
+                       coap_encode_var_safe(optbuf, sizeof(optbuf), req->len),
+                       optbuf)) {
+    return false;
+  }
+  return coap_add_data(pdu, req->sent, req->data + req->offset);
+}
 
-        case IOT_DATA_STRING:
-          coap_resp_data = read_data_string(data, len);
-          iot_log_debug(sdk_ctx->lc, "COAP:coap json data=%s, len = %zu", data,
-                        len);
-          break;
+/*
+ * Sends the request, or its next block, on the session already acquired,
+ * with a new token. Ends the request on failure.
+ */
+static void transmit_request(client_request *req) {
+  coap_session_t *session = req->entry->session;
 
-        default:
-          iot_log_error(sdk_ctx->lc, "COAP:unsupported resource type %s",
-                        iot_data_type_string (resource->properties->type.type));
-          goto finish;
-      }
-      break;
+  random_token(req->token, CLIENT_TOKEN_LEN);
+  coap_pdu_t *pdu = request_pdu(
+      session, req->non ? COAP_MESSAGE_NON : COAP_MESSAGE_CON, req->method,
+      req->token, req->uri, -1, req->params, req->data != NULL, req->format);
+  if (pdu && !add_request_payload(pdu, req)) {
+    coap_delete_pdu(pdu);
+    pdu = NULL;
+  }
+  if (pdu == NULL) {
+    request_end(req, false, false);
+    return;
+  }
+  trace_pdu("sent", pdu);
+
+  if (req->non) {
+    req->non_deadline = monotonic_msecs() + CLIENT_NON_TIMEOUT_MSECS;
+    engine.non_sent++;
+  }
+
+  /* and send the PDU; libcoap takes ownership */
+  req->next = engine.inflight;
+  engine.inflight = req;
+  req->sent_at = monotonic_usecs();
+  if (coap_send(session, pdu) == COAP_INVALID_TID) {
+    coap_log(LOG_EMERG, "COAP:coap_send cannot send pdu\n");
+    take_inflight(req->token, CLIENT_TOKEN_LEN);
+    request_end(req, false, true);
+    return;
+  }
+  metric_add(METRIC_CLIENT_REQUESTS, 1);
+}
+
+/*
+ * Reads a GET response, or adds it to the blocks received so far. Returns
+ * false if the next block has been requested; otherwise sets the request
+ * value, or leaves it NULL on failure.
+ */
+static bool read_get_response(client_request *req, coap_pdu_t *received) {
+  coap_driver *sdk_ctx = engine.driver;
+  coap_opt_iterator_t it;
+  uint8_t *data = NULL;
+  size_t len = 0;
+  if (!coap_get_data(received, &len, &data)) {
+    iot_log_error(sdk_ctx->lc, "COAP:invalid data of len %zu", len);
+  }
+  uint16_t format = COAP_MEDIATYPE_TEXT_PLAIN;
+  coap_opt_t *opt =
+      coap_check_option(received, COAP_OPTION_CONTENT_FORMAT, &it);
+  if (opt) {
+    format = coap_decode_var_bytes(coap_opt_value(opt), coap_opt_length(opt));
+  }
+
+  coap_block_t block;
+  if (!coap_get_block(received, COAP_OPTION_BLOCK2, &block)) {
+    req->value = read_response_value(&req->type, format, data, len, NULL);
+    return true;
+  }
+  size_t size_hint = 0;
+  opt = coap_check_option(received, COAP_OPTION_SIZE2, &it);
+  if (opt) {
+    size_hint =
+        coap_decode_var_bytes(coap_opt_value(opt), coap_opt_length(opt));
+  }
+  block_transfer *transfer = NULL;
+  switch (block_pool_put(engine.blocks, req->entry, (const uint8_t *)&req,
+                         sizeof(req), &block, size_hint, data, len,
+                         &transfer)) {
+    case BLOCK_MORE:
+      req->block2.num = block.num + 1;
+      req->block2.szx = block.szx;
+      transmit_request(req);
+      return false;
+
+    case BLOCK_DONE: {
+      const uint8_t *body = block_body(transfer, &len);
+      req->value = read_response_value(&req->type, format, body, len, transfer);
+      block_release(engine.blocks, transfer);
+      return true;
     }
-    case COAP_REQUEST_PUT:
-      break;
+
     default:
-      break;
+      iot_log_error(sdk_ctx->lc, "COAP:cannot reassemble response for %s",
+                    req->uri);
+      return true;
   }
+}
+
+/*
+ * coap response handler. Matches the response to its request by token, reads
+ * the value for a GET, and completes the request. Continues a request that
+ * is sent, or answered, in blocks.
+ */
+static void message_handler(struct coap_context_t *ctx, coap_session_t *session,
+                            coap_pdu_t *sent, coap_pdu_t *received,
+                            const coap_tid_t id) {
+  (void)ctx;
+  (void)session;
+  (void)sent;
+  (void)id;
+  coap_driver *sdk_ctx = engine.driver;
+  trace_pdu("received", received);
 
-finish:
-  if (device != NULL) {
-    edgex_free_device(sdk_ctx->service, (edgex_device *)device);
+  client_request *req = take_inflight(received->token, received->token_length);
+  if (req == NULL) {
+    observation *obs =
+        find_observation(received->token, received->token_length);
+    if (obs) {
+      observe_notification(obs, received);
+    } else {
+      iot_log_debug(sdk_ctx->lc, "COAP:response does not match any request");
+    }
+    return;
+  }
+  req->responded = true;
+  metric_observe(METRIC_CLIENT_RTT, monotonic_usecs() - req->sent_at);
+  metric_response(METRIC_CLIENT_RESPONSES_2XX, received->code);
+  if (req->probe) {
+    request_end(req, true, false);
+    return;
+  }
+
+  bool success = false;
+  coap_block_t block;
+  if (COAP_RESPONSE_CLASS(received->code) != 2) {
+    iot_log_error(sdk_ctx->lc, "COAP:%s failed with response code %d.%02d",
+                  req->uri, COAP_RESPONSE_CLASS(received->code),
+                  received->code & 0x1F);
+  } else if (req->method == COAP_REQUEST_GET) {
+    if (!read_get_response(req, received)) {
+      return;
+    }
+    success = req->value != NULL;
+  } else if (req->blockwise && req->offset + req->sent < req->len) {
+    /* 2.31 Continue; the device may ask for smaller blocks */
+    if (received->code == COAP_RESPONSE_CODE(231) &&
+        coap_get_block(received, COAP_OPTION_BLOCK1, &block)) {
+      req->offset += req->sent;
+      if (block.szx < req->szx) {
+        req->szx = block.szx;
+      }
+      transmit_request(req);
+      return;
+    }
+    iot_log_error(sdk_ctx->lc, "COAP:%s blocks not continued by device",
+                  req->uri);
+  } else {
+    success = true;
+  }
+  request_end(req, success, false);
+}
+/* Counter for a NACK reason */
+static metric_counter nack_metric(coap_nack_reason_t reason) {
+  switch (reason) {
+    case COAP_NACK_RST:
+      return METRIC_CLIENT_NACK_RST;
+    case COAP_NACK_TOO_MANY_RETRIES:
+      return METRIC_CLIENT_NACK_RETRIES;
+    case COAP_NACK_TLS_FAILED:
+      return METRIC_CLIENT_NACK_TLS;
+    default:
+      return METRIC_CLIENT_NACK_OTHER;
   }
-  coap_resp_rcvd = true;
 }
+
 /*
 Handling NACK messages for coap requests
 */
 static void nack_handler(coap_context_t *context, coap_session_t *session,
                          coap_pdu_t *sent, coap_nack_reason_t reason,
                          const coap_tid_t id) {
-  coap_driver *sdk_ctx = (coap_driver *)impl;
+  (void)context;
+  (void)session;
+  (void)id;
+  coap_driver *sdk_ctx = engine.driver;
+
+  client_request *req = take_inflight(sent->token, sent->token_length);
+  if (req == NULL) {
+    observation *obs = find_observation(sent->token, sent->token_length);
+    if (obs) {
+      iot_log_error(sdk_ctx->lc, "COAP:NACK for observe of %s", obs->uri);
+      observe_retry(obs, true);
+    }
+    return;
+  }
+  metric_add(nack_metric(reason), 1);
   switch (reason) {
+    case COAP_NACK_RST:
+      /* the device is up, if not serving the resource */
+      req->responded = true;
+      iot_log_error(sdk_ctx->lc, "COAP:NACK response from server for %s",
+                    req->uri);
+      break;
     case COAP_NACK_TOO_MANY_RETRIES:
     case COAP_NACK_NOT_DELIVERABLE:
-    case COAP_NACK_RST:
     case COAP_NACK_TLS_FAILED:
     case COAP_NACK_ICMP_ISSUE:
-      coap_resp_rcvd = true;
-      iot_log_error(sdk_ctx->lc, "COAP:NACK response from server");
+      req->unreachable = true;
+      iot_log_error(sdk_ctx->lc, "COAP:NACK response from server for %s",
+                    req->uri);
       break;
     default:
-      coap_resp_rcvd = true;
       break;
   }
-  return;
+  /* session is suspect; reconnect for the next request */
+  request_end(req, false, true);
 }
 
 /*
-waits for coap response for CON request from end device
-*/
-static void WaitForCoapResponseFromEndDevice(coap_context_t *ctx,
-                                             coap_session_t *session) {
-  while (1) {
-    coap_io_process(ctx, COAP_IO_WAIT);
-    if (coap_resp_rcvd == true || quit == 1) {
-      coap_session_release(session);
-      coap_free_context(ctx);
-      coap_resp_rcvd = false;
-      break;
-    }
+ * Sends a request on the end device's pooled session. Runs on the I/O
+ * thread. Completes the request immediately on failure.
+ */
+static void send_request(client_request *req) {
+  coap_driver *sdk_ctx = engine.driver;
+
+  req->entry = client_pool_acquire(req->params);
+  if (req->entry == NULL) {
+    request_complete(req, false);
+    return;
   }
+  iot_log_debug(sdk_ctx->lc, "COAP: End dev addr = %s",
+                req->params->end_dev_addr);
+
+  /* a payload too large for one PDU is sent in blocks */
+  size_t max_pdu = coap_session_max_pdu_size(req->entry->session);
+  req->szx = block_szx(max_pdu, CLIENT_PDU_OVERHEAD);
+  req->blockwise = req->data && req->len + CLIENT_PDU_OVERHEAD > max_pdu;
+  transmit_request(req);
 }
+
 /*
-send put request to end device
-*/
-int CoapSendCommandToEndDevice(uint8_t *data, size_t len, char *dev_name,
-                               char *resource_name,
-                               end_dev_params *end_dev_params_ptr,
-                               coap_driver *driver) {
-  coap_context_t *ctx = NULL;
-  coap_session_t *session = NULL;
-  coap_address_t dst;
-  coap_pdu_t *pdu = NULL;
-  coap_driver *sdk_ctx = (coap_driver *)driver;
-  int result = EXIT_FAILURE;
-  uint8_t *post_data = data;
-  char uri[COAP_URI_MAXLEN + 1] = {0};
+ * Fails requests past their deadline, and NON requests without a response in
+ * time, so a dead device does not hold up reads for the full retransmission
+ * cycle. Retransmission of a CON request is cancelled. The device may just be
+ * slow, so the session is kept. Only a request past its deadline counts
+ * towards marking the device unreachable.
+ */
+static void expire_requests(void) {
+  coap_driver *sdk_ctx = engine.driver;
+  uint64_t now = monotonic_msecs();
+  client_request **link = &engine.inflight;
+  while (*link) {
+    client_request *req = *link;
+    bool non_lost = req->non && now >= req->non_deadline;
+    if (!non_lost && (req->deadline == 0 || now < req->deadline)) {
+      link = &req->next;
+      continue;
+    }
+    *link = req->next;
+    if (non_lost) {
+      /* a lost NON says little on a lossy link, so not counted a failure */
+      engine.non_lost++;
+      metric_add(METRIC_CLIENT_NON_LOST, 1);
+      iot_log_debug(sdk_ctx->lc, "COAP:no response to NON request for %s",
+                    req->uri);
+    } else {
+      iot_log_error(sdk_ctx->lc, "COAP:request for %s timed out", req->uri);
+      req->unreachable = true;
+      metric_add(METRIC_CLIENT_TIMEOUTS, 1);
+      coap_cancel_all_messages(engine.ctx, req->entry->session, req->token,
+                               CLIENT_TOKEN_LEN);
+    }
+    request_end(req, false, false);
+  }
 
-  coap_startup();
-  coap_proto_t proto = COAP_PROTO_UDP;
-  char *port = "5683";
+  if (now - engine.last_stats_log >= CLIENT_STATS_LOG_MSECS &&
+      engine.non_lost != engine.logged_non_lost) {
+    engine.last_stats_log = now;
+    engine.logged_non_lost = engine.non_lost;
+    iot_log_info(sdk_ctx->lc,
+                 "COAP:NON requests sent %" PRIu64 ", unanswered %" PRIu64,
+                 engine.non_sent, engine.non_lost);
+  }
+}
+
+/* Wakes the I/O thread from waiting on I/O, to take newly queued work */
+static void wake_io_thread(void) {
+  uint64_t one = 1;
+  /* fails only if the count is full, so the thread is waking anyway */
+  ssize_t n = write(engine.wake_fd, &one, sizeof(one));
+  (void)n;
+}
 
-  if (end_dev_params_ptr->security_mode != SECURITY_MODE_NOSEC) {
-    proto = COAP_PROTO_DTLS;
-    port = "5684";
+/* Returns the msecs until the earliest deadline of a request in flight */
+static uint64_t next_deadline(uint64_t now, uint64_t max) {
+  uint64_t due = now + max;
+  for (client_request *req = engine.inflight; req; req = req->next) {
+    if (req->deadline && req->deadline < due) {
+      due = req->deadline;
+    }
+    if (req->non && req->non_deadline < due) {
+      due = req->non_deadline;
+    }
   }
+  return due > now ? due - now : 0;
+}
 
-  if (resolve_address(end_dev_params_ptr->end_dev_addr, port, &dst) < 0) {
-    coap_log(LOG_CRIT, "COAP:failed to resolve address\n");
-    return result;
+/*
+ * Waits for I/O on libcoap's sockets, or to be woken, until the next
+ * retransmission or request deadline at most; then processes responses. As
+ * coap_io_process(), which cannot also wait on the wake eventfd.
+ */
+static void io_wait(void) {
+  coap_tick_t ticks;
+  unsigned int nsockets = 0;
+  coap_ticks(&ticks);
+  unsigned int coap_msecs = coap_write(engine.ctx, engine.sockets,
+                                       engine.max_sockets, &nsockets, ticks);
+  uint64_t wait = next_deadline(monotonic_msecs(), CLIENT_IO_IDLE_MSECS);
+  if (coap_msecs && coap_msecs < wait) {
+    wait = coap_msecs;
   }
-  iot_log_debug(sdk_ctx->lc, "COAP: End dev addr = %s",
-                end_dev_params_ptr->end_dev_addr);
 
-  iot_log_debug(sdk_ctx->lc, "COAP: Data = %d, Len = %zu", *post_data, len);
-  /* create CoAP context and a client session */
-  ctx = coap_new_context(NULL);
-  if (ctx == NULL) {
-    iot_log_error(sdk_ctx->lc, "COAP:coap new context creation failed\n");
-    return result;
-  }
-  if (end_dev_params_ptr->security_mode == SECURITY_MODE_PSK) {
-    iot_log_debug(sdk_ctx->lc, "COAP-client:ED psk key = %s, len=%zu",
-                  (uint8_t *)end_dev_params_ptr->psk_key,
-                  strlen(end_dev_params_ptr->psk_key));
-    if (!ctx || !(session = coap_new_client_session_psk(
-                      ctx, NULL, &dst, proto, "r17",
-                      (uint8_t *)(end_dev_params_ptr->psk_key),
-                      strlen(end_dev_params_ptr->psk_key)))) {
-      iot_log_error(sdk_ctx->lc, "COAP:cannot initialize PSK");
-      return result;
+  struct pollfd pfds[nsockets + 1];
+  pfds[0].fd = engine.wake_fd;
+  pfds[0].events = POLLIN;
+  for (unsigned int i = 0; i < nsockets; i++) {
+    unsigned int flags = engine.sockets[i]->flags;
+    pfds[i + 1].fd = engine.sockets[i]->fd;
+    pfds[i + 1].events = 0;
+    if (flags & (COAP_SOCKET_WANT_READ | COAP_SOCKET_WANT_ACCEPT)) {
+      pfds[i + 1].events |= POLLIN;
     }
-  } else {
-    if (!ctx || !(session = coap_new_client_session(ctx, NULL, &dst, proto))) {
-      coap_log(LOG_EMERG, "COAP:cannot create client session\n");
-      return result;
+    if (flags & (COAP_SOCKET_WANT_WRITE | COAP_SOCKET_WANT_CONNECT)) {
+      pfds[i + 1].events |= POLLOUT;
     }
   }
-  coap_register_response_handler(ctx, message_handler);
-  coap_register_nack_handler(ctx, nack_handler);
+  if (poll(pfds, nsockets + 1, (int)wait) > 0) {
+    if (pfds[0].revents & POLLIN) {
+      uint64_t count;
+      ssize_t n = read(engine.wake_fd, &count, sizeof(count));
+      (void)n;
+    }
+    for (unsigned int i = 0; i < nsockets; i++) {
+      coap_socket_t *sock = engine.sockets[i];
+      short readable = pfds[i + 1].revents & (POLLIN | POLLERR | POLLHUP);
+      short writable = pfds[i + 1].revents & (POLLOUT | POLLERR | POLLHUP);
+      if (readable && (sock->flags & COAP_SOCKET_WANT_READ)) {
+        sock->flags |= COAP_SOCKET_CAN_READ;
+      }
+      if (readable && (sock->flags & COAP_SOCKET_WANT_ACCEPT)) {
+        sock->flags |= COAP_SOCKET_CAN_ACCEPT;
+      }
+      if (writable && (sock->flags & COAP_SOCKET_WANT_WRITE)) {
+        sock->flags |= COAP_SOCKET_CAN_WRITE;
+      }
+      if (writable && (sock->flags & COAP_SOCKET_WANT_CONNECT)) {
+        sock->flags |= COAP_SOCKET_CAN_CONNECT;
+      }
+    }
+  }
+  coap_ticks(&ticks);
+  coap_read(engine.ctx, ticks);
 
-  /* construct CoAP message */
-  pdu = coap_pdu_init(COAP_MESSAGE_CON, COAP_REQUEST_PUT,
-                      coap_new_message_id(session) /* message id */,
-                      coap_session_max_pdu_size(session));
-  if (!pdu) {
-    coap_log(LOG_EMERG, "COAP:cannot create PDU\n");
-    return result;
+  /* sockets beyond the array were not waited on; room for them next time */
+  if (nsockets == engine.max_sockets) {
+    coap_socket_t **sockets = realloc(
+        engine.sockets, 2 * engine.max_sockets * sizeof(coap_socket_t *));
+    if (sockets) {
+      engine.sockets = sockets;
+      engine.max_sockets *= 2;
+    }
   }
+}
 
-  sprintf(uri, "/a1r/%s/%s", dev_name, resource_name);
-  int res;
-#define BUFSIZE 40
-  unsigned char _buf[BUFSIZE] = {0};
-  unsigned char *buf = _buf;
-  size_t buflen;
-  buflen = BUFSIZE;
-  res = coap_split_path((const uint8_t *)uri, strlen(uri), buf, &buflen);
+/*
+ * I/O thread. Sends newly submitted requests, then processes responses and
+ * retransmissions until stopped. Waits for I/O between, and is woken when
+ * requests are submitted.
+ */
+static void *client_io_thread(void *arg) {
+  (void)arg;
+  while (true) {
+    pthread_mutex_lock(&engine.mutex);
+    bool running = engine.running;
+    client_request *req = engine.submit_head;
+    engine.submit_head = engine.submit_tail = NULL;
+    observe_op *ops = engine.ops_head;
+    engine.ops_head = engine.ops_tail = NULL;
+    pthread_mutex_unlock(&engine.mutex);
 
-  while (res--) {
-    coap_add_option(pdu, COAP_OPTION_URI_PATH, coap_opt_length(buf),
-                    coap_opt_value(buf));
-    iot_log_debug(sdk_ctx->lc, "uri.path_val = %s\n", coap_opt_value(buf));
+    if (!running) {
+      observe_apply(ops);
+      break;
+    }
+    observe_apply(ops);
+    while (req) {
+      client_request *next = req->next;
+      send_request(req);
+      req = next;
+    }
+    io_wait();
+    expire_requests();
+    observe_check();
+    client_pool_evict_idle();
+  }
 
-    buf += coap_opt_size(buf);
+  while (engine.observations) {
+    observation *obs = engine.observations;
+    engine.observations = obs->next;
+    observation_free(obs);
   }
-  if (result <= 0) {  // size
-    result = EXIT_FAILURE;
-    return result;
+
+  /* fail anything still outstanding */
+  while (engine.inflight) {
+    client_request *req = engine.inflight;
+    engine.inflight = req->next;
+    request_end(req, false, false);
+  }
+  return NULL;
+}
+
+/*
+ * Queues requests for the I/O thread and waits for all of them to complete.
+ */
+static void submit_and_wait(client_request *reqs, uint32_t count) {
+  client_completion completion;
+  uint32_t pending = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    pending += !reqs[i].from_group;
   }
-  if (!coap_add_data(pdu, len, (unsigned char *)post_data)) {
-    return result;
+  if (pending == 0) {
+    return;
   }
-  coap_show_pdu(LOG_WARNING, pdu);
+  completion_init(&completion, pending);
 
-  /* and send the PDU */
-  if (coap_send(session, pdu) == COAP_INVALID_TID) {
-    return result;
+  pthread_mutex_lock(&engine.mutex);
+  for (uint32_t i = 0; i < count; i++) {
+    if (reqs[i].from_group) {
+      continue;
+    }
+    reqs[i].completion = &completion;
+    reqs[i].next = NULL;
+    if (!engine.running) {
+      request_complete(&reqs[i], false);
+    } else if (engine.submit_tail) {
+      engine.submit_tail->next = &reqs[i];
+      engine.submit_tail = &reqs[i];
+    } else {
+      engine.submit_head = engine.submit_tail = &reqs[i];
+    }
+  }
+  pthread_mutex_unlock(&engine.mutex);
+  wake_io_thread();
+
+  completion_wait(&completion);
+}
+
+/* Returns "/a1r/device/resource", allocated to fit the names */
+static char *resource_uri(const char *dev_name, const char *resource_name) {
+  size_t size = sizeof("/a1r//") + strlen(dev_name) + strlen(resource_name);
+  char *uri = malloc(size);
+  snprintf(uri, size, "/a1r/%s/%s", dev_name, resource_name);
+  return uri;
+}
+
+static void request_init(client_request *req, uint8_t method, char *dev_name,
+                         char *resource_name,
+                         const end_dev_params *end_dev_params_ptr) {
+  memset(req, 0, sizeof(*req));
+  req->method = method;
+  req->params = end_dev_params_ptr;
+  if (end_dev_params_ptr->timeout_msecs) {
+    req->deadline = monotonic_msecs() + end_dev_params_ptr->timeout_msecs;
   }
-  WaitForCoapResponseFromEndDevice(ctx, session);
-  result = EXIT_SUCCESS;
-  return result;
+  req->uri = resource_uri(dev_name, resource_name);
 }
+
 /*
-send coap get request to end device. waits for the response form end device.
+ * Reads a GET request's value from the response of the device to a read of
+ * its multicast group, if it has one. Returns false if the device did not
+ * respond to the group, so the request is sent to it alone.
+ */
+static bool read_from_group(client_request *req, const char *resource_name) {
+  uint16_t format;
+  size_t len;
+  if (req->params->mcast_group[0] == '\0') {
+    return false;
+  }
+  uint8_t *data = mcast_read(req->params, resource_name, &format, &len);
+  if (data == NULL) {
+    return false;
+  }
+  req->value = read_response_value(&req->type, format, data, len, NULL);
+  free(data);
+  req->from_group = req->value != NULL;
+  req->responded = req->success = req->from_group;
+  return req->from_group;
+}
+
+/*
+ * True if a read of the resource is sent as NON. The messageType resource
+ * attribute overrides the device's ED_MessageType.
+ */
+static bool read_is_non(const iot_data_t *attributes,
+                        const end_dev_params *params) {
+  const char *type =
+      attributes ? iot_data_string_map_get_string(attributes, MESSAGE_TYPE_ATTR)
+                 : NULL;
+  if (type == NULL) {
+    return params->non;
+  }
+  return !strcmp(type, "NON");
+}
+/*
+ * Reports to the health tracker whether the device responded to any of the
+ * requests, or failed to respond. Requests that failed for other reasons, like
+ * a session deferred by the pool, say nothing of the device.
+ */
+static void report_health(const char *dev_name, const char *resource_name,
+                          const end_dev_params *params,
+                          const client_request *reqs, uint32_t count) {
+  bool responded = false;
+  bool unreachable = false;
+  for (uint32_t i = 0; i < count; i++) {
+    responded |= reqs[i].responded;
+    unreachable |= reqs[i].unreachable;
+  }
+  if (responded || unreachable) {
+    health_report(dev_name, resource_name, params, responded);
+  }
+}
+/* Sets the last value of a resource read from the device, if cached */
+static void cache_reading(const char *dev_name, const char *resource_name,
+                          const iot_data_t *value) {
+  if (!cache_enabled()) {
+    return;
+  }
+  resource_desc *desc = index_lookup(dev_name, strlen(dev_name), resource_name,
+                                     strlen(resource_name));
+  if (desc) {
+    cache_update(desc, value);
+    index_release(desc);
+  }
+}
+/*
+send put request to end device. waits for the response from end device.
+*/
+int CoapSendCommandToEndDevice(uint8_t *data, size_t len, uint16_t format,
+                               char *dev_name,
+                               char *resource_name,
+                               end_dev_params *end_dev_params_ptr,
+                               coap_driver *driver) {
+  client_request req;
+  iot_log_debug(driver->lc, "COAP: Data = %d, Len = %zu", *data, len);
+
+  if (!health_allow(dev_name)) {
+    iot_log_error(driver->lc, "COAP:device %s unreachable", dev_name);
+    return EXIT_FAILURE;
+  }
+  request_init(&req, COAP_REQUEST_PUT, dev_name, resource_name,
+               end_dev_params_ptr);
+  req.data = data;
+  req.len = len;
+  req.format = format;
+  submit_and_wait(&req, 1);
+  report_health(dev_name, resource_name, end_dev_params_ptr, &req, 1);
+  free(req.uri);
+  return req.success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+/*
+send coap get request to end device. waits for the response from end device.
 */
 int CoapGetRequestToEndDevice(char *dev_name, char *resource_name,
+                              iot_data_type_t type,
                               end_dev_params *end_dev_params_ptr,
-                              coap_driver *driver) {
-  coap_context_t *ctx = NULL;
-  coap_session_t *session = NULL;
-  coap_address_t dst;
-  coap_pdu_t *pdu = NULL;
-  coap_driver *sdk_ctx = (coap_driver *)driver;
-  int result = EXIT_FAILURE;
-  char uri[COAP_URI_MAXLEN + 1] = {0};
+                              coap_driver *driver, iot_data_t **value) {
+  client_request req;
 
-  coap_startup();
-
-  coap_proto_t proto = COAP_PROTO_UDP;
-  char *port = "5683";
+  *value = NULL;
+  if (!health_allow(dev_name)) {
+    iot_log_error(driver->lc, "COAP:device %s unreachable", dev_name);
+    return EXIT_FAILURE;
+  }
+  request_init(&req, COAP_REQUEST_GET, dev_name, resource_name,
+               end_dev_params_ptr);
+  req.type.type = type;
+  req.non = end_dev_params_ptr->non;
+  read_from_group(&req, resource_name);
+  submit_and_wait(&req, 1);
+  report_health(dev_name, resource_name, end_dev_params_ptr, &req, 1);
+  if (req.success) {
+    cache_reading(dev_name, resource_name, req.value);
+  }
+  free(req.uri);
+  *value = req.value;
+  return req.success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+/*
+send coap get requests for several resources of an end device as a batch. All
+requests are sent back-to-back on the device's session, and the responses are
+collected together, so the batch takes about one round trip. Readings for
+failed requests are left NULL.
+@return number of successful readings
+*/
+uint32_t CoapGetRequestsToEndDevice(char *dev_name, uint32_t count,
+                                    const devsdk_commandrequest *requests,
+                                    end_dev_params *end_dev_params_ptr,
+                                    coap_driver *driver,
+                                    devsdk_commandresult *readings) {
+  uint32_t successes = 0;
 
-  if (end_dev_params_ptr->security_mode != SECURITY_MODE_NOSEC) {
-    proto = COAP_PROTO_DTLS;
-    port = "5684";
+  for (uint32_t i = 0; i < count; i++) {
+    readings[i].origin = 0;
+    readings[i].value = NULL;
+  }
+  /* fail at once while the device is unreachable */
+  if (!health_allow(dev_name)) {
+    iot_log_error(driver->lc, "COAP:device %s unreachable", dev_name);
+    return 0;
+  }
+  client_request *reqs = calloc(count, sizeof(*reqs));
+  if (reqs == NULL) {
+    iot_log_error(driver->lc, "COAP:cannot allocate %u requests for %s", count,
+                  dev_name);
+    return 0;
   }
 
-  if (resolve_address(end_dev_params_ptr->end_dev_addr, port, &dst) < 0) {
-    coap_log(LOG_CRIT, "COAP:failed to resolve address\n");
-    return result;
+  for (uint32_t i = 0; i < count; i++) {
+    request_init(&reqs[i], COAP_REQUEST_GET, dev_name,
+                 requests[i].resource->name, end_dev_params_ptr);
+    reqs[i].type = requests[i].resource->type;
+    reqs[i].non = read_is_non(requests[i].resource->attrs, end_dev_params_ptr);
+    read_from_group(&reqs[i], requests[i].resource->name);
   }
-  iot_log_debug(sdk_ctx->lc, "COAP: End dev addr = %s",
-                end_dev_params_ptr->end_dev_addr);
+  submit_and_wait(reqs, count);
+  report_health(dev_name, requests[0].resource->name, end_dev_params_ptr, reqs,
+                count);
 
-  /* create CoAP context and a client session */
-  ctx = coap_new_context(NULL);
-  if (ctx == NULL) {
-    iot_log_error(sdk_ctx->lc, "COAP:coap new context creation failed\n");
-    return result;
-  }
-  if (end_dev_params_ptr->security_mode == SECURITY_MODE_PSK) {
-    iot_log_debug(sdk_ctx->lc, "COAP-client:ED psk key = %s, len=%zu",
-                  (uint8_t *)end_dev_params_ptr->psk_key,
-                  strlen(end_dev_params_ptr->psk_key));
-    if (!ctx || !(session = coap_new_client_session_psk(
-                      ctx, NULL, &dst, proto, "r17",
-                      (uint8_t *)(end_dev_params_ptr->psk_key),
-                      strlen(end_dev_params_ptr->psk_key)))) {
-      iot_log_error(sdk_ctx->lc, "COAP:cannot initialize PSK");
-      return result;
-    }
-  } else {
-    if (!ctx || !(session = coap_new_client_session(ctx, NULL, &dst, proto))) {
-      coap_log(LOG_EMERG, "COAP:cannot create client session\n");
-      return result;
+  for (uint32_t i = 0; i < count; i++) {
+    readings[i].origin = 0;
+    readings[i].value = reqs[i].value;
+    if (reqs[i].success) {
+      successes++;
+      cache_reading(dev_name, requests[i].resource->name, reqs[i].value);
+    } else {
+      iot_log_error(driver->lc, "COAP:Get request failed for %s", reqs[i].uri);
     }
+    free(reqs[i].uri);
   }
-  coap_register_response_handler(ctx, message_handler);
-  coap_register_nack_handler(ctx, nack_handler);
+  free(reqs);
+  return successes;
+}
+/*
+probe an end device with a GET request for a resource. waits for the response,
+and returns true for any response, whatever the code.
+*/
+bool CoapProbeEndDevice(char *dev_name, char *resource_name,
+                        const end_dev_params *end_dev_params_ptr) {
+  client_request req;
 
-  /* construct CoAP message */
-  pdu = coap_pdu_init(COAP_MESSAGE_CON, COAP_REQUEST_GET,
-                      coap_new_message_id(session) /* message id */,
-                      coap_session_max_pdu_size(session));
-  if (!pdu) {
-    coap_log(LOG_EMERG, "COAP:cannot create PDU\n");
-    return result;
+  request_init(&req, COAP_REQUEST_GET, dev_name, resource_name,
+               end_dev_params_ptr);
+  req.probe = true;
+  if (req.deadline == 0) {
+    req.deadline = monotonic_msecs() + CLIENT_DEFAULT_TIMEOUT_MSECS;
+  }
+  submit_and_wait(&req, 1);
+  free(req.uri);
+  return req.responded;
+}
+/* Queues a change to observations for the I/O thread */
+static void observe_submit(observe_op *op) {
+  pthread_mutex_lock(&engine.mutex);
+  bool running = engine.running;
+  if (running) {
+    if (engine.ops_tail) {
+      engine.ops_tail->next = op;
+    } else {
+      engine.ops_head = op;
+    }
+    engine.ops_tail = op;
+  }
+  pthread_mutex_unlock(&engine.mutex);
+  if (running) {
+    wake_io_thread();
   }
 
-  sprintf(uri, "/a1r/%s/%s", dev_name, resource_name);
-  int res;
-#define BUFSIZE 40
-  unsigned char _buf[BUFSIZE] = {0};
-  unsigned char *buf = _buf;
-  size_t buflen;
-  buflen = BUFSIZE;
-  res = coap_split_path((const uint8_t *)uri, strlen(uri), buf, &buflen);
-  while (res--) {
-    result = coap_add_option(pdu, COAP_OPTION_URI_PATH, coap_opt_length(buf),
-                             coap_opt_value(buf));
-    iot_log_debug(sdk_ctx->lc, "uri.path_val = %s\n", coap_opt_value(buf));
+  if (!running) {
+    if (op->add) {
+      observation_free(op->add);
+    }
+    free(op->cancel_device);
+    free(op);
+  }
+}
+/*
+observe a resource of an end device. Notifications are posted as readings,
+until the device's observations are cancelled. Does not wait for the
+registration.
+*/
+void CoapObserveResource(const char *dev_name, const char *resource_name,
+                         const iot_typecode_t *type,
+                         const end_dev_params *end_dev_params_ptr) {
+  observation *obs = calloc(1, sizeof(*obs));
+  obs->device_name = strdup(dev_name);
+  obs->resource_name = strdup(resource_name);
+  obs->uri = resource_uri(dev_name, resource_name);
+  obs->params = *end_dev_params_ptr;
+  obs->type = *type;
+  obs->backoff = OBSERVE_RETRY_MSECS;
 
-    buf += coap_opt_size(buf);
+  observe_op *op = calloc(1, sizeof(*op));
+  op->add = obs;
+  observe_submit(op);
+}
+/*
+cancel observations of all resources of an end device
+*/
+void CoapObserveCancel(const char *dev_name) {
+  observe_op *op = calloc(1, sizeof(*op));
+  op->cancel_device = strdup(dev_name);
+  observe_submit(op);
+}
+/*
+creates the shared client context and starts the I/O thread
+*/
+bool CoapClientInit(coap_driver *driver) {
+  engine.driver = driver;
+  coap_startup();
+  engine.ctx = coap_new_context(NULL);
+  if (engine.ctx == NULL) {
+    iot_log_error(driver->lc, "COAP:coap new context creation failed");
+    return false;
   }
-  if (result <= 0) {  // size
-    result = EXIT_FAILURE;
-    return result;
+  coap_register_response_handler(engine.ctx, message_handler);
+  coap_register_nack_handler(engine.ctx, nack_handler);
+  client_pool_init(driver, engine.ctx);
+  engine.blocks =
+      block_pool_new(driver->block_max_body, driver->block_max_peer);
+  engine.max_sockets = driver->session_max + CLIENT_IO_EXTRA_SOCKETS;
+  engine.sockets = calloc(engine.max_sockets, sizeof(coap_socket_t *));
+  engine.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (engine.sockets == NULL || engine.wake_fd < 0) {
+    iot_log_error(driver->lc, "COAP:cannot set up client I/O");
+    return false;
   }
 
-  coap_show_pdu(LOG_WARNING, pdu);
-  /* and send the PDU */
-  if (coap_send(session, pdu) == COAP_INVALID_TID) {
-    coap_log(LOG_EMERG, "COAP:coap_send cannot send pdu\n");
-    return result;
+  pthread_mutex_init(&engine.mutex, NULL);
+  engine.running = true;
+  if (pthread_create(&engine.thread, NULL, client_io_thread, NULL) != 0) {
+    iot_log_error(driver->lc, "COAP:cannot start client I/O thread");
+    engine.running = false;
+    return false;
+  }
+  return true;
+}
+/*
+stops the I/O thread, failing any outstanding requests, and releases pooled
+sessions to end devices
+*/
+void CoapClientFree(void) {
+  if (engine.ctx == NULL) {
+    return;
+  }
+  pthread_mutex_lock(&engine.mutex);
+  bool running = engine.running;
+  engine.running = false;
+  pthread_mutex_unlock(&engine.mutex);
+  if (running) {
+    wake_io_thread();
+    pthread_join(engine.thread, NULL);
+  }
+  if (engine.wake_fd >= 0) {
+    close(engine.wake_fd);
   }
-  WaitForCoapResponseFromEndDevice(ctx, session);
-  result = EXIT_SUCCESS;
-  return result;
+  free(engine.sockets);
+  engine.sockets = NULL;
+  client_pool_free();
+  mcast_free();
+  block_pool_free(engine.blocks);
+  engine.blocks = NULL;
+  coap_free_context(engine.ctx);
+  engine.ctx = NULL;
+  pthread_mutex_destroy(&engine.mutex);
 }
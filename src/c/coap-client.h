@@ -14,6 +14,7 @@
  * @brief Defines coap client artifacts for the CoAP device service.
  */
 
+#include <coap2/coap.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -23,27 +24,49 @@
 extern "C" {
 #endif
 
-#define COAP_URI_MAXLEN \
-  32  // should be minimum of (sizeof("/a1r") + sizeof("/device-name") +
-      // sizeof("resource-name"))
-
 typedef struct {
   char end_dev_addr[256];             // To hold IPv6 address
   coap_security_mode_t security_mode; /**< CoAP transport security mode */
   char psk_key[16];
+  bool cbor;                          /**< exchange values as CBOR */
+  bool non;                           /**< send reads as NON by default */
+  uint32_t timeout_msecs;             /**< request deadline; 0 for none */
+  uint32_t max_retransmit;            /**< CON retransmissions */
+  coap_fixed_point_t ack_timeout;     /**< secs before first retransmission */
+  coap_fixed_point_t ack_random_factor; /**< spread of ack_timeout */
+  coap_address_t addr;                /**< resolved end_dev_addr, with port 0 */
+  bool addr_resolved;                 /**< addr is valid */
+  char mcast_group[64];               /**< group for reads; empty if none */
+  uint32_t mcast_leisure_msecs;       /**< time to collect group responses */
 } end_dev_params;
 
 bool GetEndDeviceProtocolProperties(const devsdk_protocols *protocols,
                                     char *protocol_name, iot_data_t **exception,
                                     end_dev_params *end_dev_params_ptr,
                                     coap_driver *driver);
-extern int CoapSendCommandToEndDevice(uint8_t *data, size_t len, char *dev_name,
+bool EndDeviceParamsEqual(const end_dev_params *a, const end_dev_params *b);
+extern int CoapSendCommandToEndDevice(uint8_t *data, size_t len,
+                                      uint16_t format, char *dev_name,
                                       char *resource_name,
                                       end_dev_params *end_dev_params_ptr,
                                       coap_driver *driver);
 extern int CoapGetRequestToEndDevice(char *dev_name, char *resource_name,
+                                     iot_data_type_t type,
                                      end_dev_params *end_dev_params_ptr,
-                                     coap_driver *driver);
+                                     coap_driver *driver, iot_data_t **value);
+extern uint32_t CoapGetRequestsToEndDevice(
+    char *dev_name, uint32_t count, const devsdk_commandrequest *requests,
+    end_dev_params *end_dev_params_ptr, coap_driver *driver,
+    devsdk_commandresult *readings);
+extern bool CoapProbeEndDevice(char *dev_name, char *resource_name,
+                               const end_dev_params *end_dev_params_ptr);
+extern void CoapObserveResource(const char *dev_name,
+                                const char *resource_name,
+                                const iot_typecode_t *type,
+                                const end_dev_params *end_dev_params_ptr);
+extern void CoapObserveCancel(const char *dev_name);
+extern bool CoapClientInit(coap_driver *driver);
+extern void CoapClientFree(void);
 #ifdef __cplusplus
 }
 #endif
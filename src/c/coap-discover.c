@@ -0,0 +1,531 @@
+/* Discovery of end devices from their CoRE links
+ *
+ * Copyright (c) 2026
+ * Contributors to the EdgeX Foundry
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "coap-discover.h"
+
+#include <arpa/inet.h>
+#include <coap2/coap.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "coap-block.h"
+#include "coap-link.h"
+#include "coap-util.h"
+
+#define DISCOVERY_TOKEN_LEN 8
+/* largest response read; a longer one is dropped */
+#define DISCOVERY_DATAGRAM_MAX 1500
+/* room for the request header, token and options */
+#define DISCOVERY_REQUEST_MAX 64
+/* probe slot in the token of a request to a group */
+#define DISCOVERY_GROUP_SLOT UINT16_MAX
+/* longest wait between checks for cancellation */
+#define DISCOVERY_POLL_MSECS 100
+#define DISCOVERY_DESCRIPTION "CoAP device discovered from /.well-known/core"
+
+/* Device proposed from the links of a host */
+typedef struct proposal {
+  char *name;
+  char host[INET6_ADDRSTRLEN];
+  char *resources;         /* resource names, comma-separated */
+  iot_data_t *types;       /* resource name to resource type (rt) */
+  struct proposal *next;
+} proposal;
+
+struct scan;
+
+/* Probe of a host, reading its links a block at a time */
+typedef struct {
+  struct scan *owner;
+  bool active;
+  coap_address_t addr;
+  char host[INET6_ADDRSTRLEN];
+  uint8_t token[DISCOVERY_TOKEN_LEN];
+  uint64_t deadline;       /* msecs to give up on the next block */
+  uint32_t block_num;      /* next block expected */
+  unsigned int szx;
+  link_parser parser;
+} probe;
+
+typedef struct scan {
+  coap_driver *driver;
+  int fds[2];              /* IPv4 and IPv6 sockets; -1 until used */
+  coap_address_t *hosts;   /* hosts to probe, in order */
+  uint32_t nhosts;
+  uint32_t capacity;
+  uint32_t next_host;
+  probe *probes;           /* slots for hosts probed at once */
+  uint32_t nprobes;
+  uint32_t inflight;
+  uint8_t group_token[DISCOVERY_TOKEN_LEN];
+  uint64_t groups_end;     /* msecs to stop taking group responses */
+  uint16_t next_mid;
+  proposal *proposals;
+  uint32_t nproposals;
+} scan;
+
+static bool cancelled;
+
+/* Random token of a request, with the probe slot in its low bits */
+static void new_token(uint16_t slot, uint8_t *token) {
+  uint64_t token_val;
+  random_token((uint8_t *)&token_val, sizeof(token_val));
+  token_val = (token_val << 16) | slot;
+  memcpy(token, &token_val, DISCOVERY_TOKEN_LEN);
+}
+
+static int scan_socket(scan *s, int family) {
+  int *fd = &s->fds[family == AF_INET6];
+  if (*fd < 0) {
+    *fd = socket(family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  }
+  return *fd;
+}
+
+/* Encodes a PDU and sends it to addr; false on failure */
+static bool send_pdu(scan *s, coap_pdu_t *pdu, const coap_address_t *addr) {
+  int fd = scan_socket(s, addr->addr.sa.sa_family);
+  size_t hdr_len = coap_pdu_encode_header(pdu, COAP_PROTO_UDP);
+  if (fd < 0 || hdr_len == 0) {
+    return false;
+  }
+  trace_pdu("sent", pdu);
+  return sendto(fd, pdu->token - hdr_len, pdu->used_size + hdr_len, 0,
+                &addr->addr.sa, addr->size) >= 0;
+}
+
+/* Sends a NON GET of /.well-known/core, for a block if num > 0 */
+static bool send_get(scan *s, const coap_address_t *addr,
+                     const uint8_t *token, uint32_t num, unsigned int szx) {
+  coap_pdu_t *pdu = coap_pdu_init(COAP_MESSAGE_NON, COAP_REQUEST_GET,
+                                  ++s->next_mid, DISCOVERY_REQUEST_MAX);
+  bool sent =
+      pdu && coap_add_token(pdu, DISCOVERY_TOKEN_LEN, token) &&
+      coap_add_option(pdu, COAP_OPTION_URI_PATH, 11,
+                      (const uint8_t *)".well-known") &&
+      coap_add_option(pdu, COAP_OPTION_URI_PATH, 4, (const uint8_t *)"core") &&
+      (num == 0 ||
+       block_add_option(pdu, COAP_OPTION_BLOCK2, num, false, szx)) &&
+      send_pdu(s, pdu, addr);
+  coap_delete_pdu(pdu);
+  return sent;
+}
+
+/* True if a comma-separated list has the name */
+static bool list_has(const char *list, const char *name, size_t len) {
+  for (const char *item = list; item; item = strchr(item, ',')) {
+    item += *item == ',';
+    if (!strncmp(item, name, len) && (item[len] == ',' || !item[len])) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Adds a resource to the device proposed at a host */
+static void propose(scan *s, const char *host, const char *device,
+                    size_t device_len, const char *resource, const char *rt) {
+  proposal *p = s->proposals;
+  for (; p; p = p->next) {
+    if (strlen(p->name) == device_len &&
+        !strncmp(p->name, device, device_len)) {
+      break;
+    }
+  }
+  if (p && strcmp(p->host, host)) {
+    iot_log_warn(s->driver->lc, "COAP:device %s found at both %s and %s",
+                 p->name, p->host, host);
+    return;
+  }
+  if (p == NULL) {
+    p = calloc(1, sizeof(*p));
+    p->name = strndup(device, device_len);
+    strcpy(p->host, host);
+    p->types = iot_data_alloc_map(IOT_DATA_STRING);
+    p->next = s->proposals;
+    s->proposals = p;
+    s->nproposals++;
+  }
+  size_t len = strlen(resource);
+  if (p->resources && list_has(p->resources, resource, len)) {
+    return;
+  }
+  size_t old_len = p->resources ? strlen(p->resources) : 0;
+  char *resources = realloc(p->resources, old_len + len + 2);
+  if (resources == NULL) {
+    return;
+  }
+  sprintf(resources + old_len, "%s%s", old_len ? "," : "", resource);
+  p->resources = resources;
+  iot_data_map_add(p->types, iot_data_alloc_string(resource, IOT_DATA_COPY),
+                   iot_data_alloc_string(rt, IOT_DATA_COPY));
+}
+
+/* Proposes the device and resource of a link /a1r/{device}/{resource} */
+static void on_link(const core_link *link, void *ctx) {
+  probe *p = ctx;
+  const char *path = link->target + (link->target[0] == '/');
+  size_t seg1_len = strlen(RESOURCE_SEG1);
+  if (strncmp(path, RESOURCE_SEG1, seg1_len) || path[seg1_len] != '/') {
+    return;
+  }
+  const char *device = path + seg1_len + 1;
+  const char *resource = strchr(device, '/');
+  if (resource == NULL || resource == device || !resource[1] ||
+      strpbrk(resource + 1, "/?#")) {
+    return;
+  }
+  propose(p->owner, p->host, device, resource - device, resource + 1,
+          link->rt);
+}
+
+static void probe_end(scan *s, probe *p) {
+  link_parser_finish(&p->parser);
+  p->active = false;
+  s->inflight--;
+}
+
+/* Starts a probe of the next host in a free slot */
+static void probe_start(scan *s, probe *p, uint64_t now) {
+  uint16_t slot = p - s->probes;
+  p->owner = s;
+  p->addr = s->hosts[s->next_host++];
+  p->block_num = 0;
+  p->szx = 0;
+  p->deadline = now + s->driver->discovery_timeout_msecs;
+  if (p->addr.addr.sa.sa_family == AF_INET6) {
+    inet_ntop(AF_INET6, &p->addr.addr.sin6.sin6_addr, p->host,
+              sizeof(p->host));
+  } else {
+    inet_ntop(AF_INET, &p->addr.addr.sin.sin_addr, p->host, sizeof(p->host));
+  }
+  link_parser_init(&p->parser, on_link, p);
+  new_token(slot, p->token);
+  p->active = true;
+  s->inflight++;
+  if (!send_get(s, &p->addr, p->token, 0, 0)) {
+    probe_end(s, p);
+  }
+}
+
+/* Feeds a block of links to a probe, and asks for the next block if any */
+static void probe_response(scan *s, probe *p, coap_pdu_t *pdu) {
+  coap_block_t block;
+  bool blocked = coap_get_block(pdu, COAP_OPTION_BLOCK2, &block);
+  if (COAP_RESPONSE_CLASS(pdu->code) != 2) {
+    probe_end(s, p);
+    return;
+  }
+  if (blocked && block.num != p->block_num) {
+    /* a duplicate, or out of order; the expected block may follow */
+    return;
+  }
+  uint8_t *data = NULL;
+  size_t len = 0;
+  coap_get_data(pdu, &len, &data);
+  link_parser_feed(&p->parser, data, len);
+  if (!blocked || !block.m) {
+    probe_end(s, p);
+    return;
+  }
+  p->block_num = block.num + 1;
+  p->szx = block.szx;
+  p->deadline = monotonic_msecs() + s->driver->discovery_timeout_msecs;
+  new_token(p - s->probes, p->token);
+  if (!send_get(s, &p->addr, p->token, p->block_num, p->szx)) {
+    probe_end(s, p);
+  }
+}
+
+static void add_host(scan *s, const coap_address_t *addr) {
+  if (s->nhosts == s->capacity) {
+    uint32_t capacity = s->capacity ? s->capacity * 2 : 256;
+    coap_address_t *hosts = realloc(s->hosts, capacity * sizeof(*hosts));
+    if (hosts == NULL) {
+      return;
+    }
+    s->hosts = hosts;
+    s->capacity = capacity;
+  }
+  s->hosts[s->nhosts++] = *addr;
+}
+
+/*
+ * Takes the links of a member of a group. A response in blocks is read again
+ * from the member, as the rest must be asked of it alone.
+ */
+static void group_response(scan *s, const coap_address_t *src,
+                           coap_pdu_t *pdu) {
+  if (memcmp(pdu->token, s->group_token, DISCOVERY_TOKEN_LEN) ||
+      COAP_RESPONSE_CLASS(pdu->code) != 2) {
+    return;
+  }
+  coap_block_t block;
+  if (coap_get_block(pdu, COAP_OPTION_BLOCK2, &block) && block.m) {
+    for (uint32_t i = 0; i < s->nhosts; i++) {
+      if (coap_address_equals(&s->hosts[i], src)) {
+        return;
+      }
+    }
+    add_host(s, src);
+    return;
+  }
+  probe member = {.owner = s};
+  if (src->addr.sa.sa_family == AF_INET6) {
+    inet_ntop(AF_INET6, &src->addr.sin6.sin6_addr, member.host,
+              sizeof(member.host));
+  } else {
+    inet_ntop(AF_INET, &src->addr.sin.sin_addr, member.host,
+              sizeof(member.host));
+  }
+  uint8_t *data = NULL;
+  size_t len = 0;
+  coap_get_data(pdu, &len, &data);
+  link_parser_init(&member.parser, on_link, &member);
+  link_parser_feed(&member.parser, data, len);
+  link_parser_finish(&member.parser);
+}
+
+static void on_response(scan *s, const coap_address_t *src, coap_pdu_t *pdu) {
+  trace_pdu("received", pdu);
+  if (pdu->type == COAP_MESSAGE_CON) {
+    coap_pdu_t *ack = coap_pdu_init(COAP_MESSAGE_ACK, 0, pdu->tid, 0);
+    if (ack) {
+      send_pdu(s, ack, src);
+      coap_delete_pdu(ack);
+    }
+  }
+  if (pdu->token_length != DISCOVERY_TOKEN_LEN || COAP_PDU_IS_EMPTY(pdu) ||
+      COAP_PDU_IS_REQUEST(pdu)) {
+    return;
+  }
+  uint64_t token_val;
+  memcpy(&token_val, pdu->token, DISCOVERY_TOKEN_LEN);
+  uint16_t slot = token_val & 0xffff;
+  if (slot == DISCOVERY_GROUP_SLOT) {
+    group_response(s, src, pdu);
+  } else if (slot < s->nprobes && s->probes[slot].active &&
+             !memcmp(s->probes[slot].token, pdu->token, DISCOVERY_TOKEN_LEN)) {
+    probe_response(s, &s->probes[slot], pdu);
+  }
+}
+
+/* Reads the responses waiting on a socket */
+static void scan_receive(scan *s, int fd) {
+  uint8_t buf[DISCOVERY_DATAGRAM_MAX];
+  while (true) {
+    coap_address_t src;
+    coap_address_init(&src);
+    /* the full length is returned, so a truncated response is seen */
+    ssize_t len = recvfrom(fd, buf, sizeof(buf), MSG_TRUNC, &src.addr.sa,
+                           &src.size);
+    if (len < 0) {
+      return;
+    }
+    if ((size_t)len > sizeof(buf)) {
+      continue;
+    }
+    coap_pdu_t *pdu = coap_pdu_init(0, 0, 0, len);
+    if (pdu && coap_pdu_parse(COAP_PROTO_UDP, buf, len, pdu)) {
+      on_response(s, &src, pdu);
+    }
+    coap_delete_pdu(pdu);
+  }
+}
+
+/*
+ * Adds the hosts of an IPv4 subnet, like "192.168.1.0/24", leaving out the
+ * network and broadcast addresses.
+ */
+static void add_subnet(scan *s, const char *cidr) {
+  char text[INET_ADDRSTRLEN];
+  const char *slash = strchr(cidr, '/');
+  size_t len = slash ? (size_t)(slash - cidr) : strlen(cidr);
+  int prefix = slash ? atoi(slash + 1) : 32;
+  struct in_addr in;
+  if (len >= sizeof(text)) {
+    len = 0;
+  }
+  memcpy(text, cidr, len);
+  text[len] = '\0';
+  if (inet_pton(AF_INET, text, &in) != 1 || prefix < DISCOVERY_MIN_PREFIX ||
+      prefix > 32) {
+    iot_log_warn(s->driver->lc,
+                 "COAP:discovery subnet %s is not IPv4 with prefix /%d to /32",
+                 cidr, DISCOVERY_MIN_PREFIX);
+    return;
+  }
+  uint32_t mask = prefix ? ~0u << (32 - prefix) : 0;
+  uint32_t first = ntohl(in.s_addr) & mask;
+  uint32_t last = first | ~mask;
+  if (prefix <= 30) {
+    first++;
+    last--;
+  }
+  coap_address_t addr;
+  coap_address_init(&addr);
+  addr.size = sizeof(addr.addr.sin);
+  addr.addr.sin.sin_family = AF_INET;
+  addr.addr.sin.sin_port = htons(COAP_DEFAULT_PORT);
+  for (uint32_t host = first; host <= last && host >= first; host++) {
+    addr.addr.sin.sin_addr.s_addr = htonl(host);
+    add_host(s, &addr);
+  }
+}
+
+/* Sends a request to a multicast group, like "ff02::fd%eth0" */
+static void query_group(scan *s, const char *group, uint64_t now) {
+  coap_address_t addr;
+  char port[8];
+  snprintf(port, sizeof(port), "%u", COAP_DEFAULT_PORT);
+  if (resolve_address(group, port, &addr) < 0 ||
+      !send_get(s, &addr, s->group_token, 0, 0)) {
+    iot_log_warn(s->driver->lc, "COAP:cannot query discovery group %s", group);
+    return;
+  }
+  s->groups_end = now + s->driver->discovery_timeout_msecs;
+}
+
+/* Calls fn for each item of a comma-separated configuration list */
+static void for_each_item(scan *s, const iot_data_t *list, uint64_t now,
+                          void (*fn)(scan *, const char *, uint64_t)) {
+  if (list == NULL) {
+    return;
+  }
+  char *copy = strdup(iot_data_string(list));
+  char *saveptr = NULL;
+  for (char *item = strtok_r(copy, ", ", &saveptr); item;
+       item = strtok_r(NULL, ", ", &saveptr)) {
+    fn(s, item, now);
+  }
+  free(copy);
+}
+
+static void add_subnet_item(scan *s, const char *cidr, uint64_t now) {
+  (void)now;
+  add_subnet(s, cidr);
+}
+
+/* Proposes the devices found to the SDK */
+static void propose_all(scan *s) {
+  devsdk_discovered_device *devices =
+      calloc(s->nproposals ? s->nproposals : 1, sizeof(*devices));
+  uint32_t i = 0;
+  for (proposal *p = s->proposals; p; p = p->next, i++) {
+    iot_data_t *props = iot_data_alloc_map(IOT_DATA_STRING);
+    iot_data_string_map_add(props, "ED_ADDR",
+                            iot_data_alloc_string(p->host, IOT_DATA_COPY));
+    iot_data_string_map_add(props, "ED_SecurityMode",
+                            iot_data_alloc_string("NoSec", IOT_DATA_REF));
+    /* lets a provision watcher choose a profile by the resources */
+    iot_data_string_map_add(props, "ED_Resources",
+                            iot_data_alloc_string(p->resources, IOT_DATA_COPY));
+    devices[i].name = p->name;
+    devices[i].protocols = devsdk_protocols_new("COAP", props, NULL);
+    devices[i].description = DISCOVERY_DESCRIPTION;
+    devices[i].properties = p->types;
+    iot_data_free(props);
+  }
+  if (s->nproposals) {
+    devsdk_add_discovered_devices(s->driver->service, s->nproposals, devices);
+  }
+  for (i = 0; i < s->nproposals; i++) {
+    devsdk_protocols_free(devices[i].protocols);
+  }
+  free(devices);
+}
+
+static void scan_free(scan *s) {
+  for (int i = 0; i < 2; i++) {
+    if (s->fds[i] >= 0) {
+      close(s->fds[i]);
+    }
+  }
+  while (s->proposals) {
+    proposal *p = s->proposals;
+    s->proposals = p->next;
+    free(p->name);
+    free(p->resources);
+    iot_data_free(p->types);
+    free(p);
+  }
+  free(s->hosts);
+  free(s->probes);
+}
+
+/* Waits for a response on either socket, until the next deadline */
+static void scan_wait(scan *s, uint64_t now) {
+  uint64_t until = now + DISCOVERY_POLL_MSECS;
+  for (uint32_t i = 0; i < s->nprobes; i++) {
+    if (s->probes[i].active && s->probes[i].deadline < until) {
+      until = s->probes[i].deadline;
+    }
+  }
+  struct pollfd pfds[2];
+  nfds_t nfds = 0;
+  for (int i = 0; i < 2; i++) {
+    if (s->fds[i] >= 0) {
+      pfds[nfds].fd = s->fds[i];
+      pfds[nfds++].events = POLLIN;
+    }
+  }
+  poll(pfds, nfds, until > now ? (int)(until - now) : 0);
+  for (nfds_t i = 0; i < nfds; i++) {
+    if (pfds[i].revents & POLLIN) {
+      scan_receive(s, pfds[i].fd);
+    }
+  }
+}
+
+void discover_devices(coap_driver *driver) {
+  scan s = {.driver = driver, .fds = {-1, -1}};
+  __atomic_store_n(&cancelled, false, __ATOMIC_RELAXED);
+
+  uint64_t now = monotonic_msecs();
+  new_token(DISCOVERY_GROUP_SLOT, s.group_token);
+  for_each_item(&s, driver->discovery_groups, now, query_group);
+  for_each_item(&s, driver->discovery_subnets, now, add_subnet_item);
+  s.nprobes = driver->discovery_max_inflight ? driver->discovery_max_inflight
+                                             : DISCOVERY_DEFAULT_MAX_INFLIGHT;
+  if (s.nprobes >= DISCOVERY_GROUP_SLOT) {
+    s.nprobes = DISCOVERY_GROUP_SLOT - 1;
+  }
+  s.probes = calloc(s.nprobes, sizeof(probe));
+  iot_log_info(driver->lc, "COAP:discovery probing %u hosts, %u at once",
+               s.nhosts, s.nprobes);
+
+  while (s.probes && !__atomic_load_n(&cancelled, __ATOMIC_RELAXED)) {
+    now = monotonic_msecs();
+    for (uint32_t i = 0; i < s.nprobes; i++) {
+      probe *p = &s.probes[i];
+      if (p->active && now >= p->deadline) {
+        probe_end(&s, p);
+      }
+      if (!p->active && s.next_host < s.nhosts) {
+        probe_start(&s, p, now);
+      }
+    }
+    if (s.inflight == 0 && s.next_host == s.nhosts && now >= s.groups_end) {
+      break;
+    }
+    scan_wait(&s, now);
+  }
+
+  iot_log_info(driver->lc, "COAP:discovery proposing %u devices",
+               s.nproposals);
+  propose_all(&s);
+  scan_free(&s);
+}
+
+void discover_cancel(void) {
+  __atomic_store_n(&cancelled, true, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2026
+ * Contributors to the EdgeX Foundry
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef _COAP_DISCOVER_H_
+#define _COAP_DISCOVER_H_ 1
+
+/**
+ * @file
+ * @brief Defines discovery of end devices from the links they serve at
+ * /.well-known/core (RFC 6690).
+ */
+
+#include "device-coap.h"
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Default number of hosts probed at once */
+#define DISCOVERY_DEFAULT_MAX_INFLIGHT 64
+/** Default msecs to wait for a host to respond, or for the next block */
+#define DISCOVERY_DEFAULT_TIMEOUT_MSECS 1000
+/** Smallest IPv4 prefix length scanned, to bound the hosts probed */
+#define DISCOVERY_MIN_PREFIX 16
+
+/**
+ * Discovers end devices, and proposes them to the SDK. A NON GET of
+ * /.well-known/core is sent to each host of the configured subnets, and to
+ * each configured multicast group. Each link /a1r/{device-name}/{resource}
+ * from a host proposes the device at the host, with the resource. Up to the
+ * configured number of hosts are probed at once. Blocks until done.
+ *
+ * @param driver Configuration, and service to propose devices to
+ */
+extern void discover_devices(coap_driver *driver);
+
+/** Ends a discovery in progress early, as when the service stops. */
+extern void discover_cancel(void);
+#ifdef __cplusplus
+}
+#endif
+#endif
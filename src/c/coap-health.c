@@ -0,0 +1,279 @@
+/* Health of end devices, with a circuit breaker for unreachable ones
+ *
+ * Copyright (c) 2026
+ * Contributors to the EdgeX Foundry
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "coap-health.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "coap-metrics.h"
+#include "coap-util.h"
+
+#define HEALTH_BUCKETS 256
+/* interval to check for probes that are due */
+#define HEALTH_CHECK_SECS 1
+
+typedef struct health_entry {
+  char *name;
+  char *resource;       /**< last resource requested, to probe */
+  uint32_t hash;
+  end_dev_params params;
+  uint32_t failures;    /**< consecutive unreachable outcomes */
+  bool open;            /**< circuit open; requests fail at once */
+  bool probing;         /**< probe in progress */
+  uint64_t probe_at;    /**< msecs when next probe is due, if open */
+  uint32_t backoff;     /**< secs between probes */
+  bool down;            /**< operating state to report */
+  bool reported_down;   /**< operating state last reported */
+  struct health_entry *next;
+} health_entry;
+
+static struct {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  health_entry *buckets[HEALTH_BUCKETS];
+  uint32_t threshold;   /**< 0 if circuit breaker disabled */
+  bool running;
+  pthread_t thread;
+  coap_driver *driver;
+} health = {.mutex = PTHREAD_MUTEX_INITIALIZER,
+            .cond = PTHREAD_COND_INITIALIZER};
+
+/* Finds the entry for device, creating it if create; call with mutex held */
+static health_entry *find_entry(const char *device, bool create) {
+  uint32_t hash = fnv1a(FNV1A_INIT, device, strlen(device));
+  health_entry **bucket = &health.buckets[hash % HEALTH_BUCKETS];
+  for (health_entry *entry = *bucket; entry; entry = entry->next) {
+    if (entry->hash == hash && !strcmp(entry->name, device)) {
+      return entry;
+    }
+  }
+  if (!create) {
+    return NULL;
+  }
+  health_entry *entry = calloc(1, sizeof(*entry));
+  entry->name = strdup(device);
+  entry->hash = hash;
+  entry->backoff = HEALTH_PROBE_MIN_SECS;
+  entry->next = *bucket;
+  *bucket = entry;
+  return entry;
+}
+
+static void entry_free(health_entry *entry) {
+  free(entry->name);
+  free(entry->resource);
+  free(entry);
+}
+
+/* Closes the circuit, so requests are sent again; call with mutex held */
+static void entry_close(health_entry *entry) {
+  entry->open = false;
+  entry->failures = 0;
+  entry->backoff = HEALTH_PROBE_MIN_SECS;
+  entry->down = false;
+}
+
+/*
+ * Finds an entry with operating state to report, or a probe due; call with
+ * mutex held.
+ */
+static health_entry *next_due(uint64_t now) {
+  for (uint32_t i = 0; i < HEALTH_BUCKETS; i++) {
+    for (health_entry *entry = health.buckets[i]; entry; entry = entry->next) {
+      if (entry->down != entry->reported_down ||
+          (entry->open && !entry->probing && now >= entry->probe_at)) {
+        return entry;
+      }
+    }
+  }
+  return NULL;
+}
+
+/* Reports operating state to the SDK; called without mutex held */
+static void report_opstate(char *device, bool down) {
+  coap_driver *driver = health.driver;
+  devsdk_error err = {0};
+  devsdk_set_device_opstate(driver->service, device, !down, &err);
+  if (err.code) {
+    iot_log_error(driver->lc, "COAP:cannot set %s operating state: %s",
+                  device, err.reason);
+  } else {
+    iot_log_info(driver->lc, "COAP:device %s operating state %s", device,
+                 down ? "DOWN" : "UP");
+  }
+}
+
+/*
+ * Probes the device of entry with a request for its last resource. Any
+ * response closes the circuit; otherwise the next probe waits twice as long.
+ * Called with mutex held, which is released while probing.
+ */
+static void probe(health_entry *entry) {
+  char *name = strdup(entry->name);
+  char *resource = strdup(entry->resource);
+  end_dev_params params = entry->params;
+  entry->probing = true;
+  pthread_mutex_unlock(&health.mutex);
+
+  bool reachable = CoapProbeEndDevice(name, resource, &params);
+
+  /* the device may have been removed or updated meanwhile */
+  pthread_mutex_lock(&health.mutex);
+  entry = find_entry(name, false);
+  if (entry && entry->probing) {
+    entry->probing = false;
+    if (reachable) {
+      iot_log_info(health.driver->lc, "COAP:device %s reachable again", name);
+      entry_close(entry);
+    } else if (entry->open) {
+      entry->backoff *= 2;
+      if (entry->backoff > HEALTH_PROBE_MAX_SECS) {
+        entry->backoff = HEALTH_PROBE_MAX_SECS;
+      }
+      entry->probe_at = monotonic_msecs() + entry->backoff * 1000ULL;
+    }
+  }
+  free(name);
+  free(resource);
+}
+
+static void *health_thread(void *arg) {
+  (void)arg;
+  pthread_mutex_lock(&health.mutex);
+  while (health.running) {
+    health_entry *entry = next_due(monotonic_msecs());
+    if (entry == NULL) {
+      struct timespec ts;
+      clock_gettime(CLOCK_REALTIME, &ts);
+      ts.tv_sec += HEALTH_CHECK_SECS;
+      pthread_cond_timedwait(&health.cond, &health.mutex, &ts);
+      continue;
+    }
+    if (entry->down != entry->reported_down) {
+      char *name = strdup(entry->name);
+      bool down = entry->down;
+      entry->reported_down = down;
+      pthread_mutex_unlock(&health.mutex);
+      report_opstate(name, down);
+      free(name);
+      pthread_mutex_lock(&health.mutex);
+    } else {
+      probe(entry);
+    }
+  }
+  pthread_mutex_unlock(&health.mutex);
+  return NULL;
+}
+
+bool health_start(coap_driver *driver) {
+  pthread_mutex_lock(&health.mutex);
+  health.driver = driver;
+  health.threshold = driver->failure_threshold;
+  health.running = true;
+  pthread_mutex_unlock(&health.mutex);
+
+  if (pthread_create(&health.thread, NULL, health_thread, NULL)) {
+    iot_log_error(driver->lc, "COAP:cannot start health thread");
+    health.running = false;
+    return false;
+  }
+  return true;
+}
+
+void health_stop(void) {
+  pthread_mutex_lock(&health.mutex);
+  bool running = health.running;
+  health.running = false;
+  pthread_cond_signal(&health.cond);
+  pthread_mutex_unlock(&health.mutex);
+  if (running) {
+    pthread_join(health.thread, NULL);
+  }
+
+  for (uint32_t i = 0; i < HEALTH_BUCKETS; i++) {
+    while (health.buckets[i]) {
+      health_entry *entry = health.buckets[i];
+      health.buckets[i] = entry->next;
+      entry_free(entry);
+    }
+  }
+}
+
+bool health_allow(const char *device) {
+  pthread_mutex_lock(&health.mutex);
+  health_entry *entry = health.threshold ? find_entry(device, false) : NULL;
+  bool allow = entry == NULL || !entry->open;
+  pthread_mutex_unlock(&health.mutex);
+  if (!allow) {
+    metric_add(METRIC_CLIENT_CIRCUIT_OPEN, 1);
+  }
+  return allow;
+}
+
+void health_report(const char *device, const char *resource,
+                   const end_dev_params *params, bool reachable) {
+  pthread_mutex_lock(&health.mutex);
+  if (health.threshold == 0) {
+    pthread_mutex_unlock(&health.mutex);
+    return;
+  }
+  health_entry *entry = find_entry(device, !reachable);
+  if (entry && reachable) {
+    entry->failures = 0;
+  } else if (entry && !entry->open) {
+    free(entry->resource);
+    entry->resource = strdup(resource);
+    entry->params = *params;
+    if (++entry->failures >= health.threshold) {
+      iot_log_warn(health.driver->lc,
+                   "COAP:device %s unreachable; failing requests until it "
+                   "responds to a probe",
+                   device);
+      entry->open = true;
+      entry->down = true;
+      entry->probe_at = monotonic_msecs() + entry->backoff * 1000ULL;
+      pthread_cond_signal(&health.cond);
+    }
+  }
+  pthread_mutex_unlock(&health.mutex);
+}
+
+uint32_t health_down_count(void) {
+  uint32_t count = 0;
+  pthread_mutex_lock(&health.mutex);
+  for (uint32_t i = 0; i < HEALTH_BUCKETS; i++) {
+    for (health_entry *entry = health.buckets[i]; entry; entry = entry->next) {
+      count += entry->reported_down;
+    }
+  }
+  pthread_mutex_unlock(&health.mutex);
+  return count;
+}
+
+void health_forget(const char *device, bool removed) {
+  pthread_mutex_lock(&health.mutex);
+  uint32_t hash = fnv1a(FNV1A_INIT, device, strlen(device));
+  health_entry **link = &health.buckets[hash % HEALTH_BUCKETS];
+  while (*link && strcmp((*link)->name, device)) {
+    link = &(*link)->next;
+  }
+  health_entry *entry = *link;
+  if (entry && (removed || !entry->reported_down)) {
+    *link = entry->next;
+    entry_free(entry);
+  } else if (entry) {
+    /* kept until reported UP */
+    entry_close(entry);
+    entry->probing = false;
+    pthread_cond_signal(&health.cond);
+  }
+  pthread_mutex_unlock(&health.mutex);
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2026
+ * Contributors to the EdgeX Foundry
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef _COAP_HEALTH_H_
+#define _COAP_HEALTH_H_ 1
+
+/**
+ * @file
+ * @brief Defines health tracking of end devices, with a circuit breaker.
+ */
+
+#include <stdbool.h>
+
+#include "coap-client.h"
+#include "device-coap.h"
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Default consecutive unreachable requests that open the circuit */
+#define HEALTH_DEFAULT_FAILURE_THRESHOLD 3
+/** Secs before the first probe of a device with open circuit */
+#define HEALTH_PROBE_MIN_SECS 5
+/** Longest interval between probes, as it doubles after each failure */
+#define HEALTH_PROBE_MAX_SECS 300
+
+/**
+ * Starts the health thread, which probes unreachable devices and reports
+ * their operating state to the SDK.
+ *
+ * @param driver For logging, SDK service and failure threshold
+ * @return true if started
+ */
+extern bool health_start(coap_driver *driver);
+
+/** Stops the health thread and forgets all devices. */
+extern void health_stop(void);
+
+/**
+ * Checks whether requests to a device may be sent. Safe to call from any
+ * thread.
+ *
+ * @param device Device name
+ * @return false if the circuit is open, so the request should fail at once
+ */
+extern bool health_allow(const char *device);
+
+/**
+ * Records the outcome of requests to a device. Enough consecutive
+ * unreachable outcomes open the circuit, and the device is reported DOWN.
+ *
+ * @param device Device name
+ * @param resource Resource requested, to probe while the circuit is open
+ * @param params Device address, copied
+ * @param reachable true if the device responded, with any response code
+ */
+extern void health_report(const char *device, const char *resource,
+                          const end_dev_params *params, bool reachable);
+
+/** Returns the number of devices reported DOWN; safe from any thread. */
+extern uint32_t health_down_count(void);
+
+/**
+ * Forgets the health of a device, as when it is updated or removed. An
+ * updated device reported DOWN is reported UP again.
+ *
+ * @param device Device name
+ * @param removed true if the device no longer exists
+ */
+extern void health_forget(const char *device, bool removed);
+#ifdef __cplusplus
+}
+#endif
+#endif
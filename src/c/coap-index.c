@@ -0,0 +1,484 @@
+/* Index of device resources addressable via CoAP
+ *
+ * Copyright (c) 2026
+ * Contributors to the EdgeX Foundry
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "coap-index.h"
+
+#include <coap2/coap.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "coap-cache.h"
+#include "coap-cbor.h"
+#include "coap-util.h"
+
+#define INDEX_INITIAL_BUCKETS 256
+/* msecs an unknown device is remembered, so lookups do not reload it */
+#define INDEX_UNKNOWN_MSECS 5000
+/* most unknown devices remembered; their names come off the network */
+#define INDEX_UNKNOWN_MAX 1024
+/* least msecs between sweeps of the table for expired markers */
+#define INDEX_SWEEP_MSECS 1000
+
+static struct {
+  coap_driver *driver;
+  pthread_rwlock_t lock;
+  resource_desc **buckets;
+  uint32_t nbuckets;   /**< always a power of two */
+  uint32_t count;
+  uint32_t unknown;    /**< markers of unknown devices, in count */
+  uint64_t next_sweep; /**< msecs; earliest time for drop_expired() */
+  uint64_t removals;   /**< devices forgotten */
+} index_tbl;
+
+/* FNV-1a over "device/resource" */
+static uint32_t desc_hash(const char *device, size_t device_len,
+                          const char *resource, size_t resource_len) {
+  uint32_t hash = fnv1a(FNV1A_INIT, device, device_len);
+  hash = fnv1a(hash, "/", 1);
+  return fnv1a(hash, resource, resource_len);
+}
+
+static bool desc_matches(const resource_desc *desc, uint32_t hash,
+                         const char *device, size_t device_len,
+                         const char *resource, size_t resource_len) {
+  return desc->hash == hash && desc->device_len == device_len &&
+         desc->resource_len == resource_len &&
+         !memcmp(desc->device_name, device, device_len) &&
+         !memcmp(desc->resource_name, resource, resource_len);
+}
+
+/* Caller must hold the lock, for read at least */
+static resource_desc *find(uint32_t hash, const char *device,
+                           size_t device_len, const char *resource,
+                           size_t resource_len) {
+  resource_desc *desc = index_tbl.buckets[hash & (index_tbl.nbuckets - 1)];
+  for (; desc; desc = desc->next) {
+    if (desc_matches(desc, hash, device, device_len, resource, resource_len)) {
+      return desc;
+    }
+  }
+  return NULL;
+}
+
+/* Codec and content formats accepted for the resource value type */
+static void set_formats(resource_desc *desc) {
+  desc->codec = codec_for_type(desc->type.type);
+  if (desc->type.type == IOT_DATA_ARRAY &&
+      scalar_size(desc->type.element_type) == 0) {
+    desc->codec = NULL;
+  }
+  if (desc->codec) {
+    for (uint8_t i = 0; i < desc->codec->nformats; i++) {
+      desc->formats[desc->nformats++] = desc->codec->formats[i];
+    }
+  }
+  if (cbor_supports(&desc->type)) {
+    desc->formats[desc->nformats++] = COAP_MEDIATYPE_APPLICATION_CBOR;
+  }
+}
+
+static device_info *device_info_new(const edgex_device *device) {
+  device_info *info = calloc(1, sizeof(*info));
+  info->name = strdup(device->name);
+  info->refs = 1;
+
+  for (edgex_deviceprofile *profile = device->profile; profile;
+       profile = profile->next) {
+    for (edgex_devicecommand *cmd = profile->device_commands; cmd;
+         cmd = cmd->next) {
+      info->ncommands++;
+    }
+  }
+  info->commands = calloc(info->ncommands, sizeof(command_info));
+
+  command_info *info_cmd = info->commands;
+  for (edgex_deviceprofile *profile = device->profile; profile;
+       profile = profile->next) {
+    for (edgex_devicecommand *cmd = profile->device_commands; cmd;
+         cmd = cmd->next, info_cmd++) {
+      info_cmd->name = strdup(cmd->name);
+      edgex_resourceoperation *op = cmd->resourceOperations;
+      for (; op; op = op->next) {
+        info_cmd->nresources++;
+      }
+      info_cmd->resources = calloc(info_cmd->nresources, sizeof(char *));
+      uint32_t i = 0;
+      for (op = cmd->resourceOperations; op; op = op->next) {
+        info_cmd->resources[i++] = strdup(op->deviceResource);
+      }
+    }
+  }
+  return info;
+}
+
+static void device_info_release(device_info *info) {
+  if (__atomic_sub_fetch(&info->refs, 1, __ATOMIC_ACQ_REL)) {
+    return;
+  }
+  for (uint32_t i = 0; i < info->ncommands; i++) {
+    for (uint32_t j = 0; j < info->commands[i].nresources; j++) {
+      free(info->commands[i].resources[j]);
+    }
+    free(info->commands[i].resources);
+    free(info->commands[i].name);
+  }
+  free(info->commands);
+  free(info->name);
+  free(info);
+}
+
+static resource_desc *desc_new(device_info *device,
+                               const edgex_deviceresource *resource) {
+  resource_desc *desc = calloc(1, sizeof(*desc));
+  desc->device = device;
+  __atomic_add_fetch(&device->refs, 1, __ATOMIC_RELAXED);
+  desc->device_name = strdup(device->name);
+  desc->device_len = strlen(device->name);
+  desc->resource_name = strdup(resource->name);
+  desc->resource_len = strlen(resource->name);
+  desc->type = resource->properties->type;
+  if (resource->properties->units) {
+    desc->units = strdup(resource->properties->units);
+  }
+  set_formats(desc);
+  desc->hash = desc_hash(desc->device_name, desc->device_len,
+                         desc->resource_name, desc->resource_len);
+  desc->refs = 1; /* held by the index */
+  return desc;
+}
+
+/*
+ * Creates the marker for a device, which has an empty resource name, so it
+ * never matches a lookup. For a device not known to the SDK, info is NULL and
+ * the marker expires.
+ */
+static resource_desc *marker_new(const char *device_name, device_info *info) {
+  resource_desc *desc = calloc(1, sizeof(*desc));
+  desc->device = info;
+  if (info) {
+    __atomic_add_fetch(&info->refs, 1, __ATOMIC_RELAXED);
+  } else {
+    desc->expires = monotonic_msecs() + INDEX_UNKNOWN_MSECS;
+  }
+  desc->device_name = strdup(device_name);
+  desc->device_len = strlen(device_name);
+  desc->resource_name = strdup("");
+  desc->hash = desc_hash(desc->device_name, desc->device_len, "", 0);
+  desc->refs = 1; /* held by the index */
+  return desc;
+}
+
+static void desc_free(resource_desc *desc) {
+  if (desc->device) {
+    device_info_release(desc->device);
+  }
+  free(desc->device_name);
+  free(desc->resource_name);
+  free(desc->units);
+  iot_data_free(desc->value);
+  free(desc);
+}
+
+/* Counts out a descriptor unlinked from the table */
+static void count_unlinked(const resource_desc *desc) {
+  index_tbl.count--;
+  if (desc->expires) {
+    index_tbl.unknown--;
+  }
+}
+
+/*
+ * Drops the expired markers of unknown devices. It visits every bucket, so
+ * runs at most once in INDEX_SWEEP_MSECS; caller must hold the write lock.
+ */
+static void drop_expired(void) {
+  uint64_t now = monotonic_msecs();
+  if (index_tbl.unknown == 0 || now < index_tbl.next_sweep) {
+    return;
+  }
+  index_tbl.next_sweep = now + INDEX_SWEEP_MSECS;
+  for (uint32_t i = 0; i < index_tbl.nbuckets; i++) {
+    resource_desc **link = &index_tbl.buckets[i];
+    while (*link) {
+      resource_desc *desc = *link;
+      if (desc->expires && desc->expires <= now) {
+        *link = desc->next;
+        count_unlinked(desc);
+        index_release(desc);
+      } else {
+        link = &desc->next;
+      }
+    }
+  }
+}
+
+/* Doubles the bucket count; caller must hold the write lock */
+static void grow(void) {
+  uint32_t nbuckets = index_tbl.nbuckets * 2;
+  resource_desc **buckets = calloc(nbuckets, sizeof(resource_desc *));
+  for (uint32_t i = 0; i < index_tbl.nbuckets; i++) {
+    resource_desc *desc = index_tbl.buckets[i];
+    while (desc) {
+      resource_desc *next = desc->next;
+      desc->next = buckets[desc->hash & (nbuckets - 1)];
+      buckets[desc->hash & (nbuckets - 1)] = desc;
+      desc = next;
+    }
+  }
+  free(index_tbl.buckets);
+  index_tbl.buckets = buckets;
+  index_tbl.nbuckets = nbuckets;
+}
+
+/* Unlinks desc from its bucket; caller must hold the write lock */
+static void unlink_desc(resource_desc *desc) {
+  uint32_t slot = desc->hash & (index_tbl.nbuckets - 1);
+  resource_desc **link = &index_tbl.buckets[slot];
+  for (; *link; link = &(*link)->next) {
+    if (*link == desc) {
+      *link = desc->next;
+      count_unlinked(desc);
+      index_release(desc);
+      return;
+    }
+  }
+}
+
+/*
+ * Inserts desc unless already present; a marker replaces any marker present.
+ * Caller must hold the write lock.
+ */
+static void insert(resource_desc *desc) {
+  resource_desc *old = find(desc->hash, desc->device_name, desc->device_len,
+                            desc->resource_name, desc->resource_len);
+  if (old && desc->resource_len) {
+    index_release(desc);
+    return;
+  }
+  if (old) {
+    unlink_desc(old);
+  }
+  if (index_tbl.count >= index_tbl.nbuckets) {
+    drop_expired();
+  }
+  if (index_tbl.count >= index_tbl.nbuckets) {
+    grow();
+  }
+  uint32_t slot = desc->hash & (index_tbl.nbuckets - 1);
+  desc->next = index_tbl.buckets[slot];
+  index_tbl.buckets[slot] = desc;
+  index_tbl.count++;
+  if (desc->expires) {
+    index_tbl.unknown++;
+  }
+}
+
+/*
+ * Remembers that a device is not known to the SDK, unless INDEX_UNKNOWN_MAX
+ * unknown devices are remembered already. Caller must hold the write lock.
+ */
+static void mark_unknown(const char *device_name) {
+  if (index_tbl.unknown >= INDEX_UNKNOWN_MAX) {
+    drop_expired();
+  }
+  if (index_tbl.unknown < INDEX_UNKNOWN_MAX) {
+    insert(marker_new(device_name, NULL));
+  }
+}
+
+/*
+ * Adds descriptors for all resources of a device. Returns false if the
+ * device is not known to the SDK.
+ */
+static bool load_device(const char *device_name) {
+  coap_driver *sdk_ctx = index_tbl.driver;
+  edgex_device *device = edgex_get_device_byname(sdk_ctx->service, device_name);
+  if (device == NULL) {
+    return false;
+  }
+
+  device_info *info = device_info_new(device);
+  pthread_rwlock_wrlock(&index_tbl.lock);
+  insert(marker_new(device_name, info));
+  for (edgex_deviceprofile *profile = device->profile; profile;
+       profile = profile->next) {
+    for (edgex_deviceresource *resource = profile->device_resources; resource;
+         resource = resource->next) {
+      insert(desc_new(info, resource));
+    }
+  }
+  pthread_rwlock_unlock(&index_tbl.lock);
+  device_info_release(info);
+
+  edgex_free_device(sdk_ctx->service, device);
+  iot_log_debug(sdk_ctx->lc, "indexed resources for device %s", device_name);
+  return true;
+}
+
+void index_init(coap_driver *driver) {
+  index_tbl.driver = driver;
+  pthread_rwlock_init(&index_tbl.lock, NULL);
+  index_tbl.nbuckets = INDEX_INITIAL_BUCKETS;
+  index_tbl.buckets = calloc(index_tbl.nbuckets, sizeof(resource_desc *));
+  index_tbl.count = 0;
+}
+
+/*
+ * Returns true if the device has a marker, so there is no use loading it:
+ * either it is indexed, or it was not known to the SDK a moment ago. Caller
+ * must hold the lock, for read at least.
+ */
+static bool device_marked(const char *device, size_t device_len) {
+  uint32_t hash = desc_hash(device, device_len, "", 0);
+  resource_desc *marker = find(hash, device, device_len, "", 0);
+  return marker && (marker->device || monotonic_msecs() < marker->expires);
+}
+
+resource_desc *index_lookup(const char *device, size_t device_len,
+                            const char *resource, size_t resource_len) {
+  if (resource_len == 0) {
+    return NULL;
+  }
+  uint32_t hash = desc_hash(device, device_len, resource, resource_len);
+
+  pthread_rwlock_rdlock(&index_tbl.lock);
+  resource_desc *desc = find(hash, device, device_len, resource, resource_len);
+  if (desc) {
+    index_ref(desc);
+  }
+  bool marked = desc == NULL && device_marked(device, device_len);
+  pthread_rwlock_unlock(&index_tbl.lock);
+  if (desc || marked) {
+    return desc;
+  }
+
+  /* not indexed yet; load the device and retry */
+  char name[device_len + 1];
+  memcpy(name, device, device_len);
+  name[device_len] = '\0';
+  if (!load_device(name)) {
+    pthread_rwlock_wrlock(&index_tbl.lock);
+    mark_unknown(name);
+    pthread_rwlock_unlock(&index_tbl.lock);
+    return NULL;
+  }
+  pthread_rwlock_rdlock(&index_tbl.lock);
+  desc = find(hash, device, device_len, resource, resource_len);
+  if (desc) {
+    index_ref(desc);
+  }
+  pthread_rwlock_unlock(&index_tbl.lock);
+  return desc;
+}
+
+resource_desc *index_ref(resource_desc *desc) {
+  __atomic_add_fetch(&desc->refs, 1, __ATOMIC_RELAXED);
+  return desc;
+}
+
+void index_release(resource_desc *desc) {
+  if (__atomic_sub_fetch(&desc->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+    desc_free(desc);
+  }
+}
+
+/*
+ * Unlinks the descriptors of a device, and its marker, returning them chained
+ * by next; caller must hold the write lock
+ */
+static resource_desc *unlink_device(const char *device_name) {
+  size_t device_len = strlen(device_name);
+  resource_desc *unlinked = NULL;
+
+  for (uint32_t i = 0; i < index_tbl.nbuckets; i++) {
+    resource_desc **link = &index_tbl.buckets[i];
+    while (*link) {
+      resource_desc *desc = *link;
+      if (desc->device_len == device_len &&
+          !memcmp(desc->device_name, device_name, device_len)) {
+        *link = desc->next;
+        count_unlinked(desc);
+        desc->next = unlinked;
+        unlinked = desc;
+      } else {
+        link = &desc->next;
+      }
+    }
+  }
+  return unlinked;
+}
+
+static void release_chain(resource_desc *desc) {
+  while (desc) {
+    resource_desc *next = desc->next;
+    index_release(desc);
+    desc = next;
+  }
+}
+
+void index_invalidate(const char *device_name) {
+  pthread_rwlock_wrlock(&index_tbl.lock);
+  resource_desc *old = unlink_device(device_name);
+  pthread_rwlock_unlock(&index_tbl.lock);
+
+  /* reloaded at once, so last values carry over to the new descriptors */
+  if (old && cache_enabled() && load_device(device_name)) {
+    pthread_rwlock_rdlock(&index_tbl.lock);
+    for (resource_desc *desc = old; desc; desc = desc->next) {
+      resource_desc *to =
+          desc->resource_len ? find(desc->hash, desc->device_name,
+                                    desc->device_len, desc->resource_name,
+                                    desc->resource_len)
+                             : NULL;
+      if (to) {
+        cache_carry(desc, to);
+      }
+    }
+    pthread_rwlock_unlock(&index_tbl.lock);
+  }
+  release_chain(old);
+}
+
+void index_forget(const char *device_name) {
+  pthread_rwlock_wrlock(&index_tbl.lock);
+  resource_desc *old = unlink_device(device_name);
+  pthread_rwlock_unlock(&index_tbl.lock);
+  release_chain(old);
+  __atomic_add_fetch(&index_tbl.removals, 1, __ATOMIC_RELEASE);
+}
+
+uint64_t index_removals(void) {
+  return __atomic_load_n(&index_tbl.removals, __ATOMIC_ACQUIRE);
+}
+
+bool desc_accepts(const resource_desc *desc, uint16_t format) {
+  for (uint8_t i = 0; i < desc->nformats; i++) {
+    if (desc->formats[i] == format) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void index_free(void) {
+  pthread_rwlock_wrlock(&index_tbl.lock);
+  for (uint32_t i = 0; i < index_tbl.nbuckets; i++) {
+    while (index_tbl.buckets[i]) {
+      resource_desc *desc = index_tbl.buckets[i];
+      index_tbl.buckets[i] = desc->next;
+      index_release(desc);
+    }
+  }
+  free(index_tbl.buckets);
+  index_tbl.buckets = NULL;
+  index_tbl.count = 0;
+  index_tbl.unknown = 0;
+  pthread_rwlock_unlock(&index_tbl.lock);
+  pthread_rwlock_destroy(&index_tbl.lock);
+}
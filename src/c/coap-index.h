@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2026
+ * Contributors to the EdgeX Foundry
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef _COAP_INDEX_H_
+#define _COAP_INDEX_H_ 1
+
+/**
+ * @file
+ * @brief Defines the index of device resources addressable via CoAP.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "device-coap.h"
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct value_codec;
+
+/** Maximum number of content formats accepted for a resource */
+#define DESC_MAX_FORMATS 4
+
+/** A device command, as a set of resources read together */
+typedef struct {
+  char *name;
+  uint32_t nresources;
+  char **resources;     /**< resource names, in resource operation order */
+} command_info;
+
+/** Device level information shared by the descriptors of its resources */
+typedef struct device_info {
+  char *name;
+  uint32_t ncommands;
+  command_info *commands;
+  uint32_t refs;
+} device_info;
+
+/**
+ * Pre-resolved description of a device resource, so the data path need not
+ * look up the device and profile for each message. Reference counted; the
+ * index may drop a descriptor while it still is in use.
+ */
+typedef struct resource_desc {
+  char *device_name;
+  char *resource_name;
+  size_t device_len;
+  size_t resource_len;
+  iot_typecode_t type;          /**< resource value type */
+  char *units;                  /**< resource units, or NULL */
+  const struct value_codec *codec; /**< NULL if type not supported */
+  device_info *device;          /**< referenced */
+  uint16_t formats[DESC_MAX_FORMATS]; /**< accepted content formats */
+  uint8_t nformats;
+  uint32_t refs;
+  uint32_t hash;
+  uint64_t expires;             /**< msecs; for an unknown device marker */
+  iot_data_t *value;            /**< last value; see coap-cache.h */
+  uint64_t version;             /**< of value; 0 if none */
+  struct resource_desc *next;   /**< next in hash bucket */
+} resource_desc;
+
+/**
+ * Initializes the index. Descriptors are loaded per device on first lookup.
+ *
+ * @param driver For logging and SDK service
+ */
+extern void index_init(coap_driver *driver);
+
+/**
+ * Finds the descriptor for a device resource. Names need not be
+ * null-terminated.
+ *
+ * @param device Device name
+ * @param device_len Length of device name
+ * @param resource Resource name
+ * @param resource_len Length of resource name
+ * @return referenced descriptor, to release with index_release(); NULL if
+ *         device or resource not found
+ */
+extern resource_desc *index_lookup(const char *device, size_t device_len,
+                                   const char *resource, size_t resource_len);
+
+/** Adds a reference to a descriptor. */
+extern resource_desc *index_ref(resource_desc *desc);
+
+/** Releases a reference from index_lookup() or index_ref(). */
+extern void index_release(resource_desc *desc);
+
+/**
+ * Drops descriptors for a device, so they are reloaded on next lookup. A
+ * device not known to the SDK is not looked up again for a few seconds,
+ * unless invalidated. If last values are cached, the device is reloaded at
+ * once, and its values carried over.
+ *
+ * @param device_name Device added or updated
+ */
+extern void index_invalidate(const char *device_name);
+
+/**
+ * Drops descriptors for a device, with their last values.
+ *
+ * @param device_name Device removed
+ */
+extern void index_forget(const char *device_name);
+
+/**
+ * Returns a count of devices forgotten, to check cheaply whether any state
+ * kept for a device may be stale.
+ */
+extern uint64_t index_removals(void);
+
+/** Returns true if the resource accepts the content format. */
+extern bool desc_accepts(const resource_desc *desc, uint16_t format);
+
+/** Releases all descriptors. */
+extern void index_free(void);
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,176 @@
+/* Streaming parser for CoRE Link Format (RFC 6690)
+ *
+ * Copyright (c) 2026
+ * Contributors to the EdgeX Foundry
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "coap-link.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static bool is_space(uint8_t c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static void link_reset(link_parser *parser) {
+  parser->target_len = 0;
+  parser->target_long = false;
+  parser->rt[0] = '\0';
+  parser->ct = -1;
+  parser->obs = false;
+}
+
+static bool name_is(const link_parser *parser, const char *name) {
+  return parser->name_len == strlen(name) &&
+         !memcmp(parser->name, name, parser->name_len);
+}
+
+/* Keeps the value of the parameter just parsed, if one used */
+static void param_end(link_parser *parser) {
+  parser->value[parser->value_len] = '\0';
+  if (name_is(parser, "rt")) {
+    memcpy(parser->rt, parser->value, parser->value_len + 1);
+  } else if (name_is(parser, "ct") && parser->value_len) {
+    /* the first of a list of formats */
+    parser->ct = (int32_t)strtol(parser->value, NULL, 10);
+  } else if (name_is(parser, "obs")) {
+    parser->obs = true;
+  }
+  parser->name_len = 0;
+  parser->value_len = 0;
+}
+
+/* Passes the link just parsed to the handler, and starts the next */
+static void link_end(link_parser *parser) {
+  if (parser->target_len && !parser->target_long) {
+    parser->target[parser->target_len] = '\0';
+    core_link link = {.target = parser->target,
+                      .rt = parser->rt,
+                      .ct = parser->ct,
+                      .obs = parser->obs};
+    parser->handler(&link, parser->ctx);
+  }
+  link_reset(parser);
+  parser->state = LINK_START;
+}
+
+void link_parser_init(link_parser *parser, link_handler handler, void *ctx) {
+  memset(parser, 0, sizeof(*parser));
+  parser->handler = handler;
+  parser->ctx = ctx;
+  link_reset(parser);
+}
+
+void link_parser_feed(link_parser *parser, const uint8_t *data, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    uint8_t c = data[i];
+    switch (parser->state) {
+      case LINK_START:
+        if (c == '<') {
+          parser->state = LINK_TARGET;
+        } else if (!is_space(c) && c != ',') {
+          parser->state = LINK_SKIP;
+        }
+        break;
+
+      case LINK_TARGET:
+        if (c == '>') {
+          parser->state = LINK_PARAMS;
+        } else if (parser->target_len < LINK_TARGET_MAX) {
+          parser->target[parser->target_len++] = c;
+        } else {
+          parser->target_long = true;
+        }
+        break;
+
+      case LINK_PARAMS:
+        if (c == ';') {
+          parser->state = LINK_NAME;
+        } else if (c == ',') {
+          link_end(parser);
+        } else if (!is_space(c)) {
+          parser->state = LINK_SKIP;
+        }
+        break;
+
+      case LINK_NAME:
+        if (c == '=') {
+          parser->state = LINK_VALUE;
+        } else if (c == ';' || c == ',') {
+          param_end(parser);
+          if (c == ',') {
+            link_end(parser);
+          }
+        } else if (!is_space(c)) {
+          /* a name too long to keep matches none used */
+          if (parser->name_len < sizeof(parser->name)) {
+            parser->name[parser->name_len] = c;
+          }
+          parser->name_len++;
+        }
+        break;
+
+      case LINK_VALUE:
+        if (c == '"' && parser->value_len == 0) {
+          parser->state = LINK_QUOTED;
+        } else if (c == ';' || c == ',') {
+          param_end(parser);
+          parser->state = LINK_NAME;
+          if (c == ',') {
+            link_end(parser);
+          }
+        } else if (parser->value_len < LINK_VALUE_MAX) {
+          parser->value[parser->value_len++] = c;
+        }
+        break;
+
+      case LINK_QUOTED:
+        if (c == '\\') {
+          parser->state = LINK_ESCAPE;
+        } else if (c == '"') {
+          param_end(parser);
+          parser->state = LINK_PARAMS;
+        } else if (parser->value_len < LINK_VALUE_MAX) {
+          parser->value[parser->value_len++] = c;
+        }
+        break;
+
+      case LINK_ESCAPE:
+        if (parser->value_len < LINK_VALUE_MAX) {
+          parser->value[parser->value_len++] = c;
+        }
+        parser->state = LINK_QUOTED;
+        break;
+
+      case LINK_SKIP:
+        /* to the next link; a comma in a quoted value is not the end */
+        if (c == '"') {
+          parser->skip_quoted = !parser->skip_quoted;
+        } else if (c == ',' && !parser->skip_quoted) {
+          link_reset(parser);
+          parser->state = LINK_START;
+        }
+        break;
+    }
+  }
+}
+
+void link_parser_finish(link_parser *parser) {
+  switch (parser->state) {
+    case LINK_NAME:
+    case LINK_VALUE:
+      param_end(parser);
+      link_end(parser);
+      break;
+    case LINK_PARAMS:
+      link_end(parser);
+      break;
+    default:
+      link_reset(parser);
+      parser->state = LINK_START;
+  }
+  parser->skip_quoted = false;
+}
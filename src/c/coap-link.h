@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2026
+ * Contributors to the EdgeX Foundry
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef _COAP_LINK_H_
+#define _COAP_LINK_H_ 1
+
+/**
+ * @file
+ * @brief Defines a streaming parser for CoRE Link Format (RFC 6690), as
+ * served at /.well-known/core.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Longest link target kept; a link with a longer one is skipped */
+#define LINK_TARGET_MAX 128
+/** Longest attribute value kept; a longer one is truncated */
+#define LINK_VALUE_MAX 64
+
+/** A link, with the attributes used for discovery */
+typedef struct {
+  const char *target;   /**< URI reference, null-terminated */
+  const char *rt;       /**< resource type; empty if none */
+  int32_t ct;           /**< content format; -1 if none */
+  bool obs;             /**< observable */
+} core_link;
+
+/** Called for each link parsed */
+typedef void (*link_handler)(const core_link *link, void *ctx);
+
+typedef enum {
+  LINK_START,
+  LINK_TARGET,
+  LINK_PARAMS,
+  LINK_NAME,
+  LINK_VALUE,
+  LINK_QUOTED,
+  LINK_ESCAPE,
+  LINK_SKIP
+} link_state;
+
+/**
+ * Parser state, which holds only the link being parsed, so a document may be
+ * fed in pieces as it arrives, like blocks of a response.
+ */
+typedef struct {
+  link_state state;
+  bool skip_quoted;     /**< in a quoted value while skipping */
+  char target[LINK_TARGET_MAX + 1];
+  size_t target_len;
+  bool target_long;     /**< target exceeds LINK_TARGET_MAX */
+  char name[8];
+  size_t name_len;
+  char value[LINK_VALUE_MAX + 1];
+  size_t value_len;
+  char rt[LINK_VALUE_MAX + 1];
+  int32_t ct;
+  bool obs;
+  link_handler handler;
+  void *ctx;
+} link_parser;
+
+/**
+ * Starts parsing a document.
+ *
+ * @param parser Parser state
+ * @param handler Called for each link
+ * @param ctx Passed to handler
+ */
+extern void link_parser_init(link_parser *parser, link_handler handler,
+                             void *ctx);
+
+/**
+ * Parses the next piece of a document, calling the handler for each link
+ * completed. A malformed link is skipped, up to the next link.
+ *
+ * @param parser Parser state
+ * @param data Piece of document
+ * @param len Length of piece
+ */
+extern void link_parser_feed(link_parser *parser, const uint8_t *data,
+                             size_t len);
+
+/** Ends the document, calling the handler for the last link if complete. */
+extern void link_parser_finish(link_parser *parser);
+#ifdef __cplusplus
+}
+#endif
+#endif
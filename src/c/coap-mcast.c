@@ -0,0 +1,351 @@
+/* Group reads from end devices over multicast
+ *
+ * Copyright (c) 2026
+ * Contributors to the EdgeX Foundry
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "coap-mcast.h"
+
+#include <coap2/coap.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "coap-metrics.h"
+#include "coap-resolve.h"
+#include "coap-util.h"
+
+#define MCAST_TOKEN_LEN 8
+/* largest response read; a longer one is dropped */
+#define MCAST_DATAGRAM_MAX 1500
+/* room for the request header, token and options */
+#define MCAST_REQUEST_MAX 128
+
+/* Response of a group member */
+typedef struct {
+  coap_address_t src;
+  uint16_t format;
+  uint8_t *data;
+  size_t len;
+} member_response;
+
+/*
+ * Read of a resource from a group. Responses are collected until end, by
+ * whichever readers are waiting; any left are read from the socket by the
+ * next reader.
+ */
+typedef struct group_read {
+  char *group;
+  char *resource;
+  int fd;
+  uint8_t token[MCAST_TOKEN_LEN];
+  uint64_t end;                  /**< msecs when collection ends */
+  uint32_t users;                /**< readers waiting on responses */
+  member_response *responses;
+  uint32_t count;
+  uint32_t capacity;
+  struct group_read *next;
+} group_read;
+
+static struct {
+  pthread_mutex_t mutex;
+  group_read *reads;
+  uint16_t next_mid;
+} mcast = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+static void group_free(group_read *read) {
+  if (read->fd >= 0) {
+    close(read->fd);
+  }
+  for (uint32_t i = 0; i < read->count; i++) {
+    free(read->responses[i].data);
+  }
+  free(read->responses);
+  free(read->group);
+  free(read->resource);
+  free(read);
+}
+
+/* True if two addresses are of the same host, whatever the port */
+static bool same_host(const coap_address_t *a, const coap_address_t *b) {
+  if (a->addr.sa.sa_family != b->addr.sa.sa_family) {
+    return false;
+  }
+  if (a->addr.sa.sa_family == AF_INET6) {
+    return !memcmp(&a->addr.sin6.sin6_addr, &b->addr.sin6.sin6_addr,
+                   sizeof(a->addr.sin6.sin6_addr));
+  }
+  return a->addr.sin.sin_addr.s_addr == b->addr.sin.sin_addr.s_addr;
+}
+
+/*
+ * Finds the read of a group and resource still collecting, and frees ended
+ * reads no longer in use; call with mutex held.
+ */
+static group_read *group_find(const char *group, const char *resource,
+                              uint64_t now) {
+  group_read *found = NULL;
+  group_read **link = &mcast.reads;
+  while (*link) {
+    group_read *read = *link;
+    if (now >= read->end && read->users == 0) {
+      *link = read->next;
+      group_free(read);
+      continue;
+    }
+    if (now < read->end && !strcmp(read->group, group) &&
+        !strcmp(read->resource, resource)) {
+      found = read;
+    }
+    link = &read->next;
+  }
+  return found;
+}
+
+/*
+ * Builds the NON GET for a group read; NULL on failure, as when the path does
+ * not fit in the request
+ */
+static coap_pdu_t *group_request(const group_read *read, bool cbor) {
+  size_t uri_size = sizeof("//" RESOURCE_SEG1) + strlen(read->resource);
+  char uri[uri_size];
+  snprintf(uri, sizeof(uri), "/%s/%s", RESOURCE_SEG1, read->resource);
+  /* each path segment takes at most 5 bytes of option header */
+  size_t buflen = uri_size + 5;
+  for (const char *c = uri; *c; c++) {
+    buflen += *c == '/' ? 5 : 0;
+  }
+  unsigned char buf[buflen];
+  unsigned char optbuf[4];
+
+  coap_pdu_t *pdu = coap_pdu_init(COAP_MESSAGE_NON, COAP_REQUEST_GET,
+                                  ++mcast.next_mid, MCAST_REQUEST_MAX);
+  if (!pdu || !coap_add_token(pdu, MCAST_TOKEN_LEN, read->token)) {
+    goto fail;
+  }
+  int segs = coap_split_path((const uint8_t *)uri, strlen(uri), buf, &buflen);
+  for (unsigned char *opt = buf; segs--; opt += coap_opt_size(opt)) {
+    if (!coap_add_option(pdu, COAP_OPTION_URI_PATH, coap_opt_length(opt),
+                         coap_opt_value(opt))) {
+      goto fail;
+    }
+  }
+  if (cbor &&
+      !coap_add_option(pdu, COAP_OPTION_ACCEPT,
+                       coap_encode_var_safe(optbuf, sizeof(optbuf),
+                                            COAP_MEDIATYPE_APPLICATION_CBOR),
+                       optbuf)) {
+    goto fail;
+  }
+  return pdu;
+
+fail:
+  coap_delete_pdu(pdu);
+  return NULL;
+}
+
+/* Encodes a PDU and sends it to addr; false on failure */
+static bool send_pdu(int fd, coap_pdu_t *pdu, const coap_address_t *addr) {
+  size_t hdr_len = coap_pdu_encode_header(pdu, COAP_PROTO_UDP);
+  if (hdr_len == 0) {
+    return false;
+  }
+  trace_pdu("sent", pdu);
+  return sendto(fd, pdu->token - hdr_len, pdu->used_size + hdr_len, 0,
+                &addr->addr.sa, addr->size) >= 0;
+}
+
+/*
+ * Starts a read of a resource from the group of a device, sending the
+ * request; call with mutex held.
+ */
+static group_read *group_open(const end_dev_params *params,
+                              const char *resource, uint64_t now) {
+  coap_driver *sdk_ctx = impl;
+  coap_address_t dst;
+  char port[8];
+  snprintf(port, sizeof(port), "%u", COAP_DEFAULT_PORT);
+  if (resolve_address(params->mcast_group, port, &dst) < 0) {
+    iot_log_error(sdk_ctx->lc, "COAP:cannot resolve group %s",
+                  params->mcast_group);
+    return NULL;
+  }
+
+  group_read *read = calloc(1, sizeof(*read));
+  read->group = strdup(params->mcast_group);
+  read->resource = strdup(resource);
+  read->end = now + params->mcast_leisure_msecs;
+  random_token(read->token, MCAST_TOKEN_LEN);
+  read->fd = socket(dst.addr.sa.sa_family,
+                    SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  coap_pdu_t *pdu = read->fd >= 0 ? group_request(read, params->cbor) : NULL;
+  bool sent = pdu && send_pdu(read->fd, pdu, &dst);
+  coap_delete_pdu(pdu);
+  if (!sent) {
+    iot_log_error(sdk_ctx->lc, "COAP:cannot send read of %s to group %s",
+                  resource, params->mcast_group);
+    group_free(read);
+    return NULL;
+  }
+  metric_add(METRIC_CLIENT_GROUP_REQUESTS, 1);
+  metric_add(METRIC_CLIENT_REQUESTS, 1);
+
+  read->next = mcast.reads;
+  mcast.reads = read;
+  return read;
+}
+
+static member_response *find_response(group_read *read,
+                                      const coap_address_t *src) {
+  for (uint32_t i = 0; i < read->count; i++) {
+    if (same_host(&read->responses[i].src, src)) {
+      return &read->responses[i];
+    }
+  }
+  return NULL;
+}
+
+/* Keeps a successful response from a member; call with mutex held */
+static void group_response(group_read *read, const coap_address_t *src,
+                           coap_pdu_t *pdu) {
+  coap_opt_iterator_t it;
+  trace_pdu("received", pdu);
+  if (pdu->token_length != MCAST_TOKEN_LEN ||
+      memcmp(pdu->token, read->token, MCAST_TOKEN_LEN) ||
+      COAP_PDU_IS_EMPTY(pdu) || COAP_PDU_IS_REQUEST(pdu)) {
+    return;
+  }
+  /* a member may answer with CON, although RFC 7252 suggests NON */
+  if (pdu->type == COAP_MESSAGE_CON) {
+    coap_pdu_t *ack = coap_pdu_init(COAP_MESSAGE_ACK, 0, pdu->tid, 0);
+    if (ack) {
+      send_pdu(read->fd, ack, src);
+      coap_delete_pdu(ack);
+    }
+  }
+  metric_add(METRIC_CLIENT_GROUP_RESPONSES, 1);
+  metric_response(METRIC_CLIENT_RESPONSES_2XX, pdu->code);
+
+  /* the rest of a response in blocks is left to a unicast read */
+  coap_block_t block;
+  if (COAP_RESPONSE_CLASS(pdu->code) != 2 || find_response(read, src) ||
+      (coap_get_block(pdu, COAP_OPTION_BLOCK2, &block) && block.m)) {
+    return;
+  }
+  if (read->count == read->capacity) {
+    uint32_t capacity = read->capacity ? read->capacity * 2 : 16;
+    member_response *responses =
+        realloc(read->responses, capacity * sizeof(*responses));
+    if (responses == NULL) {
+      return;
+    }
+    read->responses = responses;
+    read->capacity = capacity;
+  }
+
+  member_response *response = &read->responses[read->count];
+  uint8_t *data = NULL;
+  size_t len = 0;
+  coap_get_data(pdu, &len, &data);
+  response->data = malloc(len ? len : 1);
+  if (response->data == NULL) {
+    return;
+  }
+  memcpy(response->data, data, len);
+  response->len = len;
+  response->src = *src;
+  response->format = COAP_MEDIATYPE_TEXT_PLAIN;
+  coap_opt_t *opt = coap_check_option(pdu, COAP_OPTION_CONTENT_FORMAT, &it);
+  if (opt) {
+    response->format =
+        coap_decode_var_bytes(coap_opt_value(opt), coap_opt_length(opt));
+  }
+  read->count++;
+}
+
+/* Reads the responses waiting on the socket; call with mutex held */
+static void group_receive(group_read *read) {
+  uint8_t buf[MCAST_DATAGRAM_MAX];
+  while (true) {
+    coap_address_t src;
+    coap_address_init(&src);
+    /* the full length is returned, so a truncated response is seen */
+    ssize_t len = recvfrom(read->fd, buf, sizeof(buf), MSG_TRUNC,
+                           &src.addr.sa, &src.size);
+    if (len < 0) {
+      return;
+    }
+    if ((size_t)len > sizeof(buf)) {
+      continue;
+    }
+    coap_pdu_t *pdu = coap_pdu_init(0, 0, 0, len);
+    if (pdu && coap_pdu_parse(COAP_PROTO_UDP, buf, len, pdu)) {
+      group_response(read, &src, pdu);
+    }
+    coap_delete_pdu(pdu);
+  }
+}
+
+uint8_t *mcast_read(const end_dev_params *params, const char *resource_name,
+                    uint16_t *format, size_t *len) {
+  coap_address_t member;
+  if (!resolve_cached(params->end_dev_addr, &member)) {
+    if (!params->addr_resolved) {
+      return NULL;
+    }
+    member = params->addr;
+  }
+
+  pthread_mutex_lock(&mcast.mutex);
+  uint64_t now = monotonic_msecs();
+  group_read *read = group_find(params->mcast_group, resource_name, now);
+  if (read == NULL) {
+    read = group_open(params, resource_name, now);
+  }
+  uint8_t *data = NULL;
+  if (read) {
+    read->users++;
+    while (true) {
+      group_receive(read);
+      member_response *response = find_response(read, &member);
+      if (response) {
+        data = malloc(response->len ? response->len : 1);
+        if (data) {
+          memcpy(data, response->data, response->len);
+          *len = response->len;
+          *format = response->format;
+        }
+        break;
+      }
+      now = monotonic_msecs();
+      if (now >= read->end) {
+        break;
+      }
+      /* other readers may take the responses meanwhile */
+      struct pollfd pfd = {.fd = read->fd, .events = POLLIN};
+      pthread_mutex_unlock(&mcast.mutex);
+      poll(&pfd, 1, (int)(read->end - now));
+      pthread_mutex_lock(&mcast.mutex);
+    }
+    read->users--;
+  }
+  pthread_mutex_unlock(&mcast.mutex);
+  return data;
+}
+
+void mcast_free(void) {
+  pthread_mutex_lock(&mcast.mutex);
+  while (mcast.reads) {
+    group_read *read = mcast.reads;
+    mcast.reads = read->next;
+    group_free(read);
+  }
+  pthread_mutex_unlock(&mcast.mutex);
+}
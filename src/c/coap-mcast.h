@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2026
+ * Contributors to the EdgeX Foundry
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef _COAP_MCAST_H_
+#define _COAP_MCAST_H_ 1
+
+/**
+ * @file
+ * @brief Defines group reads, which read a resource from all end devices in a
+ * multicast group with one request (RFC 7252, sec 8).
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "coap-client.h"
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Default msecs to collect the responses to a group read */
+#define MCAST_DEFAULT_LEISURE_MSECS 2000
+
+/**
+ * Reads a resource of a device from the response of the device to a group
+ * read. If no read of the group and resource is collecting responses, a NON
+ * GET of /a1r/{resource-name} is sent to the group, and responses are
+ * collected for the leisure of the device. Waits until the device responds
+ * or the collection ends. Responses are attributed to devices by source
+ * address. Safe to call from any thread.
+ *
+ * @param params Parameters of the device, with its group address
+ * @param resource_name Resource to read
+ * @param format Set to the content format of the response
+ * @param len Set to the length of the payload
+ * @return payload, which the caller must free; NULL if the device did not
+ *         respond with success in time
+ */
+extern uint8_t *mcast_read(const end_dev_params *params,
+                           const char *resource_name, uint16_t *format,
+                           size_t *len);
+
+/** Ends all group reads. No read may be in progress. */
+extern void mcast_free(void);
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,288 @@
+/* Counters and latency histograms for the CoAP data plane
+ *
+ * Copyright (c) 2026
+ * Contributors to the EdgeX Foundry
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "coap-metrics.h"
+
+#include <coap2/coap.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "coap-health.h"
+#include "coap-publish.h"
+
+/* upper bound of first histogram bucket; each bucket doubles it */
+#define METRIC_FIRST_BOUND_USECS 16
+/* finite buckets, up to 16 s; the last one counts larger values */
+#define METRIC_BUCKETS 21
+
+/*
+ * Metrics updated by one thread. A shard is written only by the thread that
+ * owns it, and read by the exporter, so updates are relaxed atomic stores
+ * rather than read-modify-write. A shard is never freed: when its thread
+ * exits it is handed to the next new thread, keeping its counts.
+ */
+typedef struct metric_shard {
+  uint64_t counters[METRIC_COUNTERS];
+  uint64_t buckets[METRIC_HISTOGRAMS][METRIC_BUCKETS + 1];
+  uint64_t sums[METRIC_HISTOGRAMS];
+  bool owned;
+  struct metric_shard *next;
+} __attribute__((aligned(64))) metric_shard;
+
+/* Prometheus name, labels and help of a counter */
+typedef struct {
+  const char *name;
+  const char *labels;
+  const char *help;
+} metric_info;
+
+static const metric_info counter_info[METRIC_COUNTERS] = {
+    [METRIC_SERVER_REQUESTS] = {"coap_server_requests_total", NULL,
+                                "Requests received from devices"},
+    [METRIC_SERVER_RESPONSES_2XX] = {"coap_server_responses_total",
+                                     "class=\"2xx\"",
+                                     "Responses to devices, by class"},
+    [METRIC_SERVER_RESPONSES_4XX] = {"coap_server_responses_total",
+                                     "class=\"4xx\"", NULL},
+    [METRIC_SERVER_RESPONSES_5XX] = {"coap_server_responses_total",
+                                     "class=\"5xx\"", NULL},
+    [METRIC_SERVER_INVALID_PAYLOADS] = {"coap_server_invalid_payloads_total",
+                                        NULL, "Payloads that failed to parse"},
+    [METRIC_SERVER_BUSY] = {"coap_server_busy_total", NULL,
+                            "Requests rejected with the queue full"},
+    [METRIC_SERVER_NON_LOST] = {"coap_server_non_lost_total", NULL,
+                                "NON requests lost, from message ID gaps"},
+    [METRIC_SERVER_VALUE_REQUESTS] = {"coap_server_value_requests_total", NULL,
+                                      "Last values served, by GET or Observe"},
+    [METRIC_SERVER_VALUES_VALID] = {"coap_server_values_valid_total", NULL,
+                                    "GETs of last values answered 2.03 Valid"},
+    [METRIC_SERVER_RECV_CALLS] = {"coap_server_recv_calls_total", NULL,
+                                  "Receive system calls, with batched I/O"},
+    [METRIC_SERVER_DATAGRAMS_IN] = {"coap_server_datagrams_received_total",
+                                    NULL,
+                                    "Datagrams received, with batched I/O"},
+    [METRIC_SERVER_SEND_CALLS] = {"coap_server_send_calls_total", NULL,
+                                  "Send system calls, with batched I/O"},
+    [METRIC_SERVER_DATAGRAMS_OUT] = {"coap_server_datagrams_sent_total", NULL,
+                                     "Datagrams sent, with batched I/O"},
+    [METRIC_READINGS_POSTED] = {"coap_readings_posted_total", NULL,
+                                "Readings posted to EdgeX"},
+    [METRIC_CLIENT_REQUESTS] = {"coap_client_requests_total", NULL,
+                                "Requests and blocks sent to end devices"},
+    [METRIC_CLIENT_RESPONSES_2XX] = {"coap_client_responses_total",
+                                     "class=\"2xx\"",
+                                     "Responses from end devices, by class"},
+    [METRIC_CLIENT_RESPONSES_4XX] = {"coap_client_responses_total",
+                                     "class=\"4xx\"", NULL},
+    [METRIC_CLIENT_RESPONSES_5XX] = {"coap_client_responses_total",
+                                     "class=\"5xx\"", NULL},
+    [METRIC_CLIENT_NACK_RST] = {"coap_client_nacks_total", "reason=\"reset\"",
+                                "Requests not acknowledged, by reason"},
+    [METRIC_CLIENT_NACK_RETRIES] = {"coap_client_nacks_total",
+                                    "reason=\"retries\"", NULL},
+    [METRIC_CLIENT_NACK_TLS] = {"coap_client_nacks_total", "reason=\"tls\"",
+                                NULL},
+    [METRIC_CLIENT_NACK_OTHER] = {"coap_client_nacks_total",
+                                  "reason=\"undeliverable\"", NULL},
+    [METRIC_CLIENT_TIMEOUTS] = {"coap_client_timeouts_total", NULL,
+                                "Requests past their deadline"},
+    [METRIC_CLIENT_NON_LOST] = {"coap_client_non_lost_total", NULL,
+                                "NON requests without a response"},
+    [METRIC_CLIENT_CIRCUIT_OPEN] = {"coap_client_circuit_open_total", NULL,
+                                    "Requests failed as the device is DOWN"},
+    [METRIC_CLIENT_GROUP_REQUESTS] = {"coap_client_group_requests_total", NULL,
+                                      "Multicast reads sent to device groups"},
+    [METRIC_CLIENT_GROUP_RESPONSES] = {"coap_client_group_responses_total",
+                                       NULL,
+                                       "Responses from members to group reads"},
+    [METRIC_SESSIONS_REUSED] = {"coap_client_sessions_reused_total", NULL,
+                                "Requests sent on a pooled session"},
+    [METRIC_SESSIONS_FAILED] = {"coap_client_sessions_failed_total", NULL,
+                                "Pooled sessions closed on failure"},
+    [METRIC_SESSIONS_DEFERRED] = {"coap_client_sessions_deferred_total", NULL,
+                                  "Requests deferred awaiting a session"},
+    [METRIC_DTLS_HANDSHAKES] = {"coap_client_dtls_handshakes_total", NULL,
+                                "DTLS handshakes started"},
+};
+
+static const metric_info histogram_info[METRIC_HISTOGRAMS] = {
+    [METRIC_SERVER_HANDLING] = {"coap_server_handling_seconds", NULL,
+                                "Time to handle a request from a device"},
+    [METRIC_CLIENT_RTT] = {"coap_client_rtt_seconds", NULL,
+                           "Time from a request to its response"},
+    [METRIC_DTLS_HANDSHAKE_TIME] = {"coap_client_dtls_handshake_seconds", NULL,
+                                    "Time to complete a DTLS handshake"},
+};
+
+static metric_shard *shards = NULL;
+static __thread metric_shard *local = NULL;
+static pthread_key_t shard_key;
+static pthread_once_t shard_key_once = PTHREAD_ONCE_INIT;
+
+/* Hands the shard of an exiting thread to the next new thread */
+static void shard_release(void *arg) {
+  metric_shard *shard = arg;
+  __atomic_store_n(&shard->owned, false, __ATOMIC_RELEASE);
+}
+
+static void shard_key_create(void) {
+  pthread_key_create(&shard_key, shard_release);
+}
+
+/* Claims a released shard, or adds a new one; NULL if out of memory */
+static metric_shard *shard_claim(void) {
+  pthread_once(&shard_key_once, shard_key_create);
+
+  metric_shard *shard = __atomic_load_n(&shards, __ATOMIC_ACQUIRE);
+  for (; shard; shard = shard->next) {
+    bool owned = false;
+    if (__atomic_compare_exchange_n(&shard->owned, &owned, true, false,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      break;
+    }
+  }
+  if (shard == NULL) {
+    if (posix_memalign((void **)&shard, 64, sizeof(*shard))) {
+      return NULL;
+    }
+    *shard = (metric_shard){.owned = true};
+    shard->next = __atomic_load_n(&shards, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&shards, &shard->next, shard, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+  }
+  pthread_setspecific(shard_key, shard);
+  local = shard;
+  return shard;
+}
+
+/* Adds to a value written only by this thread */
+static inline void shard_add(uint64_t *value, uint64_t n) {
+  __atomic_store_n(value, __atomic_load_n(value, __ATOMIC_RELAXED) + n,
+                   __ATOMIC_RELAXED);
+}
+
+void metric_add(metric_counter counter, uint64_t n) {
+  metric_shard *shard = local ? local : shard_claim();
+  if (shard) {
+    shard_add(&shard->counters[counter], n);
+  }
+}
+
+void metric_response(metric_counter first_class, uint8_t code) {
+  switch (COAP_RESPONSE_CLASS(code)) {
+    case 4:
+      metric_add(first_class + 1, 1);
+      break;
+    case 5:
+      metric_add(first_class + 2, 1);
+      break;
+    default:
+      metric_add(first_class, 1);
+      break;
+  }
+}
+
+void metric_observe(metric_histogram histogram, uint64_t usecs) {
+  metric_shard *shard = local ? local : shard_claim();
+  if (shard == NULL) {
+    return;
+  }
+  /* smallest bucket with bound 16 << i >= usecs */
+  uint32_t i = 0;
+  if (usecs > METRIC_FIRST_BOUND_USECS) {
+    i = 64 - __builtin_clzll(usecs - 1) - 4;
+    if (i > METRIC_BUCKETS) {
+      i = METRIC_BUCKETS;
+    }
+  }
+  shard_add(&shard->buckets[histogram][i], 1);
+  shard_add(&shard->sums[histogram], usecs);
+}
+
+/* Writes HELP and TYPE lines, once for the counters sharing a name */
+static void write_header(FILE *out, const metric_info *info,
+                         const char *type) {
+  if (info->help) {
+    fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", info->name, info->help,
+            info->name, type);
+  }
+}
+
+char *metrics_format(size_t *len) {
+  char *text = NULL;
+  FILE *out = open_memstream(&text, len);
+  if (out == NULL) {
+    return NULL;
+  }
+
+  uint64_t counters[METRIC_COUNTERS] = {0};
+  uint64_t buckets[METRIC_HISTOGRAMS][METRIC_BUCKETS + 1] = {{0}};
+  uint64_t sums[METRIC_HISTOGRAMS] = {0};
+  metric_shard *shard = __atomic_load_n(&shards, __ATOMIC_ACQUIRE);
+  for (; shard; shard = shard->next) {
+    for (uint32_t c = 0; c < METRIC_COUNTERS; c++) {
+      counters[c] += __atomic_load_n(&shard->counters[c], __ATOMIC_RELAXED);
+    }
+    for (uint32_t h = 0; h < METRIC_HISTOGRAMS; h++) {
+      for (uint32_t i = 0; i <= METRIC_BUCKETS; i++) {
+        buckets[h][i] +=
+            __atomic_load_n(&shard->buckets[h][i], __ATOMIC_RELAXED);
+      }
+      sums[h] += __atomic_load_n(&shard->sums[h], __ATOMIC_RELAXED);
+    }
+  }
+
+  for (uint32_t c = 0; c < METRIC_COUNTERS; c++) {
+    const metric_info *info = &counter_info[c];
+    write_header(out, info, "counter");
+    if (info->labels) {
+      fprintf(out, "%s{%s} %" PRIu64 "\n", info->name, info->labels,
+              counters[c]);
+    } else {
+      fprintf(out, "%s %" PRIu64 "\n", info->name, counters[c]);
+    }
+  }
+
+  for (uint32_t h = 0; h < METRIC_HISTOGRAMS; h++) {
+    const metric_info *info = &histogram_info[h];
+    write_header(out, info, "histogram");
+    uint64_t count = 0;
+    for (uint32_t i = 0; i < METRIC_BUCKETS; i++) {
+      count += buckets[h][i];
+      uint64_t bound = (uint64_t)METRIC_FIRST_BOUND_USECS << i;
+      fprintf(out, "%s_bucket{le=\"%" PRIu64 ".%06" PRIu64 "\"} %" PRIu64 "\n",
+              info->name, bound / 1000000, bound % 1000000, count);
+    }
+    count += buckets[h][METRIC_BUCKETS];
+    fprintf(out, "%s_bucket{le=\"+Inf\"} %" PRIu64 "\n", info->name, count);
+    fprintf(out, "%s_sum %" PRIu64 ".%06" PRIu64 "\n", info->name,
+            sums[h] / 1000000, sums[h] % 1000000);
+    fprintf(out, "%s_count %" PRIu64 "\n", info->name, count);
+  }
+
+  fprintf(out,
+          "# HELP coap_publish_queue_depth Readings queued for publication\n"
+          "# TYPE coap_publish_queue_depth gauge\n"
+          "coap_publish_queue_depth %" PRIu64 "\n",
+          (uint64_t)publish_queue_depth());
+  fprintf(out,
+          "# HELP coap_devices_down End devices reported DOWN\n"
+          "# TYPE coap_devices_down gauge\n"
+          "coap_devices_down %" PRIu32 "\n",
+          health_down_count());
+
+  if (fclose(out)) {
+    free(text);
+    return NULL;
+  }
+  return text;
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2026
+ * Contributors to the EdgeX Foundry
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef _COAP_METRICS_H_
+#define _COAP_METRICS_H_ 1
+
+/**
+ * @file
+ * @brief Defines counters and latency histograms for the CoAP server and
+ * client, exported as Prometheus text.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "device-coap.h"
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Path of the CoAP resource serving the metrics, if enabled */
+#define METRICS_RESOURCE "metrics"
+
+/** Counters. Response classes follow in order 2.xx, 4.xx, 5.xx. */
+typedef enum {
+  METRIC_SERVER_REQUESTS,          /**< requests received from devices */
+  METRIC_SERVER_RESPONSES_2XX,
+  METRIC_SERVER_RESPONSES_4XX,
+  METRIC_SERVER_RESPONSES_5XX,
+  METRIC_SERVER_INVALID_PAYLOADS,  /**< payloads not read as the value type */
+  METRIC_SERVER_BUSY,              /**< requests rejected as queue full */
+  METRIC_SERVER_NON_LOST,          /**< NON requests missing from ID gaps */
+  METRIC_SERVER_VALUE_REQUESTS,    /**< last values served, or notified */
+  METRIC_SERVER_VALUES_VALID,      /**< GETs answered 2.03 Valid by ETag */
+  METRIC_SERVER_RECV_CALLS,        /**< receive calls, with batched I/O */
+  METRIC_SERVER_DATAGRAMS_IN,      /**< datagrams received, with batched I/O */
+  METRIC_SERVER_SEND_CALLS,        /**< send calls, with batched I/O */
+  METRIC_SERVER_DATAGRAMS_OUT,     /**< datagrams sent, with batched I/O */
+  METRIC_READINGS_POSTED,          /**< readings posted to the SDK */
+  METRIC_CLIENT_REQUESTS,          /**< requests and blocks sent */
+  METRIC_CLIENT_RESPONSES_2XX,
+  METRIC_CLIENT_RESPONSES_4XX,
+  METRIC_CLIENT_RESPONSES_5XX,
+  METRIC_CLIENT_NACK_RST,
+  METRIC_CLIENT_NACK_RETRIES,      /**< no ACK after all retransmissions */
+  METRIC_CLIENT_NACK_TLS,
+  METRIC_CLIENT_NACK_OTHER,        /**< not deliverable, or ICMP error */
+  METRIC_CLIENT_TIMEOUTS,          /**< requests past their deadline */
+  METRIC_CLIENT_NON_LOST,          /**< NON requests without a response */
+  METRIC_CLIENT_CIRCUIT_OPEN,      /**< requests failed as device DOWN */
+  METRIC_CLIENT_GROUP_REQUESTS,    /**< multicast reads sent to groups */
+  METRIC_CLIENT_GROUP_RESPONSES,   /**< member responses to group reads */
+  METRIC_SESSIONS_REUSED,
+  METRIC_SESSIONS_FAILED,
+  METRIC_SESSIONS_DEFERRED,
+  METRIC_DTLS_HANDSHAKES,
+  METRIC_COUNTERS
+} metric_counter;
+
+/** Latency histograms, recorded in microseconds */
+typedef enum {
+  METRIC_SERVER_HANDLING,          /**< time to handle a request */
+  METRIC_CLIENT_RTT,               /**< time from request to response */
+  METRIC_DTLS_HANDSHAKE_TIME,
+  METRIC_HISTOGRAMS
+} metric_histogram;
+
+/**
+ * Adds to a counter. Each thread updates counters of its own, so this takes
+ * no lock and shares no cache line with other threads.
+ *
+ * @param counter Counter to add to
+ * @param n Amount to add
+ */
+extern void metric_add(metric_counter counter, uint64_t n);
+
+/**
+ * Counts a response by class, as 2.xx (or none), 4.xx or 5.xx.
+ *
+ * @param first_class Counter for 2.xx responses; the others follow it
+ * @param code CoAP response code; 0 for a response not sent
+ */
+extern void metric_response(metric_counter first_class, uint8_t code);
+
+/**
+ * Records a latency in a histogram.
+ *
+ * @param histogram Histogram to record in
+ * @param usecs Latency in microseconds
+ */
+extern void metric_observe(metric_histogram histogram, uint64_t usecs);
+
+/**
+ * Formats all metrics, summed over threads, in the Prometheus text format.
+ *
+ * @param len Set to the length of the result
+ * @return Text, which the caller must free; NULL if out of memory
+ */
+extern char *metrics_format(size_t *len);
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,354 @@
+/* Pool of CoAP client sessions to end devices
+ *
+ * Copyright (c) 2026
+ * Contributors to the EdgeX Foundry
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "coap-pool.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "coap-metrics.h"
+#include "coap-resolve.h"
+#include "coap-util.h"
+
+/* interval between logs of session counts, when changed */
+#define POOL_STATS_LOG_MSECS 60000
+
+static coap_driver *sdk_ctx;
+static coap_context_t *pool_ctx;
+static pool_entry *pool_head = NULL;
+static uint32_t pool_size = 0;
+static uint64_t last_eviction = 0;
+static uint32_t handshakes_inflight = 0;
+static pool_stats stats;
+static pool_stats logged_stats;
+static uint64_t last_stats_log = 0;
+
+/* Pooled sessions are matched on all of the parameters used to create them */
+static bool key_matches(const end_dev_params *key,
+                        const end_dev_params *params) {
+  return key->security_mode == params->security_mode &&
+         !strcmp(key->end_dev_addr, params->end_dev_addr) &&
+         key->max_retransmit == params->max_retransmit &&
+         !memcmp(&key->ack_timeout, &params->ack_timeout,
+                 sizeof(key->ack_timeout)) &&
+         !memcmp(&key->ack_random_factor, &params->ack_random_factor,
+                 sizeof(key->ack_random_factor)) &&
+         (key->security_mode != SECURITY_MODE_PSK ||
+          !strncmp(key->psk_key, params->psk_key, sizeof(key->psk_key)));
+}
+
+static void handshake_end(pool_entry *entry) {
+  if (entry->handshaking) {
+    entry->handshaking = false;
+    handshakes_inflight--;
+  }
+}
+
+/*
+ * Marks the session broken, and schedules reconnection after a backoff with
+ * jitter, so devices that failed together do not reconnect together.
+ */
+static void entry_fail(pool_entry *entry) {
+  if (entry->broken) {
+    return;
+  }
+  entry->broken = true;
+  handshake_end(entry);
+  stats.failed++;
+  metric_add(METRIC_SESSIONS_FAILED, 1);
+
+  uint32_t shift = entry->failures < 16 ? entry->failures : 16;
+  uint64_t delay = (uint64_t)POOL_RECONNECT_MIN_MSECS << shift;
+  if (delay > POOL_RECONNECT_MAX_MSECS) {
+    delay = POOL_RECONNECT_MAX_MSECS;
+  }
+  delay = delay / 2 + (uint64_t)random() % (delay / 2 + 1);
+  entry->failures++;
+  entry->retry_at = monotonic_msecs() + delay;
+}
+
+/*
+ * Marks the pooled session broken when DTLS fails or the peer closes it, so
+ * the next request reconnects rather than reusing a dead session.
+ */
+static int event_handler(coap_context_t *ctx, coap_event_t event,
+                         coap_session_t *session) {
+  (void)ctx;
+  pool_entry *entry = session ? coap_session_get_app_data(session) : NULL;
+  if (entry == NULL) {
+    return 0;
+  }
+  switch (event) {
+    case COAP_EVENT_DTLS_CONNECTED:
+      if (entry->handshaking) {
+        handshake_end(entry);
+        uint64_t msecs = monotonic_msecs() - entry->created;
+        stats.connected++;
+        stats.handshake_msecs += msecs;
+        metric_observe(METRIC_DTLS_HANDSHAKE_TIME, msecs * 1000);
+      }
+      break;
+    case COAP_EVENT_DTLS_CLOSED:
+    case COAP_EVENT_DTLS_ERROR:
+    case COAP_EVENT_SESSION_CLOSED:
+    case COAP_EVENT_SESSION_FAILED:
+      iot_log_info(sdk_ctx->lc, "COAP:session to %s closed, event 0x%x",
+                   entry->key.end_dev_addr, event);
+      entry_fail(entry);
+      break;
+    default:
+      break;
+  }
+  return 0;
+}
+
+static void entry_free(pool_entry *entry) {
+  handshake_end(entry);
+  if (entry->session) {
+    coap_session_set_app_data(entry->session, NULL);
+    coap_session_release(entry->session);
+  }
+  free(entry);
+}
+
+/*
+ * Unlinks entry; prev is the preceding entry or NULL if head. Frees it now if
+ * not in use, otherwise on its final release.
+ */
+static void entry_remove(pool_entry *prev, pool_entry *entry) {
+  if (prev) {
+    prev->next = entry->next;
+  } else {
+    pool_head = entry->next;
+  }
+  pool_size--;
+  if (entry->inflight) {
+    entry->detached = true;
+  } else {
+    entry_free(entry);
+  }
+}
+
+/* Creates session for an end device; returns NULL on failure */
+static pool_entry *entry_new(const end_dev_params *params) {
+  coap_address_t dst;
+  coap_proto_t proto = COAP_PROTO_UDP;
+  uint16_t port = COAP_DEFAULT_PORT;
+
+  if (params->security_mode != SECURITY_MODE_NOSEC) {
+    proto = COAP_PROTO_DTLS;
+    port = COAPS_DEFAULT_PORT;
+  }
+  /* must not block the I/O thread on a slow resolver */
+  if (!resolve_cached(params->end_dev_addr, &dst)) {
+    if (!params->addr_resolved) {
+      iot_log_error(sdk_ctx->lc, "COAP:address %s not yet resolved",
+                    params->end_dev_addr);
+      return NULL;
+    }
+    dst = params->addr;
+  }
+  address_set_port(&dst, port);
+
+  pool_entry *entry = calloc(1, sizeof(*entry));
+  memcpy(&entry->key, params, sizeof(entry->key));
+  if (params->security_mode == SECURITY_MODE_PSK) {
+    size_t key_len = strnlen(params->psk_key, sizeof(params->psk_key));
+    entry->session = coap_new_client_session_psk(
+        pool_ctx, NULL, &dst, proto, "r17", (uint8_t *)params->psk_key,
+        key_len);
+  } else {
+    entry->session = coap_new_client_session(pool_ctx, NULL, &dst, proto);
+  }
+  if (entry->session == NULL) {
+    iot_log_error(sdk_ctx->lc, "COAP:cannot create client session to %s",
+                  params->end_dev_addr);
+    entry_free(entry);
+    return NULL;
+  }
+  coap_session_set_app_data(entry->session, entry);
+  coap_session_set_max_retransmit(entry->session, params->max_retransmit);
+  coap_session_set_ack_timeout(entry->session, params->ack_timeout);
+  coap_session_set_ack_random_factor(entry->session,
+                                     params->ack_random_factor);
+  entry->created = monotonic_msecs();
+  if (proto == COAP_PROTO_DTLS) {
+    entry->handshaking = true;
+    handshakes_inflight++;
+    stats.handshakes++;
+    metric_add(METRIC_DTLS_HANDSHAKES, 1);
+  }
+
+  iot_log_debug(sdk_ctx->lc, "COAP:new pooled session to %s",
+                params->end_dev_addr);
+  return entry;
+}
+
+/*
+ * Returns the least recently used entry not in use, with its predecessor in
+ * *lru_prev; NULL if all entries are in use.
+ */
+static pool_entry *find_lru(pool_entry **lru_prev) {
+  pool_entry *prev = NULL;
+  pool_entry *lru = NULL;
+
+  *lru_prev = NULL;
+  for (pool_entry *entry = pool_head; entry; entry = entry->next) {
+    if (!entry->inflight &&
+        (lru == NULL || entry->last_used < lru->last_used)) {
+      lru = entry;
+      *lru_prev = prev;
+    }
+    prev = entry;
+  }
+  return lru;
+}
+
+void client_pool_init(coap_driver *driver, coap_context_t *ctx) {
+  sdk_ctx = driver;
+  pool_ctx = ctx;
+  coap_register_event_handler(ctx, event_handler);
+}
+
+pool_entry *client_pool_acquire(const end_dev_params *params) {
+  uint64_t now = monotonic_msecs();
+  pool_entry *prev = NULL;
+  pool_entry *entry = pool_head;
+
+  for (; entry; prev = entry, entry = entry->next) {
+    if (key_matches(&entry->key, params)) {
+      break;
+    }
+  }
+  if (entry && entry->broken && now < entry->retry_at) {
+    iot_log_debug(sdk_ctx->lc, "COAP:session to %s failed; retry in %" PRIu64
+                  " ms", params->end_dev_addr, entry->retry_at - now);
+    stats.deferred++;
+    metric_add(METRIC_SESSIONS_DEFERRED, 1);
+    return NULL;
+  }
+  if ((entry == NULL || entry->broken) &&
+      params->security_mode != SECURITY_MODE_NOSEC && sdk_ctx->handshake_max &&
+      handshakes_inflight >= sdk_ctx->handshake_max) {
+    iot_log_debug(sdk_ctx->lc, "COAP:%u handshakes in progress; deferring %s",
+                  handshakes_inflight, params->end_dev_addr);
+    stats.deferred++;
+    metric_add(METRIC_SESSIONS_DEFERRED, 1);
+    return NULL;
+  }
+
+  uint32_t failures = 0;
+  if (entry && entry->broken) {
+    iot_log_info(sdk_ctx->lc, "COAP:reconnecting session to %s",
+                 params->end_dev_addr);
+    failures = entry->failures;
+    entry_remove(prev, entry);
+    entry = NULL;
+  }
+
+  if (entry == NULL) {
+    if (pool_size >= sdk_ctx->session_max) {
+      pool_entry *lru = find_lru(&prev);
+      if (lru == NULL) {
+        /* the maximum is a hard limit, as for handshakes */
+        iot_log_debug(sdk_ctx->lc, "COAP:all %u sessions in use; deferring %s",
+                      pool_size, params->end_dev_addr);
+        stats.deferred++;
+        metric_add(METRIC_SESSIONS_DEFERRED, 1);
+        return NULL;
+      }
+      iot_log_debug(sdk_ctx->lc, "COAP:pool full; evicting session to %s",
+                    lru->key.end_dev_addr);
+      entry_remove(prev, lru);
+    }
+    entry = entry_new(params);
+    if (entry == NULL) {
+      return NULL;
+    }
+    entry->failures = failures;
+    entry->next = pool_head;
+    pool_head = entry;
+    pool_size++;
+  } else if (!entry->handshaking) {
+    stats.reused++;
+    metric_add(METRIC_SESSIONS_REUSED, 1);
+  }
+  entry->last_used = now;
+  entry->inflight++;
+  return entry;
+}
+
+void client_pool_release(pool_entry *entry, bool failed) {
+  entry->last_used = monotonic_msecs();
+  entry->inflight--;
+  if (failed) {
+    entry_fail(entry);
+  } else if (!entry->broken) {
+    entry->failures = 0;
+  }
+  if (entry->detached && !entry->inflight) {
+    entry_free(entry);
+  }
+}
+
+/* Logs session counts if changed since last logged */
+static void log_stats(uint64_t now) {
+  if (now - last_stats_log < POOL_STATS_LOG_MSECS ||
+      !memcmp(&stats, &logged_stats, sizeof(stats))) {
+    return;
+  }
+  last_stats_log = now;
+  logged_stats = stats;
+  iot_log_info(sdk_ctx->lc,
+               "COAP:sessions reused %" PRIu64 ", handshakes %" PRIu64
+               " (completed %" PRIu64 ", avg %" PRIu64 " ms), failed %" PRIu64
+               ", deferred %" PRIu64,
+               stats.reused, stats.handshakes, stats.connected,
+               stats.connected ? stats.handshake_msecs / stats.connected : 0,
+               stats.failed, stats.deferred);
+}
+
+void client_pool_evict_idle(void) {
+  uint64_t now = monotonic_msecs();
+  uint64_t idle_msecs = (uint64_t)sdk_ctx->session_idle_secs * 1000;
+
+  /* idle timeout is in seconds, so no need to check more often */
+  if (now - last_eviction < 1000) {
+    return;
+  }
+  last_eviction = now;
+  log_stats(now);
+
+  pool_entry *prev = NULL;
+  pool_entry *entry = pool_head;
+  while (entry) {
+    pool_entry *next = entry->next;
+    if (!entry->inflight && now - entry->last_used > idle_msecs) {
+      iot_log_debug(sdk_ctx->lc, "COAP:evicting idle session to %s",
+                    entry->key.end_dev_addr);
+      entry_remove(prev, entry);
+    } else {
+      prev = entry;
+    }
+    entry = next;
+  }
+}
+
+void client_pool_stats(pool_stats *out) {
+  *out = stats;
+}
+
+void client_pool_free(void) {
+  while (pool_head) {
+    pool_entry *entry = pool_head;
+    pool_head = entry->next;
+    entry_free(entry);
+  }
+  pool_size = 0;
+}
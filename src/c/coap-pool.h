@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2026
+ * Contributors to the EdgeX Foundry
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef _COAP_POOL_H_
+#define _COAP_POOL_H_ 1
+
+/**
+ * @file
+ * @brief Defines the pool of long-lived CoAP client sessions to end devices.
+ */
+
+#include <coap2/coap.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "coap-client.h"
+#include "device-coap.h"
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Default maximum number of pooled end device sessions */
+#define POOL_DEFAULT_MAX_SESSIONS 64
+/** Default seconds a pooled session may stay unused before eviction */
+#define POOL_DEFAULT_IDLE_SECS 300
+/** Default maximum number of DTLS handshakes in progress; 0 for no limit */
+#define POOL_DEFAULT_MAX_HANDSHAKES 8
+/** Delay before reconnecting a failed session, doubled up to the max */
+#define POOL_RECONNECT_MIN_MSECS 1000
+#define POOL_RECONNECT_MAX_MSECS 60000
+
+/**
+ * A pooled client session to one end device. Keyed by the end device
+ * address, security mode and PSK, so a change of any of these yields a new
+ * session.
+ */
+typedef struct pool_entry {
+  end_dev_params key;       /**< copy of end device parameters for lookup */
+  coap_session_t *session;  /**< client session to the end device */
+  uint64_t last_used;       /**< monotonic msecs at last release */
+  uint32_t inflight;        /**< acquired and not yet released */
+  bool broken;              /**< session failed; reconnect on next acquire */
+  bool detached;            /**< removed from pool; freed on last release */
+  bool handshaking;         /**< DTLS handshake in progress */
+  uint64_t created;         /**< monotonic msecs when session was created */
+  uint32_t failures;        /**< consecutive failures of the device session */
+  uint64_t retry_at;        /**< monotonic msecs before which not reconnected */
+  struct pool_entry *next;
+} pool_entry;
+
+/** Counts of client session setup, to monitor the cost of reconnects */
+typedef struct {
+  uint64_t reused;          /**< acquires served by an established session */
+  uint64_t handshakes;      /**< full DTLS handshakes started */
+  uint64_t connected;       /**< DTLS handshakes completed */
+  uint64_t handshake_msecs; /**< total time of completed handshakes */
+  uint64_t failed;          /**< sessions failed or closed by the device */
+  uint64_t deferred;        /**< acquires refused by backoff or limit */
+} pool_stats;
+
+/**
+ * Initializes the pool. Must be called once before first use. The pool is
+ * not thread safe; all functions must be called from the thread that runs
+ * the context.
+ *
+ * @param driver For logging and pool limits
+ * @param ctx Shared client context in which sessions are created
+ */
+extern void client_pool_init(coap_driver *driver, coap_context_t *ctx);
+
+/**
+ * Finds the pooled session for an end device, creating it if not present or
+ * if the existing session has failed. Evicts the least recently used idle
+ * session if the pool is full; if every session is in use, the connection is
+ * deferred. Each acquire must be paired with a release.
+ *
+ * A failed session is reconnected only after a backoff, which grows with
+ * consecutive failures, and a DTLS session only while fewer than the maximum
+ * handshakes are in progress. So after a network outage, devices are not all
+ * reconnected at once.
+ *
+ * @param params End device to connect to
+ * @return entry for the session, or NULL on failure to connect, or if the
+ *         connection is deferred
+ */
+extern pool_entry *client_pool_acquire(const end_dev_params *params);
+
+/**
+ * Returns a session to the pool after use.
+ *
+ * @param entry Entry from client_pool_acquire()
+ * @param failed true if the request failed with a transport error; the
+ *               session then is discarded and recreated on next acquire
+ */
+extern void client_pool_release(pool_entry *entry, bool failed);
+
+/** Closes sessions unused for longer than the idle timeout. */
+extern void client_pool_evict_idle(void);
+
+/**
+ * Copies the session counts. They are updated by the pool thread, so may be
+ * slightly stale when read from another thread.
+ */
+extern void client_pool_stats(pool_stats *stats);
+
+/** Releases all pooled sessions. */
+extern void client_pool_free(void);
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,168 @@
+/* Per-device PSK identities for the DTLS server
+ *
+ * Copyright (c) 2026
+ * Contributors to the EdgeX Foundry
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "coap-psk.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "coap-util.h"
+
+#define PSK_MIN_SLOTS 16
+
+typedef struct {
+  const char *identity;  /**< in table names; NULL if slot empty */
+  uint32_t hash;
+  uint16_t identity_len;
+  uint8_t key_len;
+  uint8_t key[PSK_KEY_MAXLEN];
+} psk_entry;
+
+/*
+ * Open addressed table, at most half full. Built whole and then swapped in,
+ * so it is never modified while in use.
+ */
+typedef struct {
+  psk_entry *slots;
+  uint32_t mask;
+  char *names;           /**< storage for all identities */
+} psk_table;
+
+static struct {
+  pthread_rwlock_t lock;
+  psk_table *table;
+} store = {PTHREAD_RWLOCK_INITIALIZER, NULL};
+
+static void table_free(psk_table *table) {
+  if (table) {
+    free(table->slots);
+    free(table->names);
+    free(table);
+  }
+}
+
+/* Decodes a base64 key into the entry */
+static bool decode_key(const char *text, psk_entry *entry) {
+  iot_data_t *array = iot_data_alloc_array_from_base64(text);
+  if (array == NULL) {
+    return false;
+  }
+  uint32_t len = iot_data_array_length(array);
+  bool valid = len > 0 && len <= PSK_KEY_MAXLEN;
+  if (valid) {
+    iot_data_array_iter_t iter;
+    iot_data_array_iter(array, &iter);
+    for (uint32_t i = 0; iot_data_array_iter_next(&iter); i++) {
+      entry->key[i] = *(const uint8_t *)iot_data_array_iter_value(&iter);
+    }
+    entry->key_len = (uint8_t)len;
+  }
+  iot_data_free(array);
+  return valid;
+}
+
+static void insert(psk_table *table, const psk_entry *entry) {
+  uint32_t slot = entry->hash & table->mask;
+  while (table->slots[slot].identity) {
+    slot = (slot + 1) & table->mask;
+  }
+  table->slots[slot] = *entry;
+}
+
+uint32_t psk_store_load(coap_driver *driver) {
+  iot_data_t *secrets =
+      devsdk_get_secrets(driver->service, PSK_IDENTITIES_SECRET);
+  uint32_t size = secrets ? iot_data_map_size(secrets) : 0;
+  uint32_t count = 0;
+
+  uint32_t nslots = PSK_MIN_SLOTS;
+  while (nslots < size * 2) {
+    nslots <<= 1;
+  }
+  size_t names_len = 0;
+  iot_data_map_iter_t iter;
+  if (secrets) {
+    iot_data_map_iter(secrets, &iter);
+    while (iot_data_map_iter_next(&iter)) {
+      names_len += strlen(iot_data_map_iter_string_key(&iter)) + 1;
+    }
+  }
+
+  psk_table *table = calloc(1, sizeof(*table));
+  table->slots = calloc(nslots, sizeof(psk_entry));
+  table->mask = nslots - 1;
+  table->names = malloc(names_len ? names_len : 1);
+
+  char *name = table->names;
+  if (secrets) {
+    iot_data_map_iter(secrets, &iter);
+    while (iot_data_map_iter_next(&iter)) {
+      const char *identity = iot_data_map_iter_string_key(&iter);
+      const char *text = iot_data_map_iter_string_value(&iter);
+      size_t len = strlen(identity);
+      psk_entry entry = {0};
+      if (len == 0 || len > PSK_IDENTITY_MAXLEN || text == NULL ||
+          !decode_key(text, &entry)) {
+        iot_log_warn(driver->lc, "invalid PSK for identity %s", identity);
+        continue;
+      }
+      memcpy(name, identity, len + 1);
+      entry.identity = name;
+      entry.identity_len = (uint16_t)len;
+      entry.hash = fnv1a(FNV1A_INIT, identity, len);
+      insert(table, &entry);
+      name += len + 1;
+      count++;
+    }
+    iot_data_free(secrets);
+  }
+
+  pthread_rwlock_wrlock(&store.lock);
+  psk_table *old = store.table;
+  store.table = table;
+  pthread_rwlock_unlock(&store.lock);
+  table_free(old);
+
+  iot_log_info(driver->lc, "loaded %u PSK identities", count);
+  return count;
+}
+
+size_t psk_store_lookup(const uint8_t *identity, size_t identity_len,
+                        uint8_t *key, size_t max_len) {
+  uint32_t hash = fnv1a(FNV1A_INIT, identity, identity_len);
+  size_t key_len = 0;
+
+  pthread_rwlock_rdlock(&store.lock);
+  psk_table *table = store.table;
+  if (table) {
+    uint32_t slot = hash & table->mask;
+    for (; table->slots[slot].identity; slot = (slot + 1) & table->mask) {
+      const psk_entry *entry = &table->slots[slot];
+      if (entry->hash == hash && entry->identity_len == identity_len &&
+          !memcmp(entry->identity, identity, identity_len)) {
+        if (entry->key_len <= max_len) {
+          memcpy(key, entry->key, entry->key_len);
+          key_len = entry->key_len;
+        }
+        break;
+      }
+    }
+  }
+  pthread_rwlock_unlock(&store.lock);
+  return key_len;
+}
+
+void psk_store_free(void) {
+  pthread_rwlock_wrlock(&store.lock);
+  psk_table *table = store.table;
+  store.table = NULL;
+  pthread_rwlock_unlock(&store.lock);
+  table_free(table);
+}
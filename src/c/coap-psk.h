@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2026
+ * Contributors to the EdgeX Foundry
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef _COAP_PSK_H_
+#define _COAP_PSK_H_ 1
+
+/**
+ * @file
+ * @brief Defines the store of per-device PSK identities for the DTLS server.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "device-coap.h"
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Secret holding per-device keys, keyed by PSK identity */
+#define PSK_IDENTITIES_SECRET "pskidentities"
+/** Maximum length of a key, as for the PskKey secret */
+#define PSK_KEY_MAXLEN 16
+/** Maximum length of a PSK identity */
+#define PSK_IDENTITY_MAXLEN 128
+
+/**
+ * Loads per-device keys from the secret store, replacing those loaded
+ * before. Lookups in progress are not disturbed, so the keys may be reloaded
+ * while the server runs. Each secret value is a base64 encoded key; invalid
+ * entries are logged and skipped.
+ *
+ * @param driver For logging and SDK service
+ * @return number of identities loaded
+ */
+extern uint32_t psk_store_load(coap_driver *driver);
+
+/**
+ * Finds the key for a PSK identity. Safe to call from any thread.
+ *
+ * @param identity Identity from the DTLS handshake, need not be
+ *                 null-terminated
+ * @param identity_len Length of identity
+ * @param key Buffer for key
+ * @param max_len Size of buffer
+ * @return length of key; 0 if identity not found, or key does not fit
+ */
+extern size_t psk_store_lookup(const uint8_t *identity, size_t identity_len,
+                               uint8_t *key, size_t max_len);
+
+/** Frees the loaded keys. */
+extern void psk_store_free(void);
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,478 @@
+/* Publisher pool for readings received by the CoAP server
+ *
+ * Copyright (c) 2026
+ * Contributors to the EdgeX Foundry
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "coap-publish.h"
+
+#include <pthread.h>
+#include <errno.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "coap-cache.h"
+#include "coap-metrics.h"
+#include "coap-util.h"
+
+#define COALESCE_BUCKETS 256
+
+/* A reading, or a pack of readings, waiting for publication */
+typedef struct {
+  reading_item single;
+  reading_item *pack;    /**< if not NULL, readings to post together */
+  uint32_t pack_len;
+} publish_item;
+
+/*
+ * Cell of the bounded multi-producer/multi-consumer queue. The sequence
+ * number tells producers and consumers whether the cell is free for the
+ * current lap of the ring (after D. Vyukov's bounded MPMC queue).
+ */
+typedef struct {
+  size_t sequence;
+  publish_item item;
+} queue_cell;
+
+/*
+ * Readings from one device waiting to be posted together. Buffers are also
+ * kept in a FIFO list; all share the same window, so the FIFO is in deadline
+ * order.
+ */
+typedef struct coalesce_buf {
+  device_info *device;
+  uint64_t deadline;           /**< monotonic msecs to flush by */
+  uint32_t count;
+  reading_item *items;
+  struct coalesce_buf *hnext;  /**< next in hash bucket */
+  struct coalesce_buf *prev;   /**< FIFO links */
+  struct coalesce_buf *next;
+} coalesce_buf;
+
+static struct {
+  pthread_mutex_t mutex;
+  coalesce_buf *buckets[COALESCE_BUCKETS];
+  coalesce_buf *head;
+  coalesce_buf *tail;
+  uint32_t window;             /**< msecs; 0 if not coalescing */
+  uint32_t max_readings;
+} coalescer;
+
+static struct {
+  coap_driver *driver;
+  queue_cell *cells;
+  size_t mask;
+  /* producer and consumer positions on separate cache lines */
+  size_t enqueue_pos __attribute__((aligned(64)));
+  size_t dequeue_pos __attribute__((aligned(64)));
+  sem_t items;              /**< count of queued items, for blocking */
+  uint32_t nthreads;
+  pthread_t *threads;
+  volatile bool stopping;
+} publisher;
+
+static bool queue_push(const publish_item *item) {
+  size_t pos = __atomic_load_n(&publisher.enqueue_pos, __ATOMIC_RELAXED);
+  queue_cell *cell;
+  while (true) {
+    cell = &publisher.cells[pos & publisher.mask];
+    size_t seq = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+    intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&publisher.enqueue_pos, &pos, pos + 1,
+                                      true, __ATOMIC_RELAXED,
+                                      __ATOMIC_RELAXED)) {
+        break;
+      }
+    } else if (diff < 0) {
+      return false; /* full */
+    } else {
+      pos = __atomic_load_n(&publisher.enqueue_pos, __ATOMIC_RELAXED);
+    }
+  }
+  cell->item = *item;
+  __atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+static bool queue_pop(publish_item *item) {
+  size_t pos = __atomic_load_n(&publisher.dequeue_pos, __ATOMIC_RELAXED);
+  queue_cell *cell;
+  while (true) {
+    cell = &publisher.cells[pos & publisher.mask];
+    size_t seq = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+    intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&publisher.dequeue_pos, &pos, pos + 1,
+                                      true, __ATOMIC_RELAXED,
+                                      __ATOMIC_RELAXED)) {
+        break;
+      }
+    } else if (diff < 0) {
+      return false; /* empty */
+    } else {
+      pos = __atomic_load_n(&publisher.dequeue_pos, __ATOMIC_RELAXED);
+    }
+  }
+  *item = cell->item;
+  __atomic_store_n(&cell->sequence, pos + publisher.mask + 1,
+                   __ATOMIC_RELEASE);
+  return true;
+}
+
+/* Generates and posts an event with the reading, and frees it */
+static void post_reading(reading_item *reading) {
+  devsdk_commandresult results[1];
+  results[0].origin = reading->origin;
+  results[0].value = reading->value;
+
+  devsdk_post_readings(publisher.driver->service, reading->desc->device_name,
+                       reading->desc->resource_name, results, NULL);
+  metric_add(METRIC_READINGS_POSTED, 1);
+  cache_update(reading->desc, reading->value);
+  iot_data_free(reading->value);
+  index_release(reading->desc);
+}
+
+/*
+ * Posts readings from one device, and frees them. Where the device profile
+ * has a command covering several of the resources, those readings are posted
+ * as a single event for the command; the rest are posted individually.
+ */
+static void post_group(reading_item *readings, uint32_t count) {
+  device_info *device = readings[0].desc->device;
+  bool used[count];
+  memset(used, 0, sizeof(used));
+
+  for (uint32_t c = 0; c < device->ncommands; c++) {
+    command_info *cmd = &device->commands[c];
+    if (cmd->nresources < 2 || cmd->nresources > count) {
+      continue;
+    }
+    uint32_t found[cmd->nresources];
+    bool complete = true;
+    while (complete) {
+      for (uint32_t r = 0; r < cmd->nresources && complete; r++) {
+        complete = false;
+        for (uint32_t i = 0; i < count; i++) {
+          if (!used[i] &&
+              !strcmp(readings[i].desc->resource_name, cmd->resources[r])) {
+            found[r] = i;
+            used[i] = true;
+            complete = true;
+            break;
+          }
+        }
+        if (!complete) {
+          /* return any readings claimed for this command */
+          for (uint32_t k = 0; k < r; k++) {
+            used[found[k]] = false;
+          }
+        }
+      }
+      if (!complete) {
+        break;
+      }
+      devsdk_commandresult results[cmd->nresources];
+      for (uint32_t r = 0; r < cmd->nresources; r++) {
+        results[r].origin = readings[found[r]].origin;
+        results[r].value = readings[found[r]].value;
+      }
+      devsdk_post_readings(publisher.driver->service, device->name, cmd->name,
+                           results, NULL);
+      metric_add(METRIC_READINGS_POSTED, cmd->nresources);
+      for (uint32_t r = 0; r < cmd->nresources; r++) {
+        cache_update(readings[found[r]].desc, readings[found[r]].value);
+        iot_data_free(readings[found[r]].value);
+        index_release(readings[found[r]].desc);
+      }
+    }
+  }
+
+  for (uint32_t i = 0; i < count; i++) {
+    if (!used[i]) {
+      post_reading(&readings[i]);
+    }
+  }
+}
+
+/* Posts a queued item and frees it */
+static void post_item(publish_item *item) {
+  if (item->pack) {
+    post_group(item->pack, item->pack_len);
+    free(item->pack);
+  } else {
+    post_reading(&item->single);
+  }
+}
+
+static uint32_t device_slot(const device_info *device) {
+  return ((uintptr_t)device >> 4) & (COALESCE_BUCKETS - 1);
+}
+
+/* Unlinks buffer from hash and FIFO; caller must hold the mutex */
+static void coalesce_unlink(coalesce_buf *buf) {
+  coalesce_buf **link = &coalescer.buckets[device_slot(buf->device)];
+  while (*link != buf) {
+    link = &(*link)->hnext;
+  }
+  *link = buf->hnext;
+
+  if (buf->prev) {
+    buf->prev->next = buf->next;
+  } else {
+    coalescer.head = buf->next;
+  }
+  if (buf->next) {
+    buf->next->prev = buf->prev;
+  } else {
+    coalescer.tail = buf->prev;
+  }
+}
+
+/*
+ * Adds item to the buffer for its device. Returns the buffer, unlinked, if it
+ * now is full and must be flushed; otherwise NULL.
+ */
+static coalesce_buf *coalesce_add(reading_item *reading) {
+  device_info *device = reading->desc->device;
+  coalesce_buf *full = NULL;
+
+  pthread_mutex_lock(&coalescer.mutex);
+  coalesce_buf *buf = coalescer.buckets[device_slot(device)];
+  while (buf && buf->device != device) {
+    buf = buf->hnext;
+  }
+  if (buf == NULL) {
+    buf = calloc(1, sizeof(*buf));
+    buf->items = calloc(coalescer.max_readings, sizeof(reading_item));
+    buf->device = device;
+    buf->deadline = monotonic_msecs() + coalescer.window;
+    buf->hnext = coalescer.buckets[device_slot(device)];
+    coalescer.buckets[device_slot(device)] = buf;
+    buf->prev = coalescer.tail;
+    if (coalescer.tail) {
+      coalescer.tail->next = buf;
+    } else {
+      coalescer.head = buf;
+    }
+    coalescer.tail = buf;
+  }
+  buf->items[buf->count++] = *reading;
+  if (buf->count == coalescer.max_readings) {
+    coalesce_unlink(buf);
+    full = buf;
+  }
+  pthread_mutex_unlock(&coalescer.mutex);
+  return full;
+}
+
+/*
+ * Returns, unlinked, the oldest buffer if due by now, or NULL. Sets
+ * *next_due to the deadline of the oldest buffer left, or 0 if none.
+ */
+static coalesce_buf *coalesce_take_due(uint64_t now, uint64_t *next_due) {
+  coalesce_buf *due = NULL;
+
+  pthread_mutex_lock(&coalescer.mutex);
+  if (coalescer.head && coalescer.head->deadline <= now) {
+    due = coalescer.head;
+    coalesce_unlink(due);
+  }
+  *next_due = coalescer.head ? coalescer.head->deadline : 0;
+  pthread_mutex_unlock(&coalescer.mutex);
+  return due;
+}
+
+/* Posts the readings in a buffer and frees it */
+static void coalesce_flush(coalesce_buf *buf) {
+  post_group(buf->items, buf->count);
+  free(buf->items);
+  free(buf);
+}
+
+/*
+ * Waits for a queued item, or until the oldest coalescing buffer is due.
+ * Returns false on timeout.
+ */
+static bool wait_item(uint64_t next_due) {
+  if (coalescer.window == 0) {
+    sem_wait(&publisher.items);
+    return true;
+  }
+  uint64_t now = monotonic_msecs();
+  uint64_t wait = next_due ? (next_due > now ? next_due - now : 0)
+                           : coalescer.window;
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  ts.tv_sec += wait / 1000;
+  ts.tv_nsec += (wait % 1000) * 1000000;
+  if (ts.tv_nsec >= 1000000000) {
+    ts.tv_sec++;
+    ts.tv_nsec -= 1000000000;
+  }
+  while (sem_timedwait(&publisher.items, &ts) == -1) {
+    if (errno != EINTR) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void *publisher_thread(void *arg) {
+  (void)arg;
+  publish_item item;
+  uint64_t next_due = 0;
+  while (true) {
+    if (wait_item(next_due)) {
+      /* a counted item may sit behind one another producer is still writing */
+      while (!queue_pop(&item)) {
+        if (publisher.stopping) {
+          return NULL;
+        }
+        sched_yield();
+      }
+      if (coalescer.window == 0 || item.pack) {
+        post_item(&item);
+      } else {
+        coalesce_buf *full = coalesce_add(&item.single);
+        if (full) {
+          coalesce_flush(full);
+        }
+      }
+    }
+    coalesce_buf *due;
+    while ((due = coalesce_take_due(monotonic_msecs(), &next_due))) {
+      coalesce_flush(due);
+    }
+  }
+  return NULL;
+}
+
+bool publish_start(coap_driver *driver) {
+  publisher.driver = driver;
+  publisher.nthreads = driver->publish_threads;
+  if (driver->string_refs && publisher.nthreads) {
+    iot_log_warn(driver->lc, "String payloads are copied, as readings are "
+                 "published on publisher threads");
+  }
+  if (publisher.nthreads == 0) {
+    iot_log_info(driver->lc, "Publishing readings on server thread");
+    return true;
+  }
+
+  /* ring size must be a power of two */
+  size_t size = 2;
+  while (size < driver->publish_queue_size) {
+    size <<= 1;
+  }
+  publisher.cells = calloc(size, sizeof(queue_cell));
+  publisher.mask = size - 1;
+  for (size_t i = 0; i < size; i++) {
+    publisher.cells[i].sequence = i;
+  }
+  publisher.enqueue_pos = publisher.dequeue_pos = 0;
+  sem_init(&publisher.items, 0, 0);
+  publisher.stopping = false;
+
+  pthread_mutex_init(&coalescer.mutex, NULL);
+  coalescer.max_readings = driver->coalesce_max_readings;
+  coalescer.window = coalescer.max_readings > 1 ? driver->coalesce_window : 0;
+  if (coalescer.window) {
+    iot_log_info(driver->lc, "Coalescing up to %u readings per device in %u ms",
+                 coalescer.max_readings, coalescer.window);
+  }
+
+  publisher.threads = calloc(publisher.nthreads, sizeof(pthread_t));
+  for (uint32_t i = 0; i < publisher.nthreads; i++) {
+    if (pthread_create(&publisher.threads[i], NULL, publisher_thread, NULL)) {
+      iot_log_error(driver->lc, "cannot start publisher thread");
+      publisher.nthreads = i;
+      publish_stop();
+      return false;
+    }
+  }
+  iot_log_info(driver->lc, "Started %u publisher threads, queue size %zu",
+               publisher.nthreads, size);
+  return true;
+}
+
+/* Queues or posts an item; false if the queue is full */
+static bool push_item(publish_item *item) {
+  if (publisher.nthreads == 0) {
+    post_item(item);
+    return true;
+  }
+  if (!queue_push(item)) {
+    return false;
+  }
+  sem_post(&publisher.items);
+  return true;
+}
+
+bool publish_reading(resource_desc *desc, iot_data_t *value) {
+  publish_item item = {0};
+  item.single.desc = index_ref(desc);
+  item.single.value = value;
+  /* stamped on receipt, as coalescing and the queue delay posting */
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  item.single.origin = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+  if (!push_item(&item)) {
+    index_release(desc);
+    return false;
+  }
+  return true;
+}
+
+bool publish_pack(reading_item *readings, uint32_t count) {
+  publish_item item = {0};
+  item.pack = readings;
+  item.pack_len = count;
+  return push_item(&item);
+}
+
+size_t publish_queue_depth(void) {
+  size_t dequeued = __atomic_load_n(&publisher.dequeue_pos, __ATOMIC_RELAXED);
+  size_t enqueued = __atomic_load_n(&publisher.enqueue_pos, __ATOMIC_RELAXED);
+  /* positions are read separately, so may briefly be out of order */
+  return enqueued > dequeued ? enqueued - dequeued : 0;
+}
+
+bool publish_is_inline(void) {
+  return publisher.nthreads == 0;
+}
+
+void publish_stop(void) {
+  if (publisher.threads == NULL) {
+    return;
+  }
+  /* wake each thread once more; they exit when the queue is drained */
+  publisher.stopping = true;
+  for (uint32_t i = 0; i < publisher.nthreads; i++) {
+    sem_post(&publisher.items);
+  }
+  for (uint32_t i = 0; i < publisher.nthreads; i++) {
+    pthread_join(publisher.threads[i], NULL);
+  }
+  publish_item item;
+  while (queue_pop(&item)) {
+    post_item(&item);
+  }
+  uint64_t next_due;
+  coalesce_buf *due;
+  while ((due = coalesce_take_due(UINT64_MAX, &next_due))) {
+    coalesce_flush(due);
+  }
+  pthread_mutex_destroy(&coalescer.mutex);
+  free(publisher.threads);
+  publisher.threads = NULL;
+  free(publisher.cells);
+  publisher.cells = NULL;
+  sem_destroy(&publisher.items);
+}
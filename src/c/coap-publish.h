@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2026
+ * Contributors to the EdgeX Foundry
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef _COAP_PUBLISH_H_
+#define _COAP_PUBLISH_H_ 1
+
+/**
+ * @file
+ * @brief Defines the publisher pool that posts readings received by the CoAP
+ * server into EdgeX.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "coap-index.h"
+#include "device-coap.h"
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Default number of publisher threads; 0 publishes on the server thread */
+#define PUBLISH_DEFAULT_THREADS 2
+/** Default capacity of the queue to the publisher threads */
+#define PUBLISH_DEFAULT_QUEUE_SIZE 1024
+/** Default Max-Age seconds sent with 5.03 when the queue is full */
+#define PUBLISH_DEFAULT_BUSY_MAX_AGE 5
+
+/** Default msecs to coalesce readings per device; 0 disables coalescing */
+#define PUBLISH_DEFAULT_COALESCE_WINDOW 0
+/** Default maximum number of readings coalesced per device */
+#define PUBLISH_DEFAULT_COALESCE_MAX 16
+
+/** A reading for publication */
+typedef struct {
+  resource_desc *desc;   /**< referenced */
+  iot_data_t *value;
+  uint64_t origin;       /**< nsecs since epoch; 0 for time of posting */
+} reading_item;
+
+/**
+ * Starts the publisher threads, sized from the driver configuration.
+ *
+ * @param driver For logging, SDK service and publisher limits
+ * @return true on success
+ */
+extern bool publish_start(coap_driver *driver);
+
+/**
+ * Queues a reading for publication, stamped with the time now. Takes
+ * ownership of value on success. Publishes inline if configured without
+ * publisher threads.
+ *
+ * @param desc Resource the reading is for; referenced while queued
+ * @param value Reading value
+ * @return true if queued; false if the queue is full
+ */
+extern bool publish_reading(resource_desc *desc, iot_data_t *value);
+
+/**
+ * Queues readings from one device for publication together. Readings that
+ * complete a device command are posted as one event. Takes ownership of the
+ * readings array, and of each reading's descriptor reference and value, on
+ * success.
+ *
+ * @param readings Allocated array of readings, all for the same device
+ * @param count Number of readings
+ * @return true if queued; false if the queue is full
+ */
+extern bool publish_pack(reading_item *readings, uint32_t count);
+
+/**
+ * Returns true if readings are published before publish_reading() returns,
+ * so a value may reference memory that is valid only until then.
+ */
+extern bool publish_is_inline(void);
+
+/**
+ * Returns the number of items queued for the publisher threads. Safe to call
+ * from any thread; the result may be out of date by the time it is used.
+ */
+extern size_t publish_queue_depth(void);
+
+/** Stops the publisher threads after publishing any queued readings. */
+extern void publish_stop(void);
+#ifdef __cplusplus
+}
+#endif
+#endif
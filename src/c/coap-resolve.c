@@ -0,0 +1,271 @@
+/* Cache of resolved end device addresses
+ *
+ * Copyright (c) 2026
+ * Contributors to the EdgeX Foundry
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "coap-resolve.h"
+
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "coap-util.h"
+
+#define RESOLVE_BUCKETS 256
+#define RESOLVE_HOST_MAXLEN 256
+/* entries unused for this many TTLs are dropped */
+#define RESOLVE_UNUSED_TTLS 4
+
+typedef struct resolve_entry {
+  char host[RESOLVE_HOST_MAXLEN];
+  uint32_t hash;
+  coap_address_t addr;
+  bool valid;           /**< addr has been resolved */
+  bool queued;          /**< queued for, or being resolved by, the resolver */
+  uint64_t expires;     /**< msecs when addr is due for refresh */
+  uint64_t last_used;   /**< msecs when addr was last looked up */
+  struct resolve_entry *next;
+  struct resolve_entry *next_queued;
+} resolve_entry;
+
+static struct {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  resolve_entry *buckets[RESOLVE_BUCKETS];
+  resolve_entry *queue;
+  resolve_entry **queue_tail;
+  uint64_t ttl_msecs;
+  bool running;
+  pthread_t thread;
+  coap_driver *driver;
+} cache = {.mutex = PTHREAD_MUTEX_INITIALIZER,
+           .cond = PTHREAD_COND_INITIALIZER,
+           .queue_tail = &cache.queue,
+           .ttl_msecs = RESOLVE_DEFAULT_TTL_SECS * 1000};
+
+/* IP address literals need no resolver, so are not cached */
+static bool parse_literal(const char *host, coap_address_t *addr) {
+  memset(addr, 0, sizeof(*addr));
+  if (inet_pton(AF_INET, host, &addr->addr.sin.sin_addr) == 1) {
+    addr->addr.sin.sin_family = AF_INET;
+    addr->size = sizeof(addr->addr.sin);
+    return true;
+  }
+  if (inet_pton(AF_INET6, host, &addr->addr.sin6.sin6_addr) == 1) {
+    addr->addr.sin6.sin6_family = AF_INET6;
+    addr->size = sizeof(addr->addr.sin6);
+    return true;
+  }
+  return false;
+}
+
+/* Finds the entry for host, creating it if create; call with mutex held */
+static resolve_entry *find_entry(const char *host, bool create) {
+  uint32_t hash = fnv1a(FNV1A_INIT, host, strlen(host));
+  resolve_entry **bucket = &cache.buckets[hash % RESOLVE_BUCKETS];
+  for (resolve_entry *entry = *bucket; entry; entry = entry->next) {
+    if (entry->hash == hash && !strcmp(entry->host, host)) {
+      return entry;
+    }
+  }
+  if (!create || strlen(host) >= RESOLVE_HOST_MAXLEN) {
+    return NULL;
+  }
+  resolve_entry *entry = calloc(1, sizeof(*entry));
+  strcpy(entry->host, host);
+  entry->hash = hash;
+  entry->next = *bucket;
+  *bucket = entry;
+  return entry;
+}
+
+/* Queues entry for the resolver; call with mutex held */
+static void enqueue(resolve_entry *entry) {
+  entry->queued = true;
+  entry->next_queued = NULL;
+  *cache.queue_tail = entry;
+  cache.queue_tail = &entry->next_queued;
+  pthread_cond_signal(&cache.cond);
+}
+
+/*
+ * Records the result of resolving entry; addr is NULL if it failed, when any
+ * previous address is kept until a retry succeeds. Call with mutex held.
+ */
+static void entry_update(resolve_entry *entry, const coap_address_t *addr,
+                         uint64_t now) {
+  if (addr == NULL) {
+    if (cache.driver) {
+      iot_log_warn(cache.driver->lc, "COAP:failed to resolve %s%s",
+                   entry->host, entry->valid ? "; using last address" : "");
+    }
+    entry->expires = now + RESOLVE_RETRY_SECS * 1000;
+    return;
+  }
+  if (entry->valid && memcmp(&entry->addr, addr, sizeof(*addr)) &&
+      cache.driver) {
+    iot_log_info(cache.driver->lc, "COAP:address of %s changed", entry->host);
+  }
+  entry->addr = *addr;
+  entry->valid = true;
+  entry->expires = now + cache.ttl_msecs;
+}
+
+/*
+ * Queues expired entries in recent use for refresh, and drops those long
+ * unused. Call with mutex held.
+ */
+static void scan_entries(uint64_t now) {
+  for (uint32_t i = 0; i < RESOLVE_BUCKETS; i++) {
+    resolve_entry **link = &cache.buckets[i];
+    while (*link) {
+      resolve_entry *entry = *link;
+      if (!entry->queued &&
+          now - entry->last_used > cache.ttl_msecs * RESOLVE_UNUSED_TTLS) {
+        *link = entry->next;
+        free(entry);
+        continue;
+      }
+      if (!entry->queued && now >= entry->expires &&
+          now - entry->last_used < cache.ttl_msecs) {
+        enqueue(entry);
+      }
+      link = &entry->next;
+    }
+  }
+}
+
+static void *resolver_thread(void *arg) {
+  (void)arg;
+  uint64_t last_scan = monotonic_msecs();
+
+  pthread_mutex_lock(&cache.mutex);
+  while (cache.running) {
+    uint64_t now = monotonic_msecs();
+    if (now - last_scan >= RESOLVE_RETRY_SECS * 1000) {
+      last_scan = now;
+      scan_entries(now);
+    }
+    resolve_entry *entry = cache.queue;
+    if (entry == NULL) {
+      struct timespec ts;
+      clock_gettime(CLOCK_REALTIME, &ts);
+      ts.tv_sec += RESOLVE_RETRY_SECS;
+      pthread_cond_timedwait(&cache.cond, &cache.mutex, &ts);
+      continue;
+    }
+    cache.queue = entry->next_queued;
+    if (cache.queue == NULL) {
+      cache.queue_tail = &cache.queue;
+    }
+
+    /* a queued entry is not dropped, so remains valid while unlocked */
+    char host[RESOLVE_HOST_MAXLEN];
+    strcpy(host, entry->host);
+    pthread_mutex_unlock(&cache.mutex);
+    coap_address_t addr;
+    bool resolved = resolve_address(host, NULL, &addr) > 0;
+    pthread_mutex_lock(&cache.mutex);
+
+    entry_update(entry, resolved ? &addr : NULL, monotonic_msecs());
+    entry->queued = false;
+  }
+  pthread_mutex_unlock(&cache.mutex);
+  return NULL;
+}
+
+bool resolve_start(coap_driver *driver) {
+  pthread_mutex_lock(&cache.mutex);
+  cache.driver = driver;
+  cache.ttl_msecs = (uint64_t)driver->resolve_ttl_secs * 1000;
+  cache.running = true;
+  pthread_mutex_unlock(&cache.mutex);
+
+  if (pthread_create(&cache.thread, NULL, resolver_thread, NULL)) {
+    iot_log_error(driver->lc, "COAP:cannot start address resolver");
+    cache.running = false;
+    return false;
+  }
+  return true;
+}
+
+void resolve_stop(void) {
+  pthread_mutex_lock(&cache.mutex);
+  bool running = cache.running;
+  cache.running = false;
+  pthread_cond_signal(&cache.cond);
+  pthread_mutex_unlock(&cache.mutex);
+  if (running) {
+    pthread_join(cache.thread, NULL);
+  }
+
+  for (uint32_t i = 0; i < RESOLVE_BUCKETS; i++) {
+    while (cache.buckets[i]) {
+      resolve_entry *entry = cache.buckets[i];
+      cache.buckets[i] = entry->next;
+      free(entry);
+    }
+  }
+  cache.queue = NULL;
+  cache.queue_tail = &cache.queue;
+}
+
+bool resolve_host(const char *host, coap_address_t *addr) {
+  if (parse_literal(host, addr)) {
+    return true;
+  }
+  uint64_t now = monotonic_msecs();
+  pthread_mutex_lock(&cache.mutex);
+  resolve_entry *entry = find_entry(host, false);
+  if (entry && entry->valid && now < entry->expires) {
+    entry->last_used = now;
+    *addr = entry->addr;
+    pthread_mutex_unlock(&cache.mutex);
+    return true;
+  }
+  pthread_mutex_unlock(&cache.mutex);
+
+  coap_address_t resolved;
+  bool found = resolve_address(host, NULL, &resolved) > 0;
+
+  pthread_mutex_lock(&cache.mutex);
+  now = monotonic_msecs();
+  entry = find_entry(host, true);
+  if (entry) {
+    entry_update(entry, found ? &resolved : NULL, now);
+    entry->last_used = now;
+    found = entry->valid;
+    *addr = entry->addr;
+  } else if (found) {
+    *addr = resolved;
+  }
+  pthread_mutex_unlock(&cache.mutex);
+  return found;
+}
+
+bool resolve_cached(const char *host, coap_address_t *addr) {
+  if (parse_literal(host, addr)) {
+    return true;
+  }
+  uint64_t now = monotonic_msecs();
+  bool found = false;
+  pthread_mutex_lock(&cache.mutex);
+  resolve_entry *entry = find_entry(host, true);
+  if (entry) {
+    entry->last_used = now;
+    if (!entry->queued && now >= entry->expires) {
+      enqueue(entry);
+    }
+    if (entry->valid) {
+      *addr = entry->addr;
+      found = true;
+    }
+  }
+  pthread_mutex_unlock(&cache.mutex);
+  return found;
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2026
+ * Contributors to the EdgeX Foundry
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef _COAP_RESOLVE_H_
+#define _COAP_RESOLVE_H_ 1
+
+/**
+ * @file
+ * @brief Defines the cache of resolved end device addresses.
+ */
+
+#include <coap2/coap.h>
+#include <stdbool.h>
+
+#include "device-coap.h"
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Default secs a resolved address is used before it is refreshed */
+#define RESOLVE_DEFAULT_TTL_SECS 300
+/** Secs before retrying a host that failed to resolve */
+#define RESOLVE_RETRY_SECS 10
+
+/**
+ * Starts the background resolver, which refreshes cached addresses as they
+ * expire.
+ *
+ * @param driver For logging and address TTL
+ * @return true if started
+ */
+extern bool resolve_start(coap_driver *driver);
+
+/** Stops the background resolver and empties the cache. */
+extern void resolve_stop(void);
+
+/**
+ * Resolves a host, blocking if it is not cached. Use where blocking is
+ * acceptable, like when a device is added. Safe to call from any thread,
+ * including before the resolver is started.
+ *
+ * @param host Host name or IP address literal
+ * @param addr Set to the address, with port 0
+ * @return true if resolved
+ */
+extern bool resolve_host(const char *host, coap_address_t *addr);
+
+/**
+ * Finds the cached address of a host without blocking. If the address has
+ * expired it is still returned, and the host is queued for the background
+ * resolver to refresh; if not cached, the host is queued to be resolved.
+ *
+ * @param host Host name or IP address literal
+ * @param addr Set to the address, with port 0
+ * @return true if an address was found
+ */
+extern bool resolve_cached(const char *host, coap_address_t *addr);
+#ifdef __cplusplus
+}
+#endif
+#endif
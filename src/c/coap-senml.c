@@ -0,0 +1,297 @@
+/* SenML (RFC 8428) packs of device readings
+ *
+ * Copyright (c) 2026
+ * Contributors to the EdgeX Foundry
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "coap-senml.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "coap-cbor.h"
+#include "coap-util.h"
+
+/* Times below 2**28 are relative to now (RFC 8428, sec 4.5.3) */
+#define SENML_RELATIVE_TIME_LIMIT 268435456.0
+#define SENML_NAME_MAXLEN 255
+
+/* CBOR labels for the fields read (RFC 8428, sec 6) */
+static const struct {
+  int64_t label;
+  const char *name;
+} senml_labels[] = {{-2, "bn"}, {-3, "bt"}, {0, "n"}, {2, "v"},
+                    {3, "vs"},  {4, "vb"},  {6, "t"}};
+
+/* Reads a JSON number, which may have been parsed as any numeric type */
+static bool json_number(const iot_data_t *data, double *out) {
+  if (data == NULL) {
+    return false;
+  }
+  switch (iot_data_type(data)) {
+    case IOT_DATA_INT8:
+      *out = iot_data_i8(data);
+      return true;
+    case IOT_DATA_UINT8:
+      *out = iot_data_ui8(data);
+      return true;
+    case IOT_DATA_INT16:
+      *out = iot_data_i16(data);
+      return true;
+    case IOT_DATA_UINT16:
+      *out = iot_data_ui16(data);
+      return true;
+    case IOT_DATA_INT32:
+      *out = iot_data_i32(data);
+      return true;
+    case IOT_DATA_UINT32:
+      *out = iot_data_ui32(data);
+      return true;
+    case IOT_DATA_INT64:
+      *out = (double)iot_data_i64(data);
+      return true;
+    case IOT_DATA_UINT64:
+      *out = (double)iot_data_ui64(data);
+      return true;
+    case IOT_DATA_FLOAT32:
+      *out = iot_data_f32(data);
+      return true;
+    case IOT_DATA_FLOAT64:
+      *out = iot_data_f64(data);
+      return true;
+    default:
+      return false;
+  }
+}
+
+/* Reads the record value for the resource type; caller must free result */
+static iot_data_t *record_value(const resource_desc *desc,
+                                const iot_data_t *record) {
+  const iot_data_t *field;
+  scalar_value src;
+  scalar_value v;
+
+  switch (desc->type.type) {
+    case IOT_DATA_STRING:
+      field = iot_data_string_map_get(record, "vs");
+      if (field && iot_data_type(field) == IOT_DATA_STRING) {
+        return iot_data_alloc_string(iot_data_string(field), IOT_DATA_COPY);
+      }
+      return NULL;
+
+    case IOT_DATA_BOOL:
+      field = iot_data_string_map_get(record, "vb");
+      break;
+
+    default:
+      field = iot_data_string_map_get(record, "v");
+      break;
+  }
+  /* numeric fields may have been parsed as any numeric type */
+  if (field && scalar_load(field, &src) &&
+      scalar_convert(iot_data_type(field), &src, desc->type.type, &v)) {
+    return scalar_alloc(desc->type.type, &v);
+  }
+  return NULL;
+}
+
+static double realtime_secs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void senml_free_readings(reading_item *readings, uint32_t count) {
+  for (uint32_t i = 0; i < count; i++) {
+    iot_data_free(readings[i].value);
+    index_release(readings[i].desc);
+  }
+  free(readings);
+}
+
+/*
+ * Decodes a SenML CBOR pack into the form parsed from SenML JSON: a vector of
+ * maps keyed by JSON label. Fields not used here are skipped.
+ */
+static iot_data_t *cbor_pack(const uint8_t *data, size_t len) {
+  cbor_reader reader;
+  uint8_t major;
+  uint64_t arg;
+
+  cbor_reader_init(&reader, data, len);
+  if (!cbor_read_head(&reader, &major, &arg) || major != CBOR_ARRAY ||
+      arg == 0 || arg > SENML_MAX_RECORDS) {
+    return NULL;
+  }
+  uint32_t nrecords = (uint32_t)arg;
+  iot_data_t *pack = iot_data_alloc_vector(nrecords);
+
+  for (uint32_t i = 0; i < nrecords; i++) {
+    if (!cbor_read_head(&reader, &major, &arg) || major != CBOR_MAP ||
+        arg > len) {
+      goto fail;
+    }
+    iot_data_t *record = iot_data_alloc_map(IOT_DATA_STRING);
+    iot_data_vector_add(pack, i, record);
+
+    for (uint64_t npairs = arg; npairs; npairs--) {
+      if (!cbor_read_head(&reader, &major, &arg) ||
+          (major != CBOR_UINT && major != CBOR_NEGINT) || arg > INT64_MAX) {
+        goto fail;
+      }
+      int64_t label = major == CBOR_UINT ? (int64_t)arg : -1 - (int64_t)arg;
+      const char *name = NULL;
+      for (size_t j = 0; j < sizeof(senml_labels) / sizeof(senml_labels[0]);
+           j++) {
+        if (senml_labels[j].label == label) {
+          name = senml_labels[j].name;
+          break;
+        }
+      }
+      if (name == NULL) {
+        if (!cbor_skip(&reader)) {
+          goto fail;
+        }
+        continue;
+      }
+      iot_data_t *value = cbor_read_scalar(&reader);
+      if (value == NULL) {
+        goto fail;
+      }
+      iot_data_string_map_add(record, name, value);
+    }
+  }
+  if (reader.pos == reader.end) {
+    return pack;
+  }
+
+fail:
+  iot_data_free(pack);
+  return NULL;
+}
+
+/* Reads readings from a parsed pack; takes ownership of pack */
+static bool read_pack(const char *device, size_t device_len, iot_data_t *pack,
+                      reading_item **readings_ptr, uint32_t *count_ptr) {
+  coap_driver *sdk_ctx = (coap_driver *)impl;
+  reading_item *readings = NULL;
+  uint32_t count = 0;
+  bool result = false;
+
+  uint32_t nrecords = iot_data_vector_size(pack);
+  if (nrecords == 0 || nrecords > SENML_MAX_RECORDS) {
+    iot_log_info(sdk_ctx->lc, "invalid SenML pack of %u records", nrecords);
+    goto finish;
+  }
+  readings = calloc(nrecords, sizeof(reading_item));
+
+  /* base values apply to the records that follow, until redefined */
+  const char *base_name = "";
+  double base_time = 0;
+  bool has_time = false;
+  double now = realtime_secs();
+
+  for (uint32_t i = 0; i < nrecords; i++) {
+    const iot_data_t *record = iot_data_vector_get(pack, i);
+    if (iot_data_type(record) != IOT_DATA_MAP) {
+      iot_log_info(sdk_ctx->lc, "SenML record %u is not an object", i);
+      goto finish;
+    }
+    const char *text = iot_data_string_map_get_string(record, "bn");
+    if (text) {
+      base_name = text;
+    }
+    if (json_number(iot_data_string_map_get(record, "bt"), &base_time)) {
+      has_time = true;
+    }
+
+    /* resource name is base name + name, less any device name prefix */
+    char name[SENML_NAME_MAXLEN + 1];
+    text = iot_data_string_map_get_string(record, "n");
+    int name_len = snprintf(name, sizeof(name), "%s%s", base_name,
+                            text ? text : "");
+    if (name_len < 0 || name_len > SENML_NAME_MAXLEN) {
+      iot_log_info(sdk_ctx->lc, "SenML record %u name too long", i);
+      goto finish;
+    }
+    const char *res_name = name;
+    if ((size_t)name_len > device_len && name[device_len] == '/' &&
+        !memcmp(name, device, device_len)) {
+      res_name += device_len + 1;
+      name_len -= device_len + 1;
+    }
+
+    reading_item *reading = &readings[count];
+    reading->desc = index_lookup(device, device_len, res_name, name_len);
+    if (reading->desc == NULL) {
+      iot_log_info(sdk_ctx->lc, "SenML resource not found: %.*s/%s",
+                   (int)device_len, device, res_name);
+      goto finish;
+    }
+    reading->value = record_value(reading->desc, record);
+    count++;
+    if (reading->value == NULL) {
+      iot_log_info(sdk_ctx->lc, "SenML value invalid for %s", res_name);
+      goto finish;
+    }
+
+    double time = 0;
+    bool rec_time = json_number(iot_data_string_map_get(record, "t"), &time);
+    if (has_time || rec_time) {
+      time += base_time;
+      if (fabs(time) < SENML_RELATIVE_TIME_LIMIT) {
+        time += now;
+      }
+      reading->origin = time > 0 ? (uint64_t)(time * 1e9) : 0;
+    }
+  }
+  result = true;
+
+finish:
+  iot_data_free(pack);
+  if (result) {
+    *readings_ptr = readings;
+    *count_ptr = count;
+  } else if (readings) {
+    senml_free_readings(readings, count);
+  }
+  return result;
+}
+
+bool senml_read_json(const char *device, size_t device_len,
+                     const uint8_t *data, size_t len,
+                     reading_item **readings_ptr, uint32_t *count_ptr) {
+  coap_driver *sdk_ctx = (coap_driver *)impl;
+
+  /* JSON parser requires a null terminated string */
+  char *json = malloc(len + 1);
+  memcpy(json, data, len);
+  json[len] = '\0';
+  iot_data_t *pack = iot_data_from_json(json);
+  free(json);
+
+  if (pack == NULL || iot_data_type(pack) != IOT_DATA_VECTOR) {
+    iot_log_info(sdk_ctx->lc, "SenML pack is not a JSON array");
+    iot_data_free(pack);
+    return false;
+  }
+  return read_pack(device, device_len, pack, readings_ptr, count_ptr);
+}
+
+bool senml_read_cbor(const char *device, size_t device_len,
+                     const uint8_t *data, size_t len,
+                     reading_item **readings_ptr, uint32_t *count_ptr) {
+  coap_driver *sdk_ctx = (coap_driver *)impl;
+
+  iot_data_t *pack = cbor_pack(data, len);
+  if (pack == NULL) {
+    iot_log_info(sdk_ctx->lc, "SenML pack is not a valid CBOR array");
+    return false;
+  }
+  return read_pack(device, device_len, pack, readings_ptr, count_ptr);
+}
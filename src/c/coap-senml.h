@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2026
+ * Contributors to the EdgeX Foundry
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef _COAP_SENML_H_
+#define _COAP_SENML_H_ 1
+
+/**
+ * @file
+ * @brief Defines reading of SenML (RFC 8428) packs of device readings.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "coap-publish.h"
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Maximum number of records accepted in a pack */
+#define SENML_MAX_RECORDS 64
+
+/**
+ * Reads a SenML JSON pack of readings for a device. Each record name, after
+ * any base name is applied, must be a resource of the device, optionally
+ * prefixed with "{device-name}/", and its value must suit the resource type.
+ *
+ * @param device Device name, need not be null-terminated
+ * @param device_len Length of device name
+ * @param data Payload
+ * @param len Length of payload
+ * @param readings_ptr Allocated array of readings, on success
+ * @param count_ptr Number of readings, on success
+ * @return true if all records are valid
+ */
+extern bool senml_read_json(const char *device, size_t device_len,
+                            const uint8_t *data, size_t len,
+                            reading_item **readings_ptr, uint32_t *count_ptr);
+
+/**
+ * Reads a SenML CBOR pack of readings for a device, as for
+ * senml_read_json().
+ */
+extern bool senml_read_cbor(const char *device, size_t device_len,
+                            const uint8_t *data, size_t len,
+                            reading_item **readings_ptr, uint32_t *count_ptr);
+
+/** Frees readings, as from senml_read_json(). */
+extern void senml_free_readings(reading_item *readings, uint32_t count);
+#ifdef __cplusplus
+}
+#endif
+#endif
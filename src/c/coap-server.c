@@ -7,7 +7,11 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <float.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <string.h>
 #include <stdint.h>
@@ -17,146 +21,1386 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <unistd.h>
 
 #include <coap2/coap.h>
 #include "edgex/devices.h"
 #include "coap-server.h" 
 #include "device-coap.h"
 #include "coap-util.h"
+#include "coap-batch.h"
+#include "coap-block.h"
+#include "coap-cache.h"
+#include "coap-psk.h"
+#include "coap-cbor.h"
+#include "coap-metrics.h"
+#include "coap-publish.h"
+#include "coap-senml.h"
 
 #define MSG_PAYLOAD_INVALID "payload not valid"
 #define MEDIATYPE_TEXT_PLAIN "text/plain"
 #define MEDIATYPE_APP_JSON "application/json"
 #define CONTENT_FORMAT_UNDEFINED UINT16_MAX
+/* peers tracked for NON message ID gaps; a peer may displace another */
+#define NON_PEER_SLOTS 1024
+/* larger jumps in message ID are taken as a restart of the peer */
+#define NON_MAX_GAP 256
+/* interval between logs of NON request counts, when changed */
+#define NON_STATS_LOG_MSECS 60000
+/* interval for shards to check for shutdown, however the signal arrived */
+#define SHARD_POLL_MSECS 1000
+/* peers of a batched shard tracked for block transfers */
+#define BATCH_PEER_SLOTS 1024
+/* largest block size of a payload served in blocks, as SZX; 1024 bytes */
+#define BLOCK2_MAX_SZX 6
+/* longest a shard waits on I/O while there are observers of last values */
+#define VALUE_NOTIFY_MSECS 50
+/* interval between checks for observed values without observers */
+#define VALUE_PRUNE_MSECS 1000
+/* an ETag is the version of a last value, and its format */
+#define VALUE_ETAG_LEN 8
+/* longest prefix of an unknown PSK identity shown in the log */
+#define PSK_IDENTITY_LOG_MAX 64
 
 static coap_driver *sdk_ctx;
 
+/* Last message ID received in a NON request from a peer */
+typedef struct
+{
+  coap_address_t addr;
+  uint16_t mid;
+  bool used;
+} non_peer;
+
+/*
+ * NON requests are not acknowledged, so loss is estimated from gaps in the
+ * message IDs from each peer.
+ */
+typedef struct
+{
+  non_peer *peers;
+  uint64_t received;
+  uint64_t lost;
+  uint64_t logged_lost;
+  uint64_t last_log;
+} non_stats;
+
+/*
+ * Peer of a batched shard, which stands in for a libcoap session as the key
+ * of block transfers. A peer may displace another, dropping its transfers.
+ */
+typedef struct
+{
+  coap_address_t addr;
+  bool used;
+} batch_peer;
+
+/*
+ * Observer of a last value, with the content format it asked for when it
+ * registered, as libcoap sends notifications without the request.
+ */
+typedef struct value_observer
+{
+  coap_session_t *session;
+  uint8_t token[8];
+  size_t token_len;
+  uint16_t accept;      /* Accept option, or CONTENT_FORMAT_UNDEFINED */
+  struct value_observer *next;
+} value_observer;
+
+/*
+ * Last value of a device resource with observers on a shard. A libcoap
+ * resource is created for it on the first Observe request, as the unknown
+ * resource handling other paths may not be observed; this is its user data.
+ */
+typedef struct observed_value
+{
+  char *device;
+  char *resource;
+  coap_resource_t *coap_resource;
+  uint64_t version;     /* version of the value last notified */
+  value_observer *observers;
+  struct observed_value *next;
+} observed_value;
+
+/*
+ * Server shard, with its own context and thread. With more than one shard,
+ * each has its own socket on the server port (SO_REUSEPORT), and the kernel
+ * spreads peers across them by address, so the state for a peer, like its
+ * DTLS session or payload in blocks, stays with one shard.
+ */
+typedef struct
+{
+  uint32_t index;
+  coap_context_t *ctx;
+  coap_endpoint_t *endpoint;
+  pthread_t thread;
+  bool started;
+  int cpu;              /* core the thread is pinned to, or -1 */
+  block_pool *blocks;   /* payloads being received in blocks */
+  non_stats non;
+  batch_io *batch;      /* batched I/O, bypassing libcoap; NULL if off */
+  batch_peer *batch_peers;
+  uint16_t batch_mid;   /* message ID of the last NON response sent */
+  char *metrics_text;   /* metrics snapshot, served in blocks */
+  size_t metrics_len;
+  observed_value *observed;
+  uint64_t notified_generation; /* cache generation last checked */
+  uint64_t pruned_removals;     /* index removals last checked */
+  uint64_t prune_due;           /* msecs of next check for unobserved values */
+} server_shard;
+
+/* shard served by this thread */
+static __thread server_shard *shard;
+
 /* controls input loop */
 volatile sig_atomic_t quit = 0;
 
-/* signal handler for input loop */
+/* signal handler for input loop */
+static void
+handle_sig (int signum)
+{
+  (void)signum;
+  quit = 1;
+}
+
+/* Reads CoAP content format option, or CONTENT_FORMAT_UNDEFINED if none. */
+static uint16_t
+content_format (coap_pdu_t *request)
+{
+  coap_opt_iterator_t it;
+  coap_opt_t *opt = coap_check_option (request, COAP_OPTION_CONTENT_FORMAT, &it);
+  if (opt)
+  {
+    return coap_decode_var_bytes (coap_opt_value (opt), coap_opt_length (opt));
+  }
+  return CONTENT_FORMAT_UNDEFINED;
+}
+
+/* Sets 5.03 response when the publish queue is full. */
+static void
+set_busy_response (coap_pdu_t *response)
+{
+  unsigned char buf[4];
+  metric_add (METRIC_SERVER_BUSY, 1);
+  response->code = COAP_RESPONSE_CODE (503);
+  coap_add_option (response, COAP_OPTION_MAXAGE,
+                   coap_encode_var_safe (buf, sizeof (buf), sdk_ctx->busy_max_age), buf);
+}
+
+/*
+ * Copies an identity from the network for logging, escaping bytes that are
+ * not printable as \xNN. The buffer holds at least 4 * PSK_IDENTITY_LOG_MAX + 1.
+ */
+static const char *
+escape_identity (const uint8_t *identity, size_t identity_len, char *buf)
+{
+  char *p = buf;
+  if (identity_len > PSK_IDENTITY_LOG_MAX)
+  {
+    identity_len = PSK_IDENTITY_LOG_MAX;
+  }
+  for (size_t i = 0; i < identity_len; i++)
+  {
+    if (identity[i] >= 0x20 && identity[i] < 0x7f && identity[i] != '\\')
+    {
+      *p++ = (char)identity[i];
+    }
+    else
+    {
+      p += sprintf (p, "\\x%02x", identity[i]);
+    }
+  }
+  *p = '\0';
+  return buf;
+}
+
+/*
+ * Finds the key for the PSK identity of a DTLS client. A device without its
+ * own identity may use the shared key, if configured.
+ */
+static size_t
+get_server_psk (const coap_session_t *session, const uint8_t *identity, size_t identity_len,
+                uint8_t *psk, size_t max_psk_len)
+{
+  (void)session;
+  size_t len = psk_store_lookup (identity, identity_len, psk, max_psk_len);
+  if (len || !sdk_ctx->psk_key)
+  {
+    if (!len)
+    {
+      /* at debug; the peer is not yet authenticated */
+      char buf[4 * PSK_IDENTITY_LOG_MAX + 1];
+      iot_log_debug (sdk_ctx->lc, "unknown PSK identity %s", escape_identity (identity, identity_len, buf));
+    }
+    return len;
+  }
+
+  len = iot_data_array_length (sdk_ctx->psk_key);
+  if (len > max_psk_len)
+  {
+    return 0;
+  }
+  iot_data_array_iter_t array_iter;
+  iot_data_array_iter (sdk_ctx->psk_key, &array_iter);
+  iot_data_array_iter_next (&array_iter);
+  memcpy (psk, iot_data_array_iter_value (&array_iter), len);
+  return len;
+}
+
+static uint32_t
+peer_hash (const coap_address_t *addr)
+{
+  if (addr->addr.sa.sa_family == AF_INET6)
+  {
+    uint32_t hash = fnv1a (FNV1A_INIT, &addr->addr.sin6.sin6_port, sizeof (addr->addr.sin6.sin6_port));
+    return fnv1a (hash, &addr->addr.sin6.sin6_addr, sizeof (addr->addr.sin6.sin6_addr));
+  }
+  uint32_t hash = fnv1a (FNV1A_INIT, &addr->addr.sin.sin_port, sizeof (addr->addr.sin.sin_port));
+  return fnv1a (hash, &addr->addr.sin.sin_addr, sizeof (addr->addr.sin.sin_addr));
+}
+
+/*
+ * Counts a NON request, and any requests from the peer lost before it, as
+ * shown by a gap in message IDs. A late request reduces the count of lost.
+ */
+static void
+non_received (const coap_address_t *remote, coap_pdu_t *request)
+{
+  shard->non.received++;
+  if (shard->non.peers)
+  {
+    non_peer *peer = &shard->non.peers[peer_hash (remote) % NON_PEER_SLOTS];
+    if (peer->used && coap_address_equals (&peer->addr, remote))
+    {
+      uint16_t ahead = request->tid - peer->mid;
+      if (ahead == 0)
+      {
+        return;
+      }
+      if (ahead <= NON_MAX_GAP)
+      {
+        shard->non.lost += ahead - 1;
+        metric_add (METRIC_SERVER_NON_LOST, ahead - 1);
+      }
+      else if ((uint16_t)-ahead <= NON_MAX_GAP)
+      {
+        if (shard->non.lost)
+        {
+          shard->non.lost--;
+        }
+        return;
+      }
+    }
+    peer->addr = *remote;
+    peer->mid = request->tid;
+    peer->used = true;
+  }
+
+  uint64_t now = monotonic_msecs ();
+  if (now - shard->non.last_log >= NON_STATS_LOG_MSECS && shard->non.lost != shard->non.logged_lost)
+  {
+    shard->non.last_log = now;
+    shard->non.logged_lost = shard->non.lost;
+    iot_log_info (sdk_ctx->lc, "NON requests received %" PRIu64 ", lost %" PRIu64 " (shard %u)",
+                  shard->non.received, shard->non.lost, shard->index);
+  }
+}
+
+/*
+ * Null terminates the payload of a received PDU in place, if the PDU buffer
+ * has a spare byte after it. The payload is the last part of the PDU, so the
+ * PDU itself is unchanged.
+ */
+static bool
+terminate_payload (coap_pdu_t *pdu, const uint8_t *data, size_t len)
+{
+  if (data + len != pdu->token + pdu->used_size || pdu->used_size >= pdu->alloc_size)
+  {
+    return false;
+  }
+  ((uint8_t *)data)[len] = '\0';
+  return true;
+}
+
+/*
+ * Reads the request payload. A payload sent in blocks (RFC 7959) is
+ * reassembled, keyed by peer and URI path, since a client may change the
+ * token between blocks. Returns false with the response set if waiting for
+ * more blocks, or on error. Otherwise sets transfer for a reassembled
+ * payload, which must be released after use.
+ */
+static bool
+request_body (const void *peer, coap_pdu_t *request, coap_pdu_t *response,
+              const uint8_t **data, size_t *len, block_transfer **transfer)
+{
+  uint8_t *pdu_data = NULL;
+  size_t pdu_len = 0;
+  coap_block_t block;
+
+  *transfer = NULL;
+  coap_get_data (request, &pdu_len, &pdu_data);
+  if (!coap_get_block (request, COAP_OPTION_BLOCK1, &block))
+  {
+    *data = pdu_data;
+    *len = pdu_len;
+    return true;
+  }
+
+  /* expected size of payload, if given with the first block */
+  size_t size_hint = 0;
+  coap_opt_iterator_t it;
+  coap_opt_t *opt = coap_check_option (request, COAP_OPTION_SIZE1, &it);
+  if (opt)
+  {
+    size_hint = coap_decode_var_bytes (coap_opt_value (opt), coap_opt_length (opt));
+  }
+
+  coap_string_t *path = coap_get_uri_path (request);
+  block_status status = block_pool_put (shard->blocks, peer, path ? path->s : NULL, path ? path->length : 0,
+                                        &block, size_hint, pdu_data, pdu_len, transfer);
+  coap_delete_string (path);
+
+  unsigned char buf[4];
+  switch (status)
+  {
+    case BLOCK_MORE:
+      response->code = COAP_RESPONSE_CODE (231);
+      block_add_option (response, COAP_OPTION_BLOCK1, block.num, true, block.szx);
+      return false;
+
+    case BLOCK_DONE:
+      *data = block_body (*transfer, len);
+      return true;
+
+    case BLOCK_TOO_LARGE:
+      iot_log_info (sdk_ctx->lc, "payload in blocks exceeds %u bytes", sdk_ctx->block_max_body);
+      response->code = COAP_RESPONSE_CODE (413);
+      coap_add_option (response, COAP_OPTION_SIZE1,
+                       coap_encode_var_safe (buf, sizeof (buf), sdk_ctx->block_max_body), buf);
+      return false;
+
+    case BLOCK_BUSY:
+      iot_log_warn (sdk_ctx->lc, "no memory to reassemble payload in blocks");
+      set_busy_response (response);
+      return false;
+
+    default:
+      response->code = COAP_RESPONSE_CODE (408);
+      return false;
+  }
+}
+
+/*
+ * Read a SenML pack of readings from device initiated CoAP POST to
+ * /a1r/{device-name}, and post it via devsdk_post_readings() as one event.
+ */
+static void
+pack_handler (coap_pdu_t *request, const uint8_t *data, size_t len,
+              const char *device, size_t device_len, coap_pdu_t *response)
+{
+  bool (*read_pack) (const char *, size_t, const uint8_t *, size_t, reading_item **, uint32_t *);
+  switch (content_format (request))
+  {
+    case COAP_MEDIATYPE_APPLICATION_SENML_JSON:
+      read_pack = senml_read_json;
+      break;
+
+    case COAP_MEDIATYPE_APPLICATION_SENML_CBOR:
+      read_pack = senml_read_cbor;
+      break;
+
+    default:
+      response->code = COAP_RESPONSE_CODE (415);
+      return;
+  }
+
+  reading_item *readings;
+  uint32_t count;
+  if (!len || !read_pack (device, device_len, data, len, &readings, &count))
+  {
+    metric_add (METRIC_SERVER_INVALID_PAYLOADS, 1);
+    response->code = COAP_RESPONSE_CODE (400);
+    coap_add_data (response, strlen (MSG_PAYLOAD_INVALID), (uint8_t *)MSG_PAYLOAD_INVALID);
+    return;
+  }
+
+  if (!publish_pack (readings, count))
+  {
+    iot_log_warn (sdk_ctx->lc, "publish queue full; rejecting pack for %.*s", (int)device_len, device);
+    senml_free_readings (readings, count);
+    set_busy_response (response);
+    return;
+  }
+  response->code = COAP_RESPONSE_CODE (204);
+}
+
+/*
+ * Read data from device initiated CoAP POST to /a1r/{device-name}/{resource-name},
+ * and post it via devsdk_post_readings(). The peer, a libcoap session or
+ * batch_peer, keys the transfer of a payload in blocks.
+ */
+static void
+handle_data (const coap_address_t *remote, const void *peer, coap_pdu_t *request, coap_pdu_t *response)
+{
+
+  /* reject default PUT method */
+  if (request->code == COAP_REQUEST_PUT)
+  {
+    response->code = COAP_RESPONSE_CODE (405);
+    return;
+  }
+  if (request->type == COAP_MESSAGE_NON)
+  {
+    non_received (remote, request);
+  }
+
+  const uint8_t *data;
+  size_t len;
+  block_transfer *transfer;
+  if (!request_body (peer, request, response, &data, &len, &transfer))
+  {
+    return;
+  }
+
+  /* A pack of readings for a device: /a1r/{device-name} */
+  resource_desc *desc = NULL;
+  const char *seg[2];
+  size_t seg_len[2];
+  if (path_segments (request, seg, seg_len, 2) == 2 && is_resource_seg1 (seg[0], seg_len[0]))
+  {
+    pack_handler (request, data, len, seg[1], seg_len[1], response);
+    goto finish;
+  }
+
+  /* Validate URI, expect 3 segments: /a1r/{device-name}/{resource-name} */
+  if (!parse_path (request, &desc))
+  {
+    response->code = COAP_RESPONSE_CODE (404);
+    goto finish;
+  }
+
+  iot_data_t *iot_data = NULL;
+  if (!len)
+  {
+    iot_log_info (sdk_ctx->lc, "invalid data of len %zu", len);
+    /* finalized after else clause */
+  }
+  else
+  {
+    /* Read CoAP content format option for validation below. */
+    uint16_t cf = content_format (request);
+
+    /* Validate and read payload. Content format from option must be acceptable
+     * for resource value type. */
+    if (desc->nformats == 0)
+    {
+      iot_log_error (sdk_ctx->lc, "unsupported resource type %s", iot_data_type_string (desc->type.type));
+      response->code = COAP_RESPONSE_CODE (500);
+      goto finish;
+    }
+    if (!desc_accepts (desc, cf))
+    {
+      response->code = COAP_RESPONSE_CODE (415);
+      goto finish;
+    }
+    if (cf == COAP_MEDIATYPE_APPLICATION_CBOR)
+    {
+      iot_data = cbor_read_value (data, len, &desc->type);
+    }
+    else if (!transfer && desc->type.type == IOT_DATA_STRING && sdk_ctx->string_refs &&
+             publish_is_inline () && terminate_payload (request, data, len))
+    {
+      /* published before the request is freed, so may reference it */
+      iot_data = iot_data_alloc_string ((const char *)data, IOT_DATA_REF);
+    }
+    else if (transfer)
+    {
+      /* take over the reassembled payload rather than copy it */
+      uint8_t *body = block_take_body (transfer, &len);
+      iot_data = codec_take (desc->codec, body, len, &desc->type);
+    }
+    else
+    {
+      iot_data = desc->codec->read (data, len, &desc->type);
+    }
+  }
+  if (!iot_data)
+  {
+    metric_add (METRIC_SERVER_INVALID_PAYLOADS, 1);
+    response->code = COAP_RESPONSE_CODE (400);
+    coap_add_data (response, strlen (MSG_PAYLOAD_INVALID), (uint8_t *)MSG_PAYLOAD_INVALID);
+    goto finish;
+  }
+
+  /* hand off to publisher threads, so reception is not held up by the SDK */
+  if (!publish_reading (desc, iot_data))
+  {
+    iot_log_warn (sdk_ctx->lc, "publish queue full; rejecting reading for %s", desc->device_name);
+    iot_data_free (iot_data);
+    set_busy_response (response);
+    goto finish;
+  }
+
+  response->code = COAP_RESPONSE_CODE (204);
+
+ finish:
+  if (transfer)
+  {
+    /* acknowledge the last block with a successful response */
+    if (response->code == COAP_RESPONSE_CODE (204))
+    {
+      coap_block_t block;
+      coap_get_block (request, COAP_OPTION_BLOCK1, &block);
+      block_add_option (response, COAP_OPTION_BLOCK1, block.num, false, block.szx);
+    }
+    block_release (shard->blocks, transfer);
+  }
+  /* a NON request is answered only on error; libcoap sends no empty NON */
+  if (request->type == COAP_MESSAGE_NON && response->code == COAP_RESPONSE_CODE (204))
+  {
+    response->code = 0;
+  }
+  if (desc)
+  {
+    index_release (desc);
+  }
+}
+
+/* Handles data from a device, counting the request and its response */
+static void
+serve_data (const coap_address_t *remote, const void *peer, coap_pdu_t *request, coap_pdu_t *response)
+{
+  uint64_t start = monotonic_usecs ();
+  metric_add (METRIC_SERVER_REQUESTS, 1);
+  handle_data (remote, peer, request, response);
+  metric_response (METRIC_SERVER_RESPONSES_2XX, response->code);
+  metric_observe (METRIC_SERVER_HANDLING, monotonic_usecs () - start);
+}
+
+static void
+data_handler (coap_context_t *context, coap_resource_t *coap_resource,
+              coap_session_t *session, coap_pdu_t *request, coap_binary_t *token,
+              coap_string_t *query, coap_pdu_t *response)
+{
+  (void)context;
+  (void)coap_resource;
+  (void)token;
+  (void)query;
+  trace_pdu ("received", request);
+  serve_data (&session->remote_addr, session, request, response);
+}
+
+/* Takes a new metrics snapshot, unless serving a later block of the last one */
+static bool
+metrics_snapshot (coap_pdu_t *request)
+{
+  coap_block_t block;
+  if (!shard->metrics_text || !coap_get_block (request, COAP_OPTION_BLOCK2, &block) || block.num == 0)
+  {
+    free (shard->metrics_text);
+    shard->metrics_text = metrics_format (&shard->metrics_len);
+  }
+  return shard->metrics_text != NULL;
+}
+
+/*
+ * Serves the metrics as text. Blocks of one response (RFC 7959) are taken
+ * from the snapshot made for the first block, so they fit together.
+ */
+static void
+metrics_handler (coap_context_t *context, coap_resource_t *resource,
+                 coap_session_t *session, coap_pdu_t *request, coap_binary_t *token,
+                 coap_string_t *query, coap_pdu_t *response)
+{
+  (void)context;
+  (void)query;
+
+  if (!metrics_snapshot (request))
+  {
+    response->code = COAP_RESPONSE_CODE (500);
+    return;
+  }
+  coap_add_data_blocked_response (resource, session, request, response, token, COAP_MEDIATYPE_TEXT_PLAIN,
+                                  0, shard->metrics_len, (const uint8_t *)shard->metrics_text);
+}
+
+/*
+ * Sets a 2.05 response with the block of a payload asked for (RFC 7959), or
+ * all of it if it fits in one block. Options before Content-Format must be
+ * added first. The request may be NULL, as for an Observe notification, to
+ * send the first block. Max-Age is not sent if negative.
+ */
+static void
+add_payload_block (coap_pdu_t *request, coap_pdu_t *response, uint16_t format, int max_age,
+                   const uint8_t *data, size_t len)
+{
+  coap_block_t block = { 0 };
+  bool blocked = request && coap_get_block (request, COAP_OPTION_BLOCK2, &block);
+  if (!blocked || block.szx > BLOCK2_MAX_SZX)
+  {
+    block.szx = BLOCK2_MAX_SZX;
+  }
+  size_t size = 1u << (block.szx + 4);
+  size_t offset = (size_t)block.num * size;
+  if (offset > len)
+  {
+    response->code = COAP_RESPONSE_CODE (400);
+    return;
+  }
+  size_t block_len = len - offset < size ? len - offset : size;
+  bool more = offset + block_len < len;
+
+  unsigned char buf[4];
+  response->code = COAP_RESPONSE_CODE (205);
+  coap_add_option (response, COAP_OPTION_CONTENT_FORMAT, coap_encode_var_safe (buf, sizeof (buf), format), buf);
+  if (max_age >= 0)
+  {
+    coap_add_option (response, COAP_OPTION_MAXAGE, coap_encode_var_safe (buf, sizeof (buf), max_age), buf);
+  }
+  if (blocked || more)
+  {
+    block_add_option (response, COAP_OPTION_BLOCK2, block.num, more, block.szx);
+  }
+  if (block_len)
+  {
+    coap_add_data (response, block_len, data + offset);
+  }
+}
+
+/* Reads the CoAP accept option, or CONTENT_FORMAT_UNDEFINED if none. */
+static uint16_t
+accept_format (coap_pdu_t *request)
+{
+  coap_opt_iterator_t it;
+  coap_opt_t *opt = request ? coap_check_option (request, COAP_OPTION_ACCEPT, &it) : NULL;
+  if (opt)
+  {
+    return coap_decode_var_bytes (coap_opt_value (opt), coap_opt_length (opt));
+  }
+  return CONTENT_FORMAT_UNDEFINED;
+}
+
+/* True if the request has the ETag among those it holds (RFC 7252, 5.10.6) */
+static bool
+etag_matches (coap_pdu_t *request, const uint8_t *etag)
+{
+  coap_opt_iterator_t it;
+  coap_opt_filter_t filter;
+  coap_opt_t *opt;
+
+  coap_option_filter_clear (filter);
+  coap_option_filter_set (filter, COAP_OPTION_ETAG);
+  coap_option_iterator_init (request, &it, filter);
+  while ((opt = coap_option_next (&it)))
+  {
+    if (coap_opt_length (opt) == VALUE_ETAG_LEN && !memcmp (coap_opt_value (opt), etag, VALUE_ETAG_LEN))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+ * Serves the last value of a device resource, as CBOR or with the codec for
+ * its type, as accepted. The ETag is the version of the value and its
+ * format, so a client that holds it gets 2.03 Valid without the payload.
+ * The request may be NULL for a notification; observe is the sequence number
+ * for an observer, or -1.
+ */
+static void
+serve_value (coap_pdu_t *request, uint16_t accept, const char *device, size_t device_len,
+             const char *resource, size_t resource_len, int64_t observe, coap_pdu_t *response)
+{
+  metric_add (METRIC_SERVER_VALUE_REQUESTS, 1);
+  resource_desc *desc = index_lookup (device, device_len, resource, resource_len);
+  if (!desc)
+  {
+    response->code = COAP_RESPONSE_CODE (404);
+    return;
+  }
+
+  bool cbor = accept == COAP_MEDIATYPE_APPLICATION_CBOR || (accept == CONTENT_FORMAT_UNDEFINED && !desc->codec);
+  bool acceptable = cbor ? cbor_supports (&desc->type)
+                         : desc->codec && (accept == CONTENT_FORMAT_UNDEFINED || accept == desc->codec->formats[0]);
+  uint64_t version = 0;
+  iot_data_t *value = acceptable ? cache_get (desc, &version) : NULL;
+  index_release (desc);
+  if (!acceptable)
+  {
+    response->code = COAP_RESPONSE_CODE (406);
+    return;
+  }
+  if (!value)
+  {
+    /* nothing received or read from the device yet */
+    response->code = COAP_RESPONSE_CODE (404);
+    return;
+  }
+
+  uint8_t etag[VALUE_ETAG_LEN];
+  uint64_t tag = version << 1 | cbor;
+  for (int i = VALUE_ETAG_LEN - 1; i >= 0; i--, tag >>= 8)
+  {
+    etag[i] = tag & 0xff;
+  }
+  bool valid = request && etag_matches (request, etag);
+  size_t len = 0;
+  uint16_t format;
+  uint8_t *data = valid ? NULL : codec_encode (value, cbor, &len, &format);
+  iot_data_free (value);
+  if (!valid && !data)
+  {
+    response->code = COAP_RESPONSE_CODE (500);
+    return;
+  }
+
+  unsigned char buf[4];
+  coap_add_option (response, COAP_OPTION_ETAG, VALUE_ETAG_LEN, etag);
+  if (observe >= 0)
+  {
+    coap_add_option (response, COAP_OPTION_OBSERVE, coap_encode_var_safe (buf, sizeof (buf), observe), buf);
+  }
+  if (valid)
+  {
+    metric_add (METRIC_SERVER_VALUES_VALID, 1);
+    response->code = COAP_RESPONSE_CODE (203);
+    return;
+  }
+  add_payload_block (request, response, format, -1, data, len);
+  free (data);
+}
+
+static void
+value_handler (coap_context_t *context, coap_resource_t *coap_resource,
+               coap_session_t *session, coap_pdu_t *request, coap_binary_t *token,
+               coap_string_t *query, coap_pdu_t *response);
+
+/* True if the request registers an observer */
+static bool
+observe_requested (coap_pdu_t *request)
+{
+  coap_opt_iterator_t it;
+  coap_opt_t *opt = coap_check_option (request, COAP_OPTION_OBSERVE, &it);
+  return opt && coap_decode_var_bytes (coap_opt_value (opt), coap_opt_length (opt)) == COAP_OBSERVE_ESTABLISH;
+}
+
+/* Finds the link to the observer of a value with the session and token */
+static value_observer **
+observer_link (observed_value *observed, coap_session_t *session, const coap_binary_t *token)
+{
+  value_observer **link = &observed->observers;
+  for (; *link; link = &(*link)->next)
+  {
+    value_observer *o = *link;
+    if (o->session == session && o->token_len == token->length && !memcmp (o->token, token->s, token->length))
+    {
+      break;
+    }
+  }
+  return link;
+}
+
+/* Records the content format an observer accepts, as it registers */
+static void
+observer_set_accept (observed_value *observed, coap_session_t *session, const coap_binary_t *token,
+                     uint16_t accept)
+{
+  value_observer **link = observer_link (observed, session, token);
+  if (!*link)
+  {
+    if (token->length > sizeof ((*link)->token) || !(*link = calloc (1, sizeof (**link))))
+    {
+      return;
+    }
+    (*link)->session = session;
+    memcpy ((*link)->token, token->s, token->length);
+    (*link)->token_len = token->length;
+  }
+  (*link)->accept = accept;
+}
+
+/*
+ * Creates a libcoap resource for the last value at /a1r/{device}/{resource},
+ * and registers the observer of a request to observe it. NULL if the request
+ * is not to observe, or the resource is not known.
+ */
+static observed_value *
+observe_value (coap_context_t *context, coap_session_t *session, coap_pdu_t *request,
+               coap_binary_t *token, const char **seg, const size_t *seg_len)
+{
+  if (!observe_requested (request))
+  {
+    return NULL;
+  }
+  resource_desc *desc = index_lookup (seg[1], seg_len[1], seg[2], seg_len[2]);
+  if (!desc)
+  {
+    return NULL;
+  }
+  uint64_t version = cache_version (desc);
+  index_release (desc);
+
+  size_t path_len = seg_len[0] + seg_len[1] + seg_len[2] + 2;
+  char *path = malloc (path_len + 1);
+  if (!path)
+  {
+    return NULL;
+  }
+  sprintf (path, "%.*s/%.*s/%.*s", (int)seg_len[0], seg[0], (int)seg_len[1], seg[1], (int)seg_len[2], seg[2]);
+  observed_value *observed = calloc (1, sizeof (*observed));
+  observed->device = strndup (seg[1], seg_len[1]);
+  observed->resource = strndup (seg[2], seg_len[2]);
+  observed->version = version;
+
+  /* data from devices on the path now goes to this resource */
+  coap_resource_t *resource =
+    coap_resource_init (coap_new_str_const ((const uint8_t *)path, path_len), COAP_RESOURCE_FLAGS_RELEASE_URI);
+  free (path);
+  coap_register_handler (resource, COAP_REQUEST_GET, &value_handler);
+  coap_register_handler (resource, COAP_REQUEST_POST, &data_handler);
+  coap_register_handler (resource, COAP_REQUEST_PUT, &data_handler);
+  coap_resource_set_get_observable (resource, 1);
+  coap_resource_set_userdata (resource, observed);
+  coap_add_resource (context, resource);
+  observed->coap_resource = resource;
+  observed->next = shard->observed;
+  shard->observed = observed;
+
+  coap_block_t block2 = { 0 };
+  int has_block2 = coap_get_block (request, COAP_OPTION_BLOCK2, &block2);
+  coap_add_observer (resource, session, token, NULL, has_block2, block2);
+  return observed;
+}
+
+/*
+ * Serves GET /a1r/{device-name}/{resource-name} from the last value cache,
+ * and notifications to its observers.
+ */
 static void
-handle_sig (int signum)
+value_handler (coap_context_t *context, coap_resource_t *coap_resource,
+               coap_session_t *session, coap_pdu_t *request, coap_binary_t *token,
+               coap_string_t *query, coap_pdu_t *response)
 {
-  (void)signum;
-  quit = 1;
+  (void)query;
+  if (request)
+  {
+    trace_pdu ("received", request);
+  }
+  observed_value *observed = coap_resource_get_userdata (coap_resource);
+  if (!observed)
+  {
+    /* the unknown resource, for any path */
+    const char *seg[3];
+    size_t seg_len[3];
+    if (path_segments (request, seg, seg_len, 3) != 3 || !is_resource_seg1 (seg[0], seg_len[0]))
+    {
+      response->code = COAP_RESPONSE_CODE (404);
+      return;
+    }
+    observed = observe_value (context, session, request, token, seg, seg_len);
+    if (!observed)
+    {
+      serve_value (request, accept_format (request), seg[1], seg_len[1], seg[2], seg_len[2], -1, response);
+      return;
+    }
+    coap_resource = observed->coap_resource;
+  }
+  int64_t observe = coap_find_observer (coap_resource, session, token) ? (int64_t)coap_resource->observe : -1;
+  uint16_t accept;
+  if (request)
+  {
+    accept = accept_format (request);
+    if (observe >= 0 && observe_requested (request))
+    {
+      observer_set_accept (observed, session, token, accept);
+    }
+  }
+  else
+  {
+    /* a notification is served in the format the observer registered with */
+    value_observer *o = *observer_link (observed, session, token);
+    accept = o ? o->accept : CONTENT_FORMAT_UNDEFINED;
+  }
+  serve_value (request, accept, observed->device, strlen (observed->device), observed->resource,
+               strlen (observed->resource), observe, response);
 }
 
 /*
- * Read data from device initiated CoAP POST to /a1r/{device-name}/{resource-name},
- * and post it via devsdk_post_readings().
+ * Marks observed values that have changed since last checked, so libcoap
+ * sends notifications, calling value_handler() for each observer.
  */
 static void
-data_handler (coap_context_t *context, coap_resource_t *coap_resource,
-              coap_session_t *session, coap_pdu_t *request, coap_binary_t *token,
-              coap_string_t *query, coap_pdu_t *response)
+notify_values (void)
 {
-  (void)context;
-  (void)coap_resource;
-  (void)session;
-  (void)request;
-  (void)token;
-  (void)query;
+  uint64_t generation = cache_generation ();
+  if (generation == shard->notified_generation)
+  {
+    return;
+  }
+  shard->notified_generation = generation;
+  for (observed_value *o = shard->observed; o; o = o->next)
+  {
+    resource_desc *desc = index_lookup (o->device, strlen (o->device), o->resource, strlen (o->resource));
+    uint64_t version = desc ? cache_version (desc) : 0;
+    if (desc)
+    {
+      index_release (desc);
+    }
+    if (version && version != o->version)
+    {
+      o->version = version;
+      coap_resource_notify_observers (o->coap_resource, NULL);
+    }
+  }
+  coap_check_notify (shard->ctx);
+}
 
-  /* reject default PUT method */
-  if (request->code == COAP_REQUEST_PUT)
+/* Frees an observed value; its libcoap resource is for the caller to delete */
+static void
+observed_free (observed_value *observed)
+{
+  while (observed->observers)
+  {
+    value_observer *o = observed->observers;
+    observed->observers = o->next;
+    free (o);
+  }
+  free (observed->device);
+  free (observed->resource);
+  free (observed);
+}
+
+/*
+ * Deletes the resources of observed values that have no observers left, as
+ * libcoap drops an observer when it deregisters, or its session ends, and of
+ * those for devices removed. Observers of a removed device are dropped with
+ * the resource, and may register again if the device returns.
+ */
+static void
+prune_values (void)
+{
+  uint64_t now = monotonic_msecs ();
+  uint64_t removals = index_removals ();
+  bool removed = removals != shard->pruned_removals;
+  if (!removed && now < shard->prune_due)
+  {
+    return;
+  }
+  shard->pruned_removals = removals;
+  shard->prune_due = now + VALUE_PRUNE_MSECS;
+
+  observed_value **link = &shard->observed;
+  while (*link)
+  {
+    observed_value *o = *link;
+    value_observer **olink = &o->observers;
+    while (*olink)
+    {
+      value_observer *v = *olink;
+      coap_binary_t token = { v->token_len, v->token };
+      if (coap_find_observer (o->coap_resource, v->session, &token))
+      {
+        olink = &v->next;
+      }
+      else
+      {
+        *olink = v->next;
+        free (v);
+      }
+    }
+    bool gone = false;
+    if (removed)
+    {
+      resource_desc *desc = index_lookup (o->device, strlen (o->device), o->resource, strlen (o->resource));
+      gone = !desc;
+      if (desc)
+      {
+        index_release (desc);
+      }
+    }
+    if (gone || !o->coap_resource->subscribers)
+    {
+      *link = o->next;
+      coap_delete_resource (shard->ctx, o->coap_resource);
+      observed_free (o);
+    }
+    else
+    {
+      link = &o->next;
+    }
+  }
+}
+
+/*
+ * Finds the peer of a batched shard for a remote address, displacing any
+ * other peer in its slot.
+ */
+static batch_peer *
+batch_peer_find (const coap_address_t *remote)
+{
+  batch_peer *peer = &shard->batch_peers[peer_hash (remote) % BATCH_PEER_SLOTS];
+  if (!peer->used || !coap_address_equals (&peer->addr, remote))
+  {
+    block_pool_cancel_peer (shard->blocks, peer);
+    peer->addr = *remote;
+    peer->used = true;
+  }
+  return peer;
+}
+
+/*
+ * Serves the metrics text on a batched shard, in blocks as
+ * coap_add_data_blocked_response() does for libcoap sessions.
+ */
+static void
+batch_metrics (coap_pdu_t *request, coap_pdu_t *response)
+{
+  if (request->code != COAP_REQUEST_GET)
   {
     response->code = COAP_RESPONSE_CODE (405);
     return;
   }
+  if (!metrics_snapshot (request))
+  {
+    response->code = COAP_RESPONSE_CODE (500);
+    return;
+  }
+  add_payload_block (request, response, COAP_MEDIATYPE_TEXT_PLAIN, 0,
+                     (const uint8_t *)shard->metrics_text, shard->metrics_len);
+}
 
-  /* Validate URI, expect 3 segments: /a1r/{device-name}/{resource-name} */
-  edgex_device *device = NULL;
-  edgex_deviceresource *resource = NULL;
-  if (!parse_path (request, &device, &resource))
+/*
+ * Handles datagram i of the batch received, queueing any reply. Only what
+ * libcoap would do for the NoSec server is done: requests are dispatched as to
+ * the registered resources, a CON is answered with a piggybacked ACK, and a
+ * CON ping or unexpected response is answered with a RST.
+ */
+static void
+batch_handle (uint32_t i)
+{
+  size_t len;
+  const coap_address_t *remote;
+  uint8_t *data = batch_datagram (shard->batch, i, &len, &remote);
+  if (!data)
+  {
+    return;
+  }
+  coap_pdu_t *response = NULL;
+  coap_pdu_t *request = coap_pdu_init (0, 0, 0, len);
+  if (!request || !coap_pdu_parse (COAP_PROTO_UDP, data, len, request))
+  {
+    goto finish;
+  }
+  trace_pdu ("received", request);
+  if (request->type == COAP_MESSAGE_ACK || request->type == COAP_MESSAGE_RST)
   {
-    response->code = COAP_RESPONSE_CODE (404);
     goto finish;
   }
 
-  iot_data_t *iot_data = NULL;
-  size_t len;
-  uint8_t *data;
-  if (!coap_get_data (request, &len, &data))
+  bool con = request->type == COAP_MESSAGE_CON;
+  if (!COAP_PDU_IS_REQUEST (request))
   {
-    iot_log_info (sdk_ctx->lc, "invalid data of len %zu", len);
-    /* finalized after else clause */
+    if (con)
+    {
+      response = coap_pdu_init (COAP_MESSAGE_RST, 0, request->tid, 0);
+    }
   }
   else
   {
-    /* Read CoAP content format option for validation below. */
-    uint16_t cf = CONTENT_FORMAT_UNDEFINED;
-    coap_opt_iterator_t it;
-    coap_opt_t *opt = coap_check_option (request, COAP_OPTION_CONTENT_FORMAT, &it);
-    if (opt)
+    response = coap_pdu_init (con ? COAP_MESSAGE_ACK : COAP_MESSAGE_NON, COAP_RESPONSE_CODE (404),
+                              con ? request->tid : ++shard->batch_mid, BATCH_DATAGRAM_MAX);
+    if (!response || !coap_add_token (response, request->token_length, request->token))
+    {
+      goto finish;
+    }
+    const char *seg[3];
+    size_t seg_len[3];
+    int nsegs = path_segments (request, seg, seg_len, 3);
+    if (sdk_ctx->serve_metrics && nsegs == 1 &&
+        seg_len[0] == strlen (METRICS_RESOURCE) && !memcmp (seg[0], METRICS_RESOURCE, seg_len[0]))
+    {
+      batch_metrics (request, response);
+    }
+    else if (request->code == COAP_REQUEST_POST || request->code == COAP_REQUEST_PUT)
+    {
+      serve_data (remote, batch_peer_find (remote), request, response);
+    }
+    else if (request->code == COAP_REQUEST_GET && cache_enabled () && nsegs == 3 &&
+             is_resource_seg1 (seg[0], seg_len[0]))
     {
-      cf = coap_decode_var_bytes (coap_opt_value (opt), coap_opt_length (opt));
+      /* no observers without libcoap sessions; a response without Observe says so */
+      serve_value (request, accept_format (request), seg[1], seg_len[1], seg[2], seg_len[2], -1, response);
     }
+  }
 
-    /* Validate and read payload. Content format from option must be acceptable
-     * for resource value type. */
-    switch (resource->properties->type.type)
+  /* a response code of 0 is not sent, except for an empty RST */
+  if (response && (response->code || response->type == COAP_MESSAGE_RST))
+  {
+    size_t hdr_len = coap_pdu_encode_header (response, COAP_PROTO_UDP);
+    if (hdr_len)
     {
-      case IOT_DATA_FLOAT64:
-        if (cf != COAP_MEDIATYPE_TEXT_PLAIN)
-        {
-          response->code = COAP_RESPONSE_CODE (415);
-          goto finish;
-        }
-        iot_data = read_data_float64 (data, len);
-        break;
+      batch_reply (shard->batch, i, response->token - hdr_len, response->used_size + hdr_len);
+    }
+  }
 
-      case IOT_DATA_INT32:
-        if (cf != COAP_MEDIATYPE_TEXT_PLAIN)
-        {
-          response->code = COAP_RESPONSE_CODE (415);
-          goto finish;
-        }
-        iot_data = read_data_int32 (data, len);
-        break;
+ finish:
+  coap_delete_pdu (request);
+  coap_delete_pdu (response);
+}
 
-      case IOT_DATA_STRING:
-        if (cf != COAP_MEDIATYPE_TEXT_PLAIN && cf != COAP_MEDIATYPE_APPLICATION_JSON)
-        {
-          response->code = COAP_RESPONSE_CODE (415);
-          goto finish;
-        }
-        iot_data = read_data_string (data, len);
-        break;
+/*
+ * Serves requests for a batched shard until quit, receiving the datagrams
+ * waiting with one call, and sending the replies to them with another.
+ */
+static void
+batch_run (void)
+{
+  struct pollfd pfd = { .fd = shard->endpoint->sock.fd, .events = POLLIN };
+  while (!quit)
+  {
+    uint32_t count = batch_recv (shard->batch);
+    if (!count)
+    {
+      poll (&pfd, 1, SHARD_POLL_MSECS);
+      continue;
+    }
+    for (uint32_t i = 0; i < count; i++)
+    {
+      batch_handle (i);
+    }
+    batch_flush (shard->batch);
+  }
+}
+
+/*
+ * Replaces the socket of an endpoint with one bound to addr with SO_REUSEPORT,
+ * so the sockets of all shards may share the port. libcoap binds without the
+ * option, so the endpoint is created on any free port and its socket replaced
+ * in place, with the options libcoap sets.
+ */
+static bool
+reuseport_endpoint (coap_endpoint_t *endpoint, const coap_address_t *addr)
+{
+  int on = 1;
+  int off = 0;
+  int fd = socket (addr->addr.sa.sa_family, SOCK_DGRAM, 0);
+  if (fd < 0)
+  {
+    return false;
+  }
+  bool ok = !setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof (on)) &&
+            !setsockopt (fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof (on)) &&
+            fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK) == 0;
+  /* destination address of each datagram is needed for the reply */
+  if (ok && addr->addr.sa.sa_family == AF_INET6)
+  {
+    setsockopt (fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof (off));
+    ok = !setsockopt (fd, IPPROTO_IPV6, IPV6_RECVPKTINFO, &on, sizeof (on));
+    setsockopt (fd, IPPROTO_IP, IP_PKTINFO, &on, sizeof (on));
+  }
+  else if (ok)
+  {
+    ok = !setsockopt (fd, IPPROTO_IP, IP_PKTINFO, &on, sizeof (on));
+  }
+  coap_address_t bound;
+  coap_address_init (&bound);
+  ok = ok && bind (fd, &addr->addr.sa, addr->size) == 0 &&
+       getsockname (fd, &bound.addr.sa, &bound.size) == 0 &&
+       dup2 (fd, endpoint->sock.fd) >= 0;
+  close (fd);
+  if (ok)
+  {
+    endpoint->bind_addr = bound;
+  }
+  return ok;
+}
+
+/* Creates the context for a shard, listening on bind_addr */
+static bool
+shard_open (server_shard *s, const coap_address_t *bind_addr, coap_proto_t proto, bool reuseport)
+{
+  if (!(s->ctx = coap_new_context (NULL)))
+  {
+    iot_log_error (sdk_ctx->lc, "cannot initialize context");
+    return false;
+  }
+
+  if (sdk_ctx->security_mode == SECURITY_MODE_PSK)
+  {
+    /* use iterator just to get address of PSK key data */
+    const uint8_t *key = NULL;
+    size_t key_len = 0;
+    if (sdk_ctx->psk_key)
+    {
+      iot_data_array_iter_t array_iter;
+      iot_data_array_iter (sdk_ctx->psk_key, &array_iter);
+      iot_data_array_iter_next(&array_iter);
+      key = iot_data_array_iter_value (&array_iter);
+      key_len = iot_data_array_length (sdk_ctx->psk_key);
+    }
 
-      default:
-        iot_log_error (sdk_ctx->lc, "unsupported resource type %s", iot_data_type_string (resource->properties->type.type));
-        response->code = COAP_RESPONSE_CODE (500);
-        goto finish;
+    if (!(coap_context_set_psk (s->ctx, "", key, key_len)))
+    {
+      iot_log_error (sdk_ctx->lc, "cannot initialize PSK");
+      return false;
     }
+    /* keys are looked up per identity, in place of the single key */
+    s->ctx->get_server_psk = get_server_psk;
   }
-  if (!iot_data)
+
+  coap_address_t any_port = *bind_addr;
+  if (reuseport)
   {
-    response->code = COAP_RESPONSE_CODE (400);
-    coap_add_data (response, strlen (MSG_PAYLOAD_INVALID), (uint8_t *)MSG_PAYLOAD_INVALID);
-    goto finish;
+    address_set_port (&any_port, 0);
+  }
+  s->endpoint = coap_new_endpoint (s->ctx, &any_port, proto);
+  if (!s->endpoint || (reuseport && !reuseport_endpoint (s->endpoint, bind_addr)))
+  {
+    iot_log_error (sdk_ctx->lc, "cannot initialize listen endpoint: %s", strerror (errno));
+    return false;
+  }
+
+  /* Creates handler for PUT, which is not what we want... */
+  coap_resource_t *resource = coap_resource_unknown_init (&data_handler);
+  /* ... so add POST handler also. */
+  coap_register_handler (resource, COAP_REQUEST_POST, &data_handler);
+  if (cache_enabled ())
+  {
+    coap_register_handler (resource, COAP_REQUEST_GET, &value_handler);
   }
+  coap_add_resource (s->ctx, resource);
 
-  /* generate and post an event with the data */
-  devsdk_commandresult results[1];
-  results[0].origin = 0;
-  results[0].value = iot_data;
+  if (sdk_ctx->serve_metrics)
+  {
+    resource = coap_resource_init (coap_make_str_const (METRICS_RESOURCE), 0);
+    coap_register_handler (resource, COAP_REQUEST_GET, &metrics_handler);
+    coap_add_resource (s->ctx, resource);
+  }
 
-  devsdk_post_readings (sdk_ctx->service, device->name, resource->name, results, NULL);
-  iot_data_free (results[0].value);
+  s->blocks = block_pool_new (sdk_ctx->block_max_body, sdk_ctx->block_max_peer);
+  s->non.peers = calloc (NON_PEER_SLOTS, sizeof (non_peer));
 
-  response->code = COAP_RESPONSE_CODE (204);
+  if (sdk_ctx->server_batch_size && proto == COAP_PROTO_UDP)
+  {
+    s->batch = batch_new (s->endpoint->sock.fd, sdk_ctx->server_batch_size);
+    s->batch_peers = calloc (BATCH_PEER_SLOTS, sizeof (batch_peer));
+    s->batch_mid = (uint16_t)monotonic_usecs ();
+    if (!s->batch || !s->batch_peers)
+    {
+      iot_log_error (sdk_ctx->lc, "cannot allocate batch of %u datagrams", sdk_ctx->server_batch_size);
+      return false;
+    }
+  }
+  return true;
+}
 
- finish:
-  edgex_free_device (sdk_ctx->service, device);
+static void
+shard_close (server_shard *s)
+{
+  coap_free_context (s->ctx);
+  while (s->observed)
+  {
+    observed_value *observed = s->observed;
+    s->observed = observed->next;
+    observed_free (observed);
+  }
+  block_pool_free (s->blocks);
+  free (s->non.peers);
+  batch_free (s->batch);
+  free (s->batch_peers);
+  free (s->metrics_text);
+}
+
+/*
+ * Serves requests for a shard until quit. The first shard runs on the main
+ * thread, the only one to take SIGINT and SIGTERM; each shard still checks
+ * quit periodically, as a signal may arrive just before it waits on I/O.
+ */
+static void *
+shard_run (void *arg)
+{
+  shard = arg;
+  if (shard->cpu >= 0)
+  {
+    cpu_set_t set;
+    CPU_ZERO (&set);
+    CPU_SET (shard->cpu, &set);
+    if (pthread_setaffinity_np (pthread_self (), sizeof (set), &set))
+    {
+      iot_log_warn (sdk_ctx->lc, "cannot pin server shard %u to core %d", shard->index, shard->cpu);
+    }
+  }
+  if (shard->batch)
+  {
+    batch_run ();
+    return NULL;
+  }
+  while (!quit)
+  {
+    /* observers of last values are notified of changes between waits */
+    coap_io_process (shard->ctx, shard->observed ? VALUE_NOTIFY_MSECS : SHARD_POLL_MSECS);
+    if (shard->observed)
+    {
+      notify_values ();
+      prune_values ();
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Assigns each shard a core the process may run on, in turn. A single shard
+ * is not pinned.
+ */
+static void
+assign_cores (server_shard *shards, uint32_t nshards)
+{
+  cpu_set_t allowed;
+  int cpus[CPU_SETSIZE];
+  int ncpus = 0;
+  if (nshards > 1 && sched_getaffinity (0, sizeof (allowed), &allowed) == 0)
+  {
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+      if (CPU_ISSET (cpu, &allowed))
+      {
+        cpus[ncpus++] = cpu;
+      }
+    }
+  }
+  for (uint32_t i = 0; i < nshards; i++)
+  {
+    shards[i].index = i;
+    shards[i].cpu = ncpus ? cpus[i % ncpus] : -1;
+  }
+}
+
+/* Number of server shards configured; 0 for one per core */
+static uint32_t
+shard_count (void)
+{
+  if (sdk_ctx->server_shards)
+  {
+    return sdk_ctx->server_shards;
+  }
+  cpu_set_t allowed;
+  if (sched_getaffinity (0, sizeof (allowed), &allowed) == 0 && CPU_COUNT (&allowed) > 0)
+  {
+    return CPU_COUNT (&allowed);
+  }
+  return 1;
 }
 
 int
 run_server (void)
 {
-  coap_context_t  *ctx = NULL;
   coap_address_t bind_addr;
-  coap_resource_t *resource = NULL;
+  server_shard *shards = NULL;
+  uint32_t nshards = 0;
   int result = EXIT_FAILURE;
   sdk_ctx = impl;
   struct sigaction sa;
@@ -199,65 +1443,80 @@ run_server (void)
     proto = COAP_PROTO_DTLS;
     port = "5684";
   }
+  if (sdk_ctx->server_batch_size && proto != COAP_PROTO_UDP)
+  {
+    iot_log_warn (sdk_ctx->lc, "batched datagram I/O is only for NoSec; ignoring ServerBatchSize");
+  }
   if (resolve_address (iot_data_string (sdk_ctx->coap_bind_addr), port, &bind_addr) < 0) {
     iot_log_error (sdk_ctx->lc, "failed to resolve CoAP bind address");
     goto finish;
   }
 
-  /* setup libcoap for a server */
-  if (!(ctx = coap_new_context (NULL)))
+  /* setup libcoap for a server; one context per shard */
+  nshards = shard_count ();
+  shards = calloc (nshards, sizeof (server_shard));
+  if (!shards)
   {
-    iot_log_error (sdk_ctx->lc, "cannot initialize context");
+    nshards = 0;
     goto finish;
   }
-
-  if (sdk_ctx->security_mode == SECURITY_MODE_PSK)
+  assign_cores (shards, nshards);
+  for (uint32_t i = 0; i < nshards; i++)
   {
-    /* use iterator just to get address of PSK key data */
-    iot_data_array_iter_t array_iter;
-    iot_data_array_iter (sdk_ctx->psk_key, &array_iter);
-    iot_data_array_iter_next(&array_iter);
-
-    if (!(coap_context_set_psk (ctx, "", (uint8_t *)iot_data_array_iter_value (&array_iter),
-                                iot_data_array_length (sdk_ctx->psk_key))))
+    if (!shard_open (&shards[i], &bind_addr, proto, nshards > 1))
     {
-      iot_log_error (sdk_ctx->lc, "cannot initialize PSK");
       goto finish;
     }
   }
 
-  if (!(coap_new_endpoint (ctx, &bind_addr, proto)))
-  {
-    iot_log_error (sdk_ctx->lc, "cannot initialize listen endpoint");
-    goto finish;
-  }
-
-  /* Creates handler for PUT, which is not what we want... */
-  resource = coap_resource_unknown_init (&data_handler);
-  /* ... so add POST handler also. */
-  coap_register_handler (resource, COAP_REQUEST_POST, &data_handler);
-  coap_add_resource (ctx, resource);
-
-  /* setup signal handling for input loop */
+  /*
+   * setup signal handling for input loop; only the main thread takes them.
+   * main() blocks them before the SDK and driver threads start, and the
+   * shard threads are started with them blocked too.
+   */
   sigemptyset (&sa.sa_mask);
   sa.sa_handler = handle_sig;
   sa.sa_flags = 0;
   sigaction (SIGINT, &sa, NULL);
   sigaction (SIGTERM, &sa, NULL);
 
-  iot_log_info (sdk_ctx->lc, "CoAP %s server started on %s", sdk_ctx->psk_key ? "PSK" : "NoSec",
-                iot_data_string (sdk_ctx->coap_bind_addr));
-
-  while (!quit)
+  sigset_t block_set;
+  sigemptyset (&block_set);
+  sigaddset (&block_set, SIGINT);
+  sigaddset (&block_set, SIGTERM);
+  pthread_sigmask (SIG_BLOCK, &block_set, NULL);
+  for (uint32_t i = 1; i < nshards; i++)
   {
-    coap_io_process (ctx, COAP_IO_WAIT);
+    shards[i].started = pthread_create (&shards[i].thread, NULL, shard_run, &shards[i]) == 0;
+    if (!shards[i].started)
+    {
+      iot_log_error (sdk_ctx->lc, "cannot start server shard %u", i);
+      goto finish;
+    }
   }
+  pthread_sigmask (SIG_UNBLOCK, &block_set, NULL);
+
+  iot_log_info (sdk_ctx->lc, "CoAP %s server started on %s with %u shards%s",
+                sdk_ctx->security_mode == SECURITY_MODE_PSK ? "PSK" : "NoSec",
+                iot_data_string (sdk_ctx->coap_bind_addr), nshards, shards[0].batch ? ", batched" : "");
 
+  shard_run (&shards[0]);
   result = EXIT_SUCCESS;
 
  finish:
-
-  coap_free_context (ctx);
+  quit = 1;
+  for (uint32_t i = 0; i < nshards; i++)
+  {
+    if (shards[i].started)
+    {
+      pthread_join (shards[i].thread, NULL);
+    }
+  }
+  for (uint32_t i = 0; i < nshards; i++)
+  {
+    shard_close (&shards[i]);
+  }
+  free (shards);
   coap_cleanup ();
 
   return result;
@@ -9,8 +9,15 @@
 #include "coap-util.h"
 
 #include <errno.h>
+#include <float.h>
+#include <inttypes.h>
+#include <math.h>
 #include <netdb.h>
+#include <stdio.h>
+#include <sys/random.h>
+#include <time.h>
 
+#include "coap-cbor.h"
 #include "device-coap.h"
 
 /*
@@ -56,58 +63,570 @@ finish:
   return len;
 }
 
-/* Caller must free returned iot_data_t */
-iot_data_t *read_data_float64(uint8_t *data, size_t len) {
+/* Sets the port of an internet address */
+void address_set_port(coap_address_t *addr, uint16_t port) {
+  if (addr->addr.sa.sa_family == AF_INET6) {
+    addr->addr.sin6.sin6_port = htons(port);
+  } else {
+    addr->addr.sin.sin_port = htons(port);
+  }
+}
+
+/* Milliseconds from an arbitrary fixed point; unaffected by clock changes */
+uint64_t monotonic_msecs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* As monotonic_msecs(), in microseconds, for timing short operations */
+uint64_t monotonic_usecs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * Fills a token with random bytes, so that an off-path attacker cannot guess
+ * it to spoof the response to a NoSec request (RFC 7252, 5.3.1)
+ */
+void random_token(uint8_t *token, size_t len) {
+  if (getrandom(token, len, 0) == (ssize_t)len) {
+    return;
+  }
+  /* no entropy source; still unique, if guessable */
+  static uint64_t counter;
+  uint64_t val = monotonic_usecs() << 16 ^
+                 __atomic_add_fetch(&counter, 1, __ATOMIC_RELAXED);
+  memset(token, 0, len);
+  memcpy(token, &val, len < sizeof(val) ? len : sizeof(val));
+}
+
+/*
+ * Continues an FNV-1a hash over len bytes; start from FNV1A_INIT. Quick to
+ * compute, and spreads short keys like names and addresses well enough for
+ * the hash tables of each module.
+ */
+uint32_t fnv1a(uint32_t hash, const void *data, size_t len) {
+  const uint8_t *bytes = data;
+  for (size_t i = 0; i < len; i++) {
+    hash = (hash ^ bytes[i]) * 16777619u;
+  }
+  return hash;
+}
+
+/*
+ * Dumps a PDU sent or received to the log, if enabled by TracePdus. Only 1 in
+ * that many PDUs is dumped, counted across all threads, so tracing may be left
+ * on under load. Nothing is formatted for a PDU not sampled.
+ */
+void trace_pdu(const char *what, const coap_pdu_t *pdu) {
+  static uint32_t count = 0;
   coap_driver *sdk_ctx = (coap_driver *)impl;
-  if (len > FLOAT64_STR_MAXLEN) {
-    iot_log_info(sdk_ctx->lc, "invalid float64 of len %zu", len);
-    return NULL;
+  uint32_t every = sdk_ctx->trace_pdus;
+  if (every == 0 ||
+      __atomic_fetch_add(&count, 1, __ATOMIC_RELAXED) % every != 0) {
+    return;
   }
-  /* data conversion requires a null terminated string */
-  uint8_t data_str[FLOAT64_STR_MAXLEN + 1];
-  data_str[len] = 0;
-  memcpy(data_str, data, len);
+  iot_log_info(sdk_ctx->lc, "COAP:trace %s PDU", what);
+  /* at the current level, so it is not filtered */
+  coap_show_pdu(coap_get_log_level(), pdu);
+}
 
+/*
+ * Reads an unsigned integer from the driver configuration, where values are
+ * provided as text. Returns default_val if not present or not valid.
+ */
+uint32_t config_get_uint(const iot_data_t *config, const char *key,
+                         uint32_t default_val) {
+  const char *text = iot_data_string_map_get_string(config, key);
+  if (text == NULL || *text == '\0') {
+    return default_val;
+  }
   char *endptr;
   errno = 0;
-  double dbl_val = strtod((char *)data_str, &endptr);
+  unsigned long val = strtoul(text, &endptr, 10);
+  if (errno || *endptr != '\0' || val > UINT32_MAX) {
+    coap_driver *sdk_ctx = (coap_driver *)impl;
+    iot_log_warn(sdk_ctx->lc, "invalid value for %s: %s; using %u", key, text,
+                 default_val);
+    return default_val;
+  }
+  return (uint32_t)val;
+}
 
-  if (errno || (*endptr != '\0')) {
-    iot_log_info(sdk_ctx->lc, "invalid float64 of len %zu", len);
-    return NULL;
+/*
+ * Reads a decimal number, like 1.5, from the driver configuration as a
+ * libcoap fixed point value, to the nearest thousandth. Returns default_val
+ * if not present or not valid.
+ */
+coap_fixed_point_t config_get_fixed(const iot_data_t *config, const char *key,
+                                    coap_fixed_point_t default_val) {
+  const char *text = iot_data_string_map_get_string(config, key);
+  if (text == NULL || *text == '\0') {
+    return default_val;
+  }
+  char *endptr;
+  errno = 0;
+  double val = strtod(text, &endptr);
+  if (errno || *endptr != '\0' || !(val >= 0.0 && val < UINT16_MAX)) {
+    coap_driver *sdk_ctx = (coap_driver *)impl;
+    iot_log_warn(sdk_ctx->lc, "invalid value for %s: %s; using %u.%03u", key,
+                 text, default_val.integer_part, default_val.fractional_part);
+    return default_val;
   }
+  uint32_t thousandths = (uint32_t)(val * 1000.0 + 0.5);
+  coap_fixed_point_t fixed = {(uint16_t)(thousandths / 1000),
+                              (uint16_t)(thousandths % 1000)};
+  return fixed;
+}
 
-  return iot_data_alloc_f64(dbl_val);
+size_t scalar_size(iot_data_type_t type) {
+  switch (type) {
+    case IOT_DATA_INT8:
+    case IOT_DATA_UINT8:
+      return 1;
+    case IOT_DATA_INT16:
+    case IOT_DATA_UINT16:
+      return 2;
+    case IOT_DATA_INT32:
+    case IOT_DATA_UINT32:
+    case IOT_DATA_FLOAT32:
+      return 4;
+    case IOT_DATA_INT64:
+    case IOT_DATA_UINT64:
+    case IOT_DATA_FLOAT64:
+      return 8;
+    case IOT_DATA_BOOL:
+      return sizeof(bool);
+    default:
+      return 0;
+  }
 }
 
-/* Caller must free returned iot_data_t */
-iot_data_t *read_data_int32(uint8_t *data, size_t len) {
-  coap_driver *sdk_ctx = (coap_driver *)impl;
-  if (len > INT32_STR_MAXLEN) {
-    iot_log_info(sdk_ctx->lc, "invalid int32 of len %zu", len);
-    return NULL;
+iot_data_t *scalar_alloc(iot_data_type_t type, const scalar_value *v) {
+  switch (type) {
+    case IOT_DATA_INT8:
+      return iot_data_alloc_i8(v->i8);
+    case IOT_DATA_UINT8:
+      return iot_data_alloc_ui8(v->ui8);
+    case IOT_DATA_INT16:
+      return iot_data_alloc_i16(v->i16);
+    case IOT_DATA_UINT16:
+      return iot_data_alloc_ui16(v->ui16);
+    case IOT_DATA_INT32:
+      return iot_data_alloc_i32(v->i32);
+    case IOT_DATA_UINT32:
+      return iot_data_alloc_ui32(v->ui32);
+    case IOT_DATA_INT64:
+      return iot_data_alloc_i64(v->i64);
+    case IOT_DATA_UINT64:
+      return iot_data_alloc_ui64(v->ui64);
+    case IOT_DATA_FLOAT32:
+      return iot_data_alloc_f32(v->f32);
+    case IOT_DATA_FLOAT64:
+      return iot_data_alloc_f64(v->f64);
+    case IOT_DATA_BOOL:
+      return iot_data_alloc_bool(v->b);
+    default:
+      return NULL;
   }
-  /* data conversion requires a null terminated string */
-  uint8_t data_str[INT32_STR_MAXLEN + 1];
-  data_str[len] = 0;
-  memcpy(data_str, data, len);
+}
 
+bool scalar_load(const iot_data_t *value, scalar_value *v) {
+  switch (iot_data_type(value)) {
+    case IOT_DATA_INT8:
+      v->i8 = iot_data_i8(value);
+      return true;
+    case IOT_DATA_UINT8:
+      v->ui8 = iot_data_ui8(value);
+      return true;
+    case IOT_DATA_INT16:
+      v->i16 = iot_data_i16(value);
+      return true;
+    case IOT_DATA_UINT16:
+      v->ui16 = iot_data_ui16(value);
+      return true;
+    case IOT_DATA_INT32:
+      v->i32 = iot_data_i32(value);
+      return true;
+    case IOT_DATA_UINT32:
+      v->ui32 = iot_data_ui32(value);
+      return true;
+    case IOT_DATA_INT64:
+      v->i64 = iot_data_i64(value);
+      return true;
+    case IOT_DATA_UINT64:
+      v->ui64 = iot_data_ui64(value);
+      return true;
+    case IOT_DATA_FLOAT32:
+      v->f32 = iot_data_f32(value);
+      return true;
+    case IOT_DATA_FLOAT64:
+      v->f64 = iot_data_f64(value);
+      return true;
+    case IOT_DATA_BOOL:
+      v->b = iot_data_bool(value);
+      return true;
+    default:
+      return false;
+  }
+}
+
+/* Range of an integer type; false if not an integer type */
+static bool int_range(iot_data_type_t type, int64_t *min, uint64_t *max) {
+  switch (type) {
+    case IOT_DATA_INT8:
+      *min = INT8_MIN;
+      *max = INT8_MAX;
+      return true;
+    case IOT_DATA_UINT8:
+      *min = 0;
+      *max = UINT8_MAX;
+      return true;
+    case IOT_DATA_INT16:
+      *min = INT16_MIN;
+      *max = INT16_MAX;
+      return true;
+    case IOT_DATA_UINT16:
+      *min = 0;
+      *max = UINT16_MAX;
+      return true;
+    case IOT_DATA_INT32:
+      *min = INT32_MIN;
+      *max = INT32_MAX;
+      return true;
+    case IOT_DATA_UINT32:
+      *min = 0;
+      *max = UINT32_MAX;
+      return true;
+    case IOT_DATA_INT64:
+      *min = INT64_MIN;
+      *max = INT64_MAX;
+      return true;
+    case IOT_DATA_UINT64:
+      *min = 0;
+      *max = UINT64_MAX;
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool scalar_from_int(iot_data_type_t type, bool negative, uint64_t magnitude,
+                     scalar_value *v) {
+  int64_t min;
+  uint64_t max;
+  if (!int_range(type, &min, &max)) {
+    return false;
+  }
+  int64_t sval = 0;
+  if (!negative) {
+    if (magnitude > max) {
+      return false;
+    }
+    sval = (int64_t)magnitude;
+  } else {
+    /* magnitude of min is -(min + 1) + 1, to avoid overflow for INT64_MIN;
+     * wraps to 0 for unsigned types */
+    if (magnitude > (uint64_t)(-(min + 1)) + 1) {
+      return false;
+    }
+    sval = magnitude ? -(int64_t)(magnitude - 1) - 1 : 0;
+  }
+  switch (type) {
+    case IOT_DATA_INT8:
+      v->i8 = (int8_t)sval;
+      break;
+    case IOT_DATA_UINT8:
+      v->ui8 = (uint8_t)sval;
+      break;
+    case IOT_DATA_INT16:
+      v->i16 = (int16_t)sval;
+      break;
+    case IOT_DATA_UINT16:
+      v->ui16 = (uint16_t)sval;
+      break;
+    case IOT_DATA_INT32:
+      v->i32 = (int32_t)sval;
+      break;
+    case IOT_DATA_UINT32:
+      v->ui32 = (uint32_t)sval;
+      break;
+    case IOT_DATA_INT64:
+      v->i64 = sval;
+      break;
+    default:
+      v->ui64 = magnitude;
+      break;
+  }
+  return true;
+}
+
+/* Reads an integer scalar as sign and magnitude; false if not an integer */
+static bool int_parts(iot_data_type_t type, const scalar_value *v,
+                      bool *negative, uint64_t *magnitude) {
+  int64_t sval;
+  switch (type) {
+    case IOT_DATA_INT8:
+      sval = v->i8;
+      break;
+    case IOT_DATA_INT16:
+      sval = v->i16;
+      break;
+    case IOT_DATA_INT32:
+      sval = v->i32;
+      break;
+    case IOT_DATA_INT64:
+      sval = v->i64;
+      break;
+    case IOT_DATA_UINT8:
+      sval = v->ui8;
+      break;
+    case IOT_DATA_UINT16:
+      sval = v->ui16;
+      break;
+    case IOT_DATA_UINT32:
+      sval = v->ui32;
+      break;
+    case IOT_DATA_UINT64:
+      *negative = false;
+      *magnitude = v->ui64;
+      return true;
+    default:
+      return false;
+  }
+  *negative = sval < 0;
+  *magnitude = sval < 0 ? (uint64_t)(-(sval + 1)) + 1 : (uint64_t)sval;
+  return true;
+}
+
+bool scalar_convert(iot_data_type_t src_type, const scalar_value *src,
+                    iot_data_type_t type, scalar_value *v) {
+  bool negative;
+  uint64_t magnitude;
+
+  if (type == IOT_DATA_BOOL || src_type == IOT_DATA_BOOL) {
+    v->b = src->b;
+    return type == src_type;
+  }
+  if (type == IOT_DATA_FLOAT32 || type == IOT_DATA_FLOAT64) {
+    double dbl;
+    if (src_type == IOT_DATA_FLOAT64) {
+      dbl = src->f64;
+    } else if (src_type == IOT_DATA_FLOAT32) {
+      dbl = src->f32;
+    } else if (int_parts(src_type, src, &negative, &magnitude)) {
+      dbl = negative ? -(double)magnitude : (double)magnitude;
+    } else {
+      return false;
+    }
+    if (type == IOT_DATA_FLOAT64) {
+      v->f64 = dbl;
+      return true;
+    }
+    if (isfinite(dbl) && fabs(dbl) > FLT_MAX) {
+      return false;
+    }
+    v->f32 = (float)dbl;
+    return true;
+  }
+  return int_parts(src_type, src, &negative, &magnitude) &&
+         scalar_from_int(type, negative, magnitude, v);
+}
+
+bool format_scalar(iot_data_type_t type, const scalar_value *v, char *buf,
+                   size_t size) {
+  int len;
+  switch (type) {
+    case IOT_DATA_INT8:
+      len = snprintf(buf, size, "%" PRId8, v->i8);
+      break;
+    case IOT_DATA_UINT8:
+      len = snprintf(buf, size, "%" PRIu8, v->ui8);
+      break;
+    case IOT_DATA_INT16:
+      len = snprintf(buf, size, "%" PRId16, v->i16);
+      break;
+    case IOT_DATA_UINT16:
+      len = snprintf(buf, size, "%" PRIu16, v->ui16);
+      break;
+    case IOT_DATA_INT32:
+      len = snprintf(buf, size, "%" PRId32, v->i32);
+      break;
+    case IOT_DATA_UINT32:
+      len = snprintf(buf, size, "%" PRIu32, v->ui32);
+      break;
+    case IOT_DATA_INT64:
+      len = snprintf(buf, size, "%" PRId64, v->i64);
+      break;
+    case IOT_DATA_UINT64:
+      len = snprintf(buf, size, "%" PRIu64, v->ui64);
+      break;
+    case IOT_DATA_FLOAT32:
+      len = snprintf(buf, size, "%.9g", v->f32);
+      break;
+    case IOT_DATA_FLOAT64:
+      len = snprintf(buf, size, "%.17g", v->f64);
+      break;
+    case IOT_DATA_BOOL:
+      len = snprintf(buf, size, "%s", v->b ? "true" : "false");
+      break;
+    default:
+      return false;
+  }
+  return len >= 0 && (size_t)len < size;
+}
+
+/* Powers of ten exactly representable as a double */
+static const double exact_pow10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+/* Reads an optional sign; returns the index of the first character after it */
+static size_t read_sign(const char *text, size_t len, bool *negative) {
+  *negative = len && text[0] == '-';
+  return len && (text[0] == '-' || text[0] == '+') ? 1 : 0;
+}
+
+/* Reads a decimal integer as sign and magnitude; false if not valid */
+static bool parse_int(const char *text, size_t len, bool *negative,
+                      uint64_t *magnitude) {
+  size_t i = read_sign(text, len, negative);
+  if (i == len) {
+    return false;
+  }
+  uint64_t val = 0;
+  for (; i < len; i++) {
+    unsigned int digit = (unsigned char)text[i] - '0';
+    if (digit > 9 || val > (UINT64_MAX - digit) / 10) {
+      return false;
+    }
+    val = val * 10 + digit;
+  }
+  *magnitude = val;
+  return true;
+}
+
+/*
+ * Reads plain decimal text, like -12.375, as mantissa and count of fraction
+ * digits. False if the text has an exponent, or more significant digits than
+ * max_digits, so it needs the general parser.
+ */
+static bool parse_decimal(const char *text, size_t len, int max_digits,
+                          bool *negative, uint64_t *mantissa, int *frac) {
+  size_t i = read_sign(text, len, negative);
+  bool point = false;
+  bool any = false;
+  int digits = 0;
+  *mantissa = 0;
+  *frac = 0;
+  for (; i < len; i++) {
+    if (text[i] == '.' && !point) {
+      point = true;
+      continue;
+    }
+    unsigned int digit = (unsigned char)text[i] - '0';
+    if (digit > 9) {
+      return false;
+    }
+    any = true;
+    if (*mantissa || digit) {
+      if (++digits > max_digits) {
+        return false;
+      }
+      *mantissa = *mantissa * 10 + digit;
+    }
+    if (point) {
+      (*frac)++;
+    }
+  }
+  return any;
+}
+
+/*
+ * Reads a float of the type. Plain decimal text with a mantissa and power of
+ * ten both exact in the type is read with one rounding, as strtod() would
+ * read it. Other text is copied to be null terminated for strtod().
+ */
+static bool parse_float(const char *text, size_t len, iot_data_type_t type,
+                        scalar_value *v) {
+  bool negative;
+  uint64_t mantissa;
+  int frac;
+  bool f64 = type == IOT_DATA_FLOAT64;
+
+  /* 10^15 < 2^53 and 10^7 < 2^24; 10^22 and 10^10 are exact */
+  if (parse_decimal(text, len, f64 ? 15 : 7, &negative, &mantissa, &frac) &&
+      frac <= (f64 ? 22 : 10)) {
+    if (f64) {
+      v->f64 = (double)mantissa / exact_pow10[frac];
+      v->f64 = negative ? -v->f64 : v->f64;
+    } else {
+      v->f32 = (float)mantissa / (float)exact_pow10[frac];
+      v->f32 = negative ? -v->f32 : v->f32;
+    }
+    return true;
+  }
+
+  char buf[NUMBER_STR_MAXLEN + 1];
   char *endptr;
+  if (len == 0 || len > NUMBER_STR_MAXLEN) {
+    return false;
+  }
+  memcpy(buf, text, len);
+  buf[len] = '\0';
   errno = 0;
-  long int_val = strtol((char *)data_str, &endptr, 10);
+  if (f64) {
+    v->f64 = strtod(buf, &endptr);
+  } else {
+    v->f32 = strtof(buf, &endptr);
+  }
+  return !errno && endptr == buf + len;
+}
 
-  /* validate strtol conversion, and ensure within range */
-  if (errno || (*endptr != '\0') || (int_val < INT32_MIN) ||
-      (int_val > INT32_MAX)) {
-    iot_log_info(sdk_ctx->lc, "invalid int32 of len %zu", len);
-    return NULL;
+/* Reads text, not null terminated, as a scalar of the type; false if invalid */
+static bool text_scalar(const char *text, size_t len, iot_data_type_t type,
+                        scalar_value *v) {
+  switch (type) {
+    case IOT_DATA_FLOAT64:
+    case IOT_DATA_FLOAT32:
+      return parse_float(text, len, type, v);
+
+    case IOT_DATA_BOOL:
+      if ((len == 4 && !memcmp(text, "true", 4)) ||
+          (len == 5 && !memcmp(text, "false", 5))) {
+        v->b = len == 4;
+        return true;
+      }
+      return false;
+
+    default: {
+      bool negative;
+      uint64_t magnitude;
+      return parse_int(text, len, &negative, &magnitude) &&
+             scalar_from_int(type, negative, magnitude, v);
+    }
   }
+}
 
-  return iot_data_alloc_i32((int32_t)int_val);
+/* Reads a number in place from the payload, without copying */
+static iot_data_t *read_number(const uint8_t *data, size_t len,
+                               const iot_typecode_t *type) {
+  coap_driver *sdk_ctx = (coap_driver *)impl;
+  scalar_value v;
+
+  if (!text_scalar((const char *)data, len, type->type, &v)) {
+    iot_log_info(sdk_ctx->lc, "invalid %s of len %zu",
+                 iot_data_type_string(type->type), len);
+    return NULL;
+  }
+  return scalar_alloc(type->type, &v);
 }
 
-/* Caller must free returned iot_data_t */
-iot_data_t *read_data_string(uint8_t *data, size_t len) {
+static iot_data_t *read_string(const uint8_t *data, size_t len,
+                               const iot_typecode_t *type) {
+  (void)type;
   /* must copy request data to append null terminator */
   char *str_data = malloc(len + 1);
   memcpy(str_data, data, len);
@@ -117,113 +636,282 @@ iot_data_t *read_data_string(uint8_t *data, size_t len) {
   return iot_data;
 }
 
-static size_t uri_decode(const char *src, const size_t len, char *dst) {
-  size_t i = 0, j = 0;
+static iot_data_t *take_string(uint8_t *data, size_t len,
+                               const iot_typecode_t *type) {
+  (void)len;
+  (void)type;
+  return iot_data_alloc_string((char *)data, IOT_DATA_TAKE);
+}
+
+static iot_data_t *read_binary(const uint8_t *data, size_t len,
+                               const iot_typecode_t *type) {
+  (void)type;
+  return iot_data_alloc_binary((void *)data, len, IOT_DATA_COPY);
+}
+
+static iot_data_t *take_binary(uint8_t *data, size_t len,
+                               const iot_typecode_t *type) {
+  (void)type;
+  return iot_data_alloc_binary(data, len, IOT_DATA_TAKE);
+}
+
+/* Parses a null-terminated JSON array of numbers or bools, like "[1, 2, 3]" */
+static iot_data_t *parse_array(const char *json, size_t len,
+                               const iot_typecode_t *type) {
   coap_driver *sdk_ctx = (coap_driver *)impl;
-  iot_log_debug(sdk_ctx->lc, "URI to decode = %s", src);
-  while (src[i] != '\0') {
-    int copy_char = 1;
-    if (src[i] == '%' && i + 2 < len) {
-      const unsigned char v1 = hexval[(unsigned char)src[i + 1]];
-      const unsigned char v2 = hexval[(unsigned char)src[i + 2]];
-
-      /* skip invalid hex sequences */
-      if ((v1 | v2) != 0xFF) {
-        dst[j] = (v1 << 4) | v2;
-        j++;
-        i += 3;
-        copy_char = 0;
+  size_t size = scalar_size(type->element_type);
+  iot_data_t *result = NULL;
+
+  iot_data_t *vector = iot_data_from_json(json);
+
+  if (size && vector && iot_data_type(vector) == IOT_DATA_VECTOR) {
+    uint32_t count = iot_data_vector_size(vector);
+    uint8_t *elements = malloc(count ? count * size : 1);
+    uint32_t i = 0;
+    for (; i < count; i++) {
+      const iot_data_t *elem = iot_data_vector_get(vector, i);
+      scalar_value src;
+      scalar_value v;
+      if (!scalar_load(elem, &src) ||
+          !scalar_convert(iot_data_type(elem), &src, type->element_type,
+                          &v)) {
+        break;
       }
+      memcpy(elements + i * size, &v, size);
+    }
+    if (i == count) {
+      result = iot_data_alloc_array(elements, count, type->element_type,
+                                    IOT_DATA_TAKE);
+    } else {
+      free(elements);
+    }
+  }
+  iot_data_free(vector);
+
+  if (result == NULL) {
+    iot_log_info(sdk_ctx->lc, "invalid %s array of len %zu",
+                 iot_data_type_string(type->element_type), len);
+  }
+  return result;
+}
+
+static iot_data_t *read_array(const uint8_t *data, size_t len,
+                              const iot_typecode_t *type) {
+  /* JSON parser requires a null terminated string */
+  char *json = malloc(len + 1);
+  memcpy(json, data, len);
+  json[len] = '\0';
+  iot_data_t *result = parse_array(json, len, type);
+  free(json);
+  return result;
+}
+
+static iot_data_t *take_array(uint8_t *data, size_t len,
+                              const iot_typecode_t *type) {
+  iot_data_t *result = parse_array((const char *)data, len, type);
+  free(data);
+  return result;
+}
+
+static uint8_t *write_number(const iot_data_t *value, size_t *len) {
+  scalar_value v;
+  char text[NUMBER_STR_MAXLEN + 1];
+
+  if (!scalar_load(value, &v) ||
+      !format_scalar(iot_data_type(value), &v, text, sizeof(text))) {
+    return NULL;
+  }
+  *len = strlen(text);
+  return (uint8_t *)strdup(text);
+}
+
+static uint8_t *write_string(const iot_data_t *value, size_t *len) {
+  *len = strlen(iot_data_string(value));
+  return (uint8_t *)strdup(iot_data_string(value));
+}
+
+static uint8_t *write_binary(const iot_data_t *value, size_t *len) {
+  uint32_t length = iot_data_array_length(value);
+  uint8_t *data = malloc(length ? length : 1);
+  iot_data_array_iter_t iter;
+  iot_data_array_iter(value, &iter);
+  for (uint32_t i = 0; iot_data_array_iter_next(&iter); i++) {
+    data[i] = *(const uint8_t *)iot_data_array_iter_value(&iter);
+  }
+  *len = length;
+  return data;
+}
+
+/* Writes a JSON array, like "[1,2,3]" */
+static uint8_t *write_array(const iot_data_t *value, size_t *len) {
+  iot_data_type_t type = iot_data_array_type(value);
+  size_t size = scalar_size(type);
+  if (size == 0) {
+    return NULL;
+  }
+  /* each element takes at most NUMBER_STR_MAXLEN plus a separator */
+  size_t bufsize = 2 + iot_data_array_length(value) * (NUMBER_STR_MAXLEN + 1);
+  char *buf = malloc(bufsize);
+  size_t pos = 0;
+  buf[pos++] = '[';
+
+  iot_data_array_iter_t iter;
+  iot_data_array_iter(value, &iter);
+  while (iot_data_array_iter_next(&iter)) {
+    scalar_value v;
+    memcpy(&v, iot_data_array_iter_value(&iter), size);
+    if (pos > 1) {
+      buf[pos++] = ',';
+    }
+    if (!format_scalar(type, &v, buf + pos, bufsize - pos)) {
+      free(buf);
+      return NULL;
+    }
+    pos += strlen(buf + pos);
+  }
+  buf[pos++] = ']';
+  *len = pos;
+  return (uint8_t *)buf;
+}
+
+/* One entry per supported value type */
+static const value_codec codecs[] = {
+    {IOT_DATA_INT8, read_number, write_number, {COAP_MEDIATYPE_TEXT_PLAIN}, 1},
+    {IOT_DATA_UINT8, read_number, write_number, {COAP_MEDIATYPE_TEXT_PLAIN}, 1},
+    {IOT_DATA_INT16, read_number, write_number, {COAP_MEDIATYPE_TEXT_PLAIN}, 1},
+    {IOT_DATA_UINT16, read_number, write_number, {COAP_MEDIATYPE_TEXT_PLAIN}, 1},
+    {IOT_DATA_INT32, read_number, write_number, {COAP_MEDIATYPE_TEXT_PLAIN}, 1},
+    {IOT_DATA_UINT32, read_number, write_number, {COAP_MEDIATYPE_TEXT_PLAIN}, 1},
+    {IOT_DATA_INT64, read_number, write_number, {COAP_MEDIATYPE_TEXT_PLAIN}, 1},
+    {IOT_DATA_UINT64, read_number, write_number, {COAP_MEDIATYPE_TEXT_PLAIN}, 1},
+    {IOT_DATA_FLOAT32, read_number, write_number, {COAP_MEDIATYPE_TEXT_PLAIN}, 1},
+    {IOT_DATA_FLOAT64, read_number, write_number, {COAP_MEDIATYPE_TEXT_PLAIN}, 1},
+    {IOT_DATA_BOOL, read_number, write_number, {COAP_MEDIATYPE_TEXT_PLAIN}, 1},
+    {IOT_DATA_STRING, read_string, write_string,
+     {COAP_MEDIATYPE_TEXT_PLAIN, COAP_MEDIATYPE_APPLICATION_JSON}, 2,
+     take_string},
+    {IOT_DATA_BINARY, read_binary, write_binary,
+     {COAP_MEDIATYPE_APPLICATION_OCTET_STREAM}, 1, take_binary},
+    {IOT_DATA_ARRAY, read_array, write_array,
+     {COAP_MEDIATYPE_APPLICATION_JSON}, 1, take_array},
+};
+
+const value_codec *codec_for_type(iot_data_type_t type) {
+  for (size_t i = 0; i < sizeof(codecs) / sizeof(codecs[0]); i++) {
+    if (codecs[i].type == type) {
+      return &codecs[i];
+    }
+  }
+  return NULL;
+}
+
+iot_data_t *codec_take(const value_codec *codec, uint8_t *data, size_t len,
+                       const iot_typecode_t *type) {
+  if (codec->take) {
+    return codec->take(data, len, type);
+  }
+  iot_data_t *result = codec->read(data, len, type);
+  free(data);
+  return result;
+}
+
+/*
+ * Encodes a value as CBOR, or with the codec for the value type. Caller must
+ * free result; NULL if the type is not supported.
+ */
+uint8_t *codec_encode(const iot_data_t *value, bool cbor, size_t *len,
+                      uint16_t *format) {
+  if (cbor) {
+    *len = cbor_write_value(value, NULL, 0);
+    if (*len == 0) {
+      return NULL;
     }
-    if (copy_char) {
-      dst[j] = src[i];
-      i++;
-      j++;
+    uint8_t *data = malloc(*len);
+    if (data) {
+      cbor_write_value(value, data, *len);
     }
+    *format = COAP_MEDIATYPE_APPLICATION_CBOR;
+    return data;
+  }
+  const value_codec *codec = codec_for_type(iot_data_type(value));
+  if (codec == NULL) {
+    return NULL;
   }
-  dst[j] = '\0';
-  iot_log_debug(sdk_ctx->lc, "URI is decoded as= %s", dst);
-  return j;
+  *format = codec->formats[0];
+  return codec->write(value, len);
+}
+
+/*
+ * Reads Uri-Path option values in place; they are not null-terminated.
+ *
+ * @param[in] request For path to read
+ * @param[out] segs Segment values
+ * @param[out] seg_lens Segment lengths
+ * @param[in] max_segs Size of segs and seg_lens
+ * @return number of segments, or max_segs + 1 if there are more
+ */
+int path_segments(coap_pdu_t *request, const char **segs, size_t *seg_lens,
+                  int max_segs) {
+  coap_opt_iterator_t it;
+  coap_opt_filter_t filter;
+  coap_opt_t *opt;
+  int nsegs = 0;
+
+  coap_option_filter_clear(filter);
+  coap_option_filter_set(filter, COAP_OPTION_URI_PATH);
+  coap_option_iterator_init(request, &it, filter);
+  while ((opt = coap_option_next(&it))) {
+    if (nsegs == max_segs) {
+      return max_segs + 1;
+    }
+    segs[nsegs] = (const char *)coap_opt_value(opt);
+    seg_lens[nsegs] = coap_opt_length(opt);
+    nsegs++;
+  }
+  return nsegs;
+}
+
+/* true if segment is the fixed first segment of resource paths */
+bool is_resource_seg1(const char *seg, size_t seg_len) {
+  return seg_len == strlen(RESOURCE_SEG1) &&
+         !memcmp(seg, RESOURCE_SEG1, seg_len);
 }
 
 /*
  * Parse URI path, expect 3 segments: /a1r/{device-name}/{resource-name}
  *
+ * Reads the Uri-Path options in place, and looks up the resource in the
+ * index, so no allocation is needed for a known resource.
+ *
  * @param[in] request For path to parse
- * @param[out] device Found device
- * @param[out] resource Found resource for device
+ * @param[out] desc_ptr Found resource descriptor; release with index_release()
  * @return true if URI format OK, and device and resource found
  */
-bool parse_path(coap_pdu_t *request, edgex_device **device_ptr,
-                edgex_deviceresource **resource_ptr) {
+bool parse_path(coap_pdu_t *request, resource_desc **desc_ptr) {
   coap_driver *sdk_ctx = (coap_driver *)impl;
-  coap_string_t *uri_path = coap_get_uri_path(request);
-  iot_log_debug(sdk_ctx->lc, "URI %s", uri_path->s);
-  char path_tmp[32] = {0};
-  char path[32] = {0};
-  strcpy(path_tmp, (char *)uri_path->s);
-  iot_log_debug(sdk_ctx->lc, "URI %s", uri_path->s);
-  edgex_device *device = NULL;
-  edgex_deviceprofile *profile = NULL;
-  edgex_deviceresource *resource = NULL;
-  uri_decode(path_tmp, 16, path);
-  iot_log_debug(sdk_ctx->lc, "Parse decoded URI %s", path);
-  char *seg = strtok(path, "/");
-  bool res = false;
-  for (int i = 0; i < 3; i++) {
-    if (!seg) {
-      iot_log_info(sdk_ctx->lc, "missing URI segment %u", i);
-      break;
-    }
-
-    switch (i) {
-      case 0:
-        if (strcmp(seg, RESOURCE_SEG1)) {
-          iot_log_info(sdk_ctx->lc, "invalid URI; segment %u", i);
-          goto end_for;
-        }
-        break;
-      case 1:
-        if (!(device = edgex_get_device_byname(sdk_ctx->service, seg))) {
-          iot_log_info(sdk_ctx->lc, "device not found: %s", seg);
-          goto end_for;
-        }
-        profile = device->profile;
-        break;
-      case 2:
-        for (; profile; profile = profile->next) {
-          resource = profile->device_resources;
-          for (; resource; resource = resource->next) {
-            if (!strcmp(resource->name, seg)) {
-              break;
-            }
-          }
-        }
-        if (!resource) {
-          iot_log_info(sdk_ctx->lc, "resource not found: %s", seg);
-          goto end_for;
-        }
-        res = true;
-        break;
-    }
-    seg = strtok(NULL, "/");
-  }
+  const char *seg[3];
+  size_t seg_len[3];
 
-end_for:
-  if (res && seg) {
+  int nsegs = path_segments(request, seg, seg_len, 3);
+  if (nsegs > 3) {
     iot_log_info(sdk_ctx->lc, "extra URI segment");
-    res = false;
+    return false;
+  }
+  if (nsegs < 3) {
+    iot_log_info(sdk_ctx->lc, "missing URI segment %d", nsegs);
+    return false;
+  }
+  if (!is_resource_seg1(seg[0], seg_len[0])) {
+    iot_log_info(sdk_ctx->lc, "invalid URI; segment 0");
+    return false;
   }
-  coap_delete_string(uri_path);
 
-  if (res) {
-    *device_ptr = device;
-    *resource_ptr = resource;
-  } else {
-    if (device != NULL) {
-      edgex_free_device(sdk_ctx->service, device);
-    }
+  resource_desc *desc = index_lookup(seg[1], seg_len[1], seg[2], seg_len[2]);
+  if (desc == NULL) {
+    iot_log_info(sdk_ctx->lc, "resource not found: %.*s/%.*s", (int)seg_len[1],
+                 seg[1], (int)seg_len[2], seg[2]);
+    return false;
   }
-  return res;
+  *desc_ptr = desc;
+  return true;
 }
-
@@ -18,43 +18,91 @@
 #include <devsdk/devsdk.h>
 #include <edgex/devices.h>
 #include <stdint.h>
+
+#include "coap-index.h"
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 #define RESOURCE_SEG1 "a1r"
-/* Maximum length of a string containing numeric values. */
-#define FLOAT64_STR_MAXLEN 24
-#define INT32_STR_MAXLEN 11
-
-// to decode coap encoded uri in coap client message handler
-#define __ 0xFF
-static const unsigned char hexval[0x100] = {
-    __, __, __, __, __, __, __, __, __, __, __, __, __, __, __, __, /* 00-0F */
-    __, __, __, __, __, __, __, __, __, __, __, __, __, __, __, __, /* 00-0F */
-    __, __, __, __, __, __, __, __, __, __, __, __, __, __, __, __, /* 00-0F */
-    0,  1,  2,  3,  4,  5,  6,  7,  8,  9,  __, __, __, __, __, __, /* 30-3F */
-    __, 10, 11, 12, 13, 14, 15, __, __, __, __, __, __, __, __, __, /* 40-4F */
-    __, __, __, __, __, __, __, __, __, __, __, __, __, __, __, __, /* 00-0F */
-    __, 10, 11, 12, 13, 14, 15, __, __, __, __, __, __, __, __, __, /* 60-6F */
-    __, __, __, __, __, __, __, __, __, __, __, __, __, __, __, __, /* 00-0F */
-    __, __, __, __, __, __, __, __, __, __, __, __, __, __, __, __, /* 00-0F */
-    __, __, __, __, __, __, __, __, __, __, __, __, __, __, __, __, /* 00-0F */
-    __, __, __, __, __, __, __, __, __, __, __, __, __, __, __, __, /* 00-0F */
-    __, __, __, __, __, __, __, __, __, __, __, __, __, __, __, __, /* 00-0F */
-    __, __, __, __, __, __, __, __, __, __, __, __, __, __, __, __, /* 00-0F */
-    __, __, __, __, __, __, __, __, __, __, __, __, __, __, __, __, /* 00-0F */
-    __, __, __, __, __, __, __, __, __, __, __, __, __, __, __, __, /* 00-0F */
-    __, __, __, __, __, __, __, __, __, __, __, __, __, __, __, __, /* 00-0F */
-};
+
+/** FNV-1a offset basis; the hash of no bytes, to start fnv1a() from */
+#define FNV1A_INIT 2166136261u
+
+/*
+ * True if debug messages are logged, so a caller can skip building their
+ * arguments. Reads the level each time, as it may be changed at runtime.
+ */
+#define LOG_DEBUG_ENABLED(lc) ((lc) && (lc)->level >= IOT_LOG_DEBUG)
+/* Maximum length of a string containing a numeric value. */
+#define NUMBER_STR_MAXLEN 24
+
+/** Storage for a numeric or bool value */
+typedef union {
+  int8_t i8;
+  uint8_t ui8;
+  int16_t i16;
+  uint16_t ui16;
+  int32_t i32;
+  uint32_t ui32;
+  int64_t i64;
+  uint64_t ui64;
+  float f32;
+  double f64;
+  bool b;
+} scalar_value;
+
+/**
+ * Reads and writes payloads of a value type, as text or other non-CBOR
+ * formats. Selected once per resource, by codec_for_type().
+ */
+typedef struct value_codec {
+  iot_data_type_t type;
+  /** Reads a value; caller must free result. NULL if not valid. */
+  iot_data_t *(*read)(const uint8_t *data, size_t len,
+                      const iot_typecode_t *type);
+  /** Writes a value; caller must free result. NULL if not supported. */
+  uint8_t *(*write)(const iot_data_t *value, size_t *len);
+  uint16_t formats[2];  /**< content formats read; first is written */
+  uint8_t nformats;
+  /**
+   * Optional; reads a value from an allocated, null-terminated buffer and
+   * takes ownership of it, to avoid copying a large payload.
+   */
+  iot_data_t *(*take)(uint8_t *data, size_t len, const iot_typecode_t *type);
+} value_codec;
 
 extern int resolve_address(const char *host, const char *service,
                            coap_address_t *lib_addr);
-extern iot_data_t *read_data_float64(uint8_t *data, size_t len);
-extern iot_data_t *read_data_int32(uint8_t *data, size_t len);
-extern iot_data_t *read_data_string(uint8_t *data, size_t len);
-extern bool parse_path(coap_pdu_t *request, edgex_device **device_ptr,
-                       edgex_deviceresource **resource_ptr);
+extern void address_set_port(coap_address_t *addr, uint16_t port);
+extern uint64_t monotonic_msecs(void);
+extern uint64_t monotonic_usecs(void);
+extern uint32_t fnv1a(uint32_t hash, const void *data, size_t len);
+extern void random_token(uint8_t *token, size_t len);
+extern void trace_pdu(const char *what, const coap_pdu_t *pdu);
+extern uint32_t config_get_uint(const iot_data_t *config, const char *key,
+                                uint32_t default_val);
+extern coap_fixed_point_t config_get_fixed(const iot_data_t *config,
+                                           const char *key,
+                                           coap_fixed_point_t default_val);
+extern const value_codec *codec_for_type(iot_data_type_t type);
+extern uint8_t *codec_encode(const iot_data_t *value, bool cbor, size_t *len,
+                             uint16_t *format);
+extern iot_data_t *codec_take(const value_codec *codec, uint8_t *data,
+                              size_t len, const iot_typecode_t *type);
+extern size_t scalar_size(iot_data_type_t type);
+extern iot_data_t *scalar_alloc(iot_data_type_t type, const scalar_value *v);
+extern bool scalar_load(const iot_data_t *value, scalar_value *v);
+extern bool scalar_from_int(iot_data_type_t type, bool negative,
+                            uint64_t magnitude, scalar_value *v);
+extern bool scalar_convert(iot_data_type_t src_type, const scalar_value *src,
+                           iot_data_type_t type, scalar_value *v);
+extern bool format_scalar(iot_data_type_t type, const scalar_value *v,
+                          char *buf, size_t size);
+extern int path_segments(coap_pdu_t *request, const char **segs,
+                         size_t *seg_lens, int max_segs);
+extern bool is_resource_seg1(const char *seg, size_t seg_len);
+extern bool parse_path(coap_pdu_t *request, resource_desc **desc_ptr);
 #ifdef __cplusplus
 }
 #endif
@@ -9,10 +9,22 @@
 
 #include "device-coap.h"
 
+#include <pthread.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <unistd.h>
 
+#include "coap-batch.h"
+#include "coap-block.h"
+#include "coap-cache.h"
 #include "coap-client.h"
+#include "coap-discover.h"
+#include "coap-health.h"
+#include "coap-index.h"
+#include "coap-pool.h"
+#include "coap-psk.h"
+#include "coap-publish.h"
+#include "coap-resolve.h"
 #include "coap-server.h"
 #include "coap-util.h"
 #include "devsdk/devsdk.h"
@@ -27,9 +39,32 @@
 #define COAP_BIND_ADDR_KEY "CoapBindAddr"
 #define SECURITY_MODE_KEY "SecurityMode"
 #define PSK_KEY_KEY "PskKey"
+#define SESSION_MAX_KEY "ClientSessionMax"
+#define SESSION_IDLE_KEY "ClientSessionIdleTimeout"
+#define HANDSHAKE_MAX_KEY "ClientHandshakeMax"
+#define RESOLVE_TTL_KEY "ClientResolveTTL"
+#define FAILURE_THRESHOLD_KEY "DeviceFailureThreshold"
+#define PUBLISH_THREADS_KEY "PublisherThreads"
+#define PUBLISH_QUEUE_KEY "PublishQueueSize"
+#define BUSY_MAX_AGE_KEY "BusyMaxAge"
+#define COALESCE_WINDOW_KEY "CoalesceWindow"
+#define COALESCE_MAX_KEY "CoalesceMaxReadings"
+#define STRING_REFS_KEY "ReferenceStringPayloads"
+#define BLOCK_MAX_BODY_KEY "BlockMaxBody"
+#define BLOCK_MAX_PEER_KEY "BlockMaxPerPeer"
+#define TRACE_PDUS_KEY "TracePdus"
+#define SERVE_METRICS_KEY "ServeMetrics"
+#define SERVE_VALUES_KEY "ServeLastValues"
+#define SERVER_SHARDS_KEY "ServerShards"
+#define SERVER_BATCH_SIZE_KEY "ServerBatchSize"
+#define DISCOVERY_SUBNETS_KEY "DiscoverySubnets"
+#define DISCOVERY_GROUPS_KEY "DiscoveryGroups"
+#define DISCOVERY_MAX_INFLIGHT_KEY "DiscoveryMaxInFlight"
+#define DISCOVERY_TIMEOUT_KEY "DiscoveryTimeout"
+/* Resource attribute to observe the resource rather than poll it */
+#define OBSERVE_ATTR "observe"
 
 coap_driver *impl;
-extern iot_data_t *coap_resp_data;
 
 /* Looks up security mode enum value from configuration text value */
 coap_security_mode_t find_security_mode(const char *mode_text) {
@@ -43,6 +78,137 @@ coap_security_mode_t find_security_mode(const char *mode_text) {
   }
 }
 
+/* Returns true if the resource attributes ask to observe the resource */
+static bool is_observed(const iot_data_t *attributes) {
+  const iot_data_t *attr =
+      attributes ? iot_data_string_map_get(attributes, OBSERVE_ATTR) : NULL;
+  if (attr == NULL) {
+    return false;
+  }
+  if (iot_data_type(attr) == IOT_DATA_BOOL) {
+    return iot_data_bool(attr);
+  }
+  return iot_data_type(attr) == IOT_DATA_STRING &&
+         !strcmp(iot_data_string(attr), "true");
+}
+
+/*
+ * Replaces any observations of a device with observations of its resources
+ * that have the observe attribute. Devices that are locked are not observed.
+ */
+static void observe_device(coap_driver *driver, const edgex_device *device) {
+  CoapObserveCancel(device->name);
+  if (device->adminState == LOCKED) {
+    return;
+  }
+
+  end_dev_params params;
+  iot_data_t *exception = NULL;
+  bool have_params = false;
+  for (edgex_deviceprofile *profile = device->profile; profile;
+       profile = profile->next) {
+    for (edgex_deviceresource *res = profile->device_resources; res;
+         res = res->next) {
+      if (!is_observed(res->attributes)) {
+        continue;
+      }
+      if (!have_params) {
+        memset(&params, 0, sizeof(params));
+        if (!GetEndDeviceProtocolProperties(device->protocols, "COAP",
+                                            &exception, &params, driver)) {
+          iot_log_error(driver->lc, "COAP: cannot observe device %s",
+                        device->name);
+          iot_data_free(exception);
+          return;
+        }
+        have_params = true;
+      }
+      iot_log_debug(driver->lc, "COAP: observing %s/%s", device->name,
+                    res->name);
+      CoapObserveResource(device->name, res->name, &res->properties->type,
+                          &params);
+    }
+  }
+}
+
+/* Observes resources of the named device, as for observe_device() */
+static void observe_device_byname(coap_driver *driver, const char *devname) {
+  edgex_device *device = edgex_get_device_byname(driver->service, devname);
+  if (device) {
+    observe_device(driver, device);
+    edgex_free_device(driver->service, device);
+  } else {
+    CoapObserveCancel(devname);
+  }
+}
+
+/* COAP protocol properties and admin state of a device, as last seen */
+typedef struct device_seen {
+  char *name;
+  end_dev_params params;
+  bool params_valid;   /**< false if the properties did not parse */
+  bool enabled;
+  struct device_seen *next;
+} device_seen;
+
+static struct {
+  pthread_mutex_t mutex;
+  device_seen *head;
+} seen = {PTHREAD_MUTEX_INITIALIZER, NULL};
+
+/*
+ * Records the protocol properties and admin state of a device. Returns true
+ * if they differ from those last seen, or the device was not seen before.
+ * The SDK reports any update this way, including a change of operating
+ * state, which does not affect how the device is reached.
+ */
+static bool device_changed(coap_driver *driver, const char *devname,
+                           const devsdk_protocols *protocols, bool enabled) {
+  end_dev_params params;
+  iot_data_t *exception = NULL;
+  memset(&params, 0, sizeof(params));
+  bool valid = GetEndDeviceProtocolProperties(protocols, "COAP", &exception,
+                                              &params, driver);
+  iot_data_free(exception);
+
+  pthread_mutex_lock(&seen.mutex);
+  device_seen *dev = seen.head;
+  while (dev && strcmp(dev->name, devname)) {
+    dev = dev->next;
+  }
+  bool changed = dev == NULL || dev->enabled != enabled ||
+                 dev->params_valid != valid ||
+                 (valid && !EndDeviceParamsEqual(&dev->params, &params));
+  if (dev == NULL) {
+    dev = calloc(1, sizeof(*dev));
+    dev->name = strdup(devname);
+    dev->next = seen.head;
+    seen.head = dev;
+  }
+  dev->params = params;
+  dev->params_valid = valid;
+  dev->enabled = enabled;
+  pthread_mutex_unlock(&seen.mutex);
+  return changed;
+}
+
+/* Drops what was seen of a device, or of all devices if devname is NULL */
+static void device_forget(const char *devname) {
+  pthread_mutex_lock(&seen.mutex);
+  device_seen **link = &seen.head;
+  while (*link) {
+    device_seen *dev = *link;
+    if (devname == NULL || !strcmp(dev->name, devname)) {
+      *link = dev->next;
+      free(dev->name);
+      free(dev);
+    } else {
+      link = &dev->next;
+    }
+  }
+  pthread_mutex_unlock(&seen.mutex);
+}
+
 /* Init callback; reads in config values to device driver */
 static bool coap_init(void *impl, struct iot_logger_t *lc,
                       const iot_data_t *config) {
@@ -50,7 +216,6 @@ static bool coap_init(void *impl, struct iot_logger_t *lc,
   bool result = true;
 
   driver->lc = lc;
-  pthread_mutex_init(&driver->mutex, NULL);
   driver->security_mode = find_security_mode(
       iot_data_string_map_get_string(config, SECURITY_MODE_KEY));
 
@@ -70,14 +235,18 @@ static bool coap_init(void *impl, struct iot_logger_t *lc,
       if (!conf_psk_key) {
           conf_psk_key = iot_data_string_map_get_string(config, PSK_KEY_KEY);
       }
-      if (strlen(conf_psk_key)) {
+      /* shared key is for devices without their own identity */
+      uint32_t identities = psk_store_load(driver);
+      if (conf_psk_key && strlen(conf_psk_key)) {
         iot_data_t *key_array = iot_data_alloc_array_from_base64(conf_psk_key);
         driver->psk_key = key_array;
         iot_log_info(lc, "PSK key len %u", iot_data_array_length(key_array));
       } else {
-        iot_log_error(lc, "PSK key not in configuration");
         driver->psk_key = NULL;
-        result = false;
+        if (identities == 0) {
+          iot_log_error(lc, "PSK key not in configuration");
+          result = false;
+        }
       }
       iot_data_free (secrets);
       break;
@@ -100,10 +269,118 @@ static bool coap_init(void *impl, struct iot_logger_t *lc,
     result = false;
   }
 
+  /* Pooled client sessions to end devices */
+  driver->session_max =
+      config_get_uint(config, SESSION_MAX_KEY, POOL_DEFAULT_MAX_SESSIONS);
+  driver->session_idle_secs =
+      config_get_uint(config, SESSION_IDLE_KEY, POOL_DEFAULT_IDLE_SECS);
+  driver->handshake_max = config_get_uint(config, HANDSHAKE_MAX_KEY,
+                                          POOL_DEFAULT_MAX_HANDSHAKES);
+  driver->resolve_ttl_secs =
+      config_get_uint(config, RESOLVE_TTL_KEY, RESOLVE_DEFAULT_TTL_SECS);
+  driver->failure_threshold = config_get_uint(
+      config, FAILURE_THRESHOLD_KEY, HEALTH_DEFAULT_FAILURE_THRESHOLD);
+  /* Publication of readings received by the server */
+  driver->publish_threads =
+      config_get_uint(config, PUBLISH_THREADS_KEY, PUBLISH_DEFAULT_THREADS);
+  driver->publish_queue_size =
+      config_get_uint(config, PUBLISH_QUEUE_KEY, PUBLISH_DEFAULT_QUEUE_SIZE);
+  driver->busy_max_age =
+      config_get_uint(config, BUSY_MAX_AGE_KEY, PUBLISH_DEFAULT_BUSY_MAX_AGE);
+  driver->coalesce_window = config_get_uint(config, COALESCE_WINDOW_KEY,
+                                            PUBLISH_DEFAULT_COALESCE_WINDOW);
+  driver->coalesce_max_readings =
+      config_get_uint(config, COALESCE_MAX_KEY, PUBLISH_DEFAULT_COALESCE_MAX);
+  const char *string_refs =
+      iot_data_string_map_get_string(config, STRING_REFS_KEY);
+  driver->string_refs = string_refs && !strcmp(string_refs, "true");
+  /* Reassembly of payloads transferred in blocks */
+  driver->block_max_body =
+      config_get_uint(config, BLOCK_MAX_BODY_KEY, BLOCK_DEFAULT_MAX_BODY);
+  driver->block_max_peer =
+      config_get_uint(config, BLOCK_MAX_PEER_KEY, BLOCK_DEFAULT_MAX_PEER);
+  driver->trace_pdus = config_get_uint(config, TRACE_PDUS_KEY, 0);
+  const char *serve_metrics =
+      iot_data_string_map_get_string(config, SERVE_METRICS_KEY);
+  driver->serve_metrics = serve_metrics && !strcmp(serve_metrics, "true");
+  const char *serve_values =
+      iot_data_string_map_get_string(config, SERVE_VALUES_KEY);
+  driver->serve_values = serve_values && !strcmp(serve_values, "true");
+  driver->server_shards = config_get_uint(config, SERVER_SHARDS_KEY, 1);
+  driver->server_batch_size = config_get_uint(config, SERVER_BATCH_SIZE_KEY, 0);
+  if (driver->server_batch_size > BATCH_SIZE_MAX) {
+    driver->server_batch_size = BATCH_SIZE_MAX;
+  }
+  /* Discovery of end devices from /.well-known/core */
+  const char *subnets =
+      iot_data_string_map_get_string(config, DISCOVERY_SUBNETS_KEY);
+  driver->discovery_subnets =
+      subnets ? iot_data_alloc_string(subnets, IOT_DATA_COPY) : NULL;
+  const char *groups =
+      iot_data_string_map_get_string(config, DISCOVERY_GROUPS_KEY);
+  driver->discovery_groups =
+      groups ? iot_data_alloc_string(groups, IOT_DATA_COPY) : NULL;
+  driver->discovery_max_inflight = config_get_uint(
+      config, DISCOVERY_MAX_INFLIGHT_KEY, DISCOVERY_DEFAULT_MAX_INFLIGHT);
+  driver->discovery_timeout_msecs = config_get_uint(
+      config, DISCOVERY_TIMEOUT_KEY, DISCOVERY_DEFAULT_TIMEOUT_MSECS);
+
+  index_init(driver);
+  cache_init(driver);
+
+  /* started before the client, which posts notifications through it */
+  if (!publish_start(driver)) {
+    result = false;
+  }
+
+  if (!resolve_start(driver)) {
+    result = false;
+  }
+
+  if (!CoapClientInit(driver) || !health_start(driver)) {
+    result = false;
+  } else {
+    edgex_device *devices = edgex_devices(driver->service);
+    for (edgex_device *device = devices; device; device = device->next) {
+      device_changed(driver, device->name, device->protocols,
+                     device->adminState != LOCKED);
+      observe_device(driver, device);
+    }
+    edgex_free_device(driver->service, devices);
+  }
+
   iot_log_debug(lc, "Init complete");
   return result;
 }
 
+/*
+ * Posts the readings that succeeded from a read where others failed, since
+ * the SDK posts none from a failed read. Each is posted as its own event.
+ */
+static void post_partial_readings(coap_driver *driver,
+                                  const devsdk_device_t *device,
+                                  uint32_t nreadings,
+                                  const devsdk_commandrequest *requests,
+                                  devsdk_commandresult *readings) {
+  for (uint32_t i = 0; i < nreadings; i++) {
+    if (readings[i].value == NULL) {
+      continue;
+    }
+    const char *resource = requests[i].resource->name;
+    resource_desc *desc = index_lookup(device->name, strlen(device->name),
+                                       resource, strlen(resource));
+    if (desc && publish_reading(desc, readings[i].value)) {
+      readings[i].value = NULL;
+    } else {
+      iot_log_warn(driver->lc, "COAP:cannot post partial reading for %s/%s",
+                   device->name, resource);
+    }
+    if (desc) {
+      index_release(desc);
+    }
+  }
+}
+
 static bool coap_get_handler(void *impl, const devsdk_device_t *device,
                              uint32_t nreadings,
                              const devsdk_commandrequest *requests,
@@ -112,43 +389,36 @@ static bool coap_get_handler(void *impl, const devsdk_device_t *device,
                              const iot_data_t *options,
                              iot_data_t **exception) {
   coap_driver *driver = (coap_driver *)impl;
-  pthread_mutex_lock(&driver->mutex);
-  bool successful_get_request = true;
-  int ret = EXIT_FAILURE;
   uint32_t i = 0;
   if (device == NULL) {
     iot_log_error(driver->lc, "COAP:Device is empty");
-    return successful_get_request;
+    return true;
   }
   end_dev_params *end_dev_params_ptr = (end_dev_params *)device->address;
   iot_log_debug(driver->lc, "COAP:Triggering Get events nreadings=%d\n",
                 nreadings);
   /* The following requests and reading parameters are arrays of size nreadings
    */
-  for (i = 0; i < nreadings; i++) {
+  for (i = 0; LOG_DEBUG_ENABLED(driver->lc) && i < nreadings; i++) {
     iot_log_debug(driver->lc, "COAP:Triggering Get events resource name=%s\n",
                   requests[i].resource->name);
     iot_log_debug(driver->lc, "COAP:Triggering Get events req type=%s",
                   iot_data_type_string (requests[i].resource->type.type));
-    ret = CoapGetRequestToEndDevice(device->name, requests[i].resource->name,
-                                    end_dev_params_ptr, driver);
-    if (ret == EXIT_FAILURE) {
-      iot_log_error(driver->lc,
-                    "COAP:Triggering Get events failed with ret=%d\n", ret);
-      successful_get_request = false;
-    } else {
-      if (coap_resp_data != NULL) {
-        readings[i].origin = 0;
-        readings[i].value = coap_resp_data;
-        iot_log_debug(driver->lc,
-                      "COAP:Triggering Get events success with ret=%d\n", ret);
-      } else {
-        successful_get_request = false;
-      }
-    }
   }
-  pthread_mutex_unlock(&driver->mutex);
-  return successful_get_request;
+  /* Sent as one batch so the reads overlap rather than run one by one */
+  uint32_t successes = CoapGetRequestsToEndDevice(
+      device->name, nreadings, requests, end_dev_params_ptr, driver, readings);
+  iot_log_debug(driver->lc, "COAP:Triggering Get events %u of %u succeeded",
+                successes, nreadings);
+  if (successes == nreadings) {
+    return true;
+  }
+  if (successes) {
+    post_partial_readings(driver, device, nreadings, requests, readings);
+  }
+  *exception = iot_data_alloc_string("read from end device failed or timed out",
+                                     IOT_DATA_REF);
+  return false;
 }
 
 static bool coap_put_handler(void *impl, const devsdk_device_t *device,
@@ -157,76 +427,100 @@ static bool coap_put_handler(void *impl, const devsdk_device_t *device,
                              const iot_data_t *values[],
                              const iot_data_t *options,
                              iot_data_t **exception) {
-  (void)requests;
-
   coap_driver *driver = (coap_driver *)impl;
-  pthread_mutex_lock(&driver->mutex);
-  int len = 0;
-  int ret = EXIT_SUCCESS;
-  bool successful_get_request = true;
-  char coap_put_data[FLOAT64_STR_MAXLEN + 1] = {0};
-  char *coap_str_data = NULL;
   end_dev_params *end_dev_params_ptr = (end_dev_params *)device->address;
   iot_log_debug(driver->lc, "COAP:PUT on device:");
   iot_log_debug(driver->lc, "COAP: nvalues = %d", nvalues);
 
   for (uint32_t i = 0; i < nvalues; i++) {
-    memset(coap_put_data, 0, FLOAT64_STR_MAXLEN + 1);
-    switch (iot_data_type(values[i])) {
-      case IOT_DATA_STRING: {
-        coap_str_data = malloc(strlen(iot_data_string(values[i])) + 1);
-        iot_log_debug(driver->lc, "  Value: %s", iot_data_string(values[i]));
-        memcpy(coap_str_data, iot_data_string(values[i]),
-               strlen(iot_data_string(values[i])) + 1);
-        len = strlen(coap_str_data);
-        break;
-      }
-      case IOT_DATA_INT32: {
-        iot_log_debug(driver->lc, "  Value: %d", iot_data_i32(values[i]));
-        sprintf(coap_put_data, "%d", iot_data_i32(values[i]));
-        len = strlen(coap_put_data);
-        break;
-      }
-      case IOT_DATA_FLOAT64: {
-        iot_log_debug(driver->lc, "  Value: %0.6f", iot_data_f64(values[i]));
-        sprintf(coap_put_data, "%0.6f", iot_data_f64(values[i]));
-        len = strlen(coap_put_data);
-        break;
-      }
-        /* etc etc */
-      default:
-        iot_log_debug(driver->lc, "  Value has unexpected type %s: %s",
-                      iot_data_type_name(values[i]),
-                      iot_data_to_json(values[i]));
-        ret = EXIT_FAILURE;
-    }
-    if (ret == EXIT_FAILURE) {
+    size_t len = 0;
+    uint16_t format = 0;
+    uint8_t *data =
+        codec_encode(values[i], end_dev_params_ptr->cbor, &len, &format);
+    if (data == NULL) {
+      iot_log_error(driver->lc, "  Value has unexpected type %s",
+                    iot_data_type_name(values[i]));
       return false;
     }
-
-    if (iot_data_type(values[i]) == IOT_DATA_STRING) {
-      ret = CoapSendCommandToEndDevice((uint8_t *)coap_str_data, len,
-                                       device->name, requests[i].resource->name,
-                                       end_dev_params_ptr, driver);
-      free(coap_str_data);
-    } else {
-      ret = CoapSendCommandToEndDevice((uint8_t *)coap_put_data, len,
-                                       device->name, requests[i].resource->name,
-                                       end_dev_params_ptr, driver);
+    if (LOG_DEBUG_ENABLED(driver->lc)) {
+      iot_log_debug(driver->lc, "  Value: %s type, len %zu",
+                    iot_data_type_name(values[i]), len);
     }
-    if (ret == -1) {
+
+    int ret = CoapSendCommandToEndDevice(data, len, format, device->name,
+                                         requests[i].resource->name,
+                                         end_dev_params_ptr, driver);
+    free(data);
+    if (ret == EXIT_FAILURE) {
       iot_log_error(driver->lc, "Sending data to End Device fails=%d\n", ret);
       return false;
     }
-    successful_get_request = true;
   }
-  pthread_mutex_unlock(&driver->mutex);
-  return successful_get_request;
+  return true;
 }
 
 static void coap_stop(void *impl, bool force) {
+  (void)impl;
+  discover_cancel();
+  /* stopped first, as it may be waiting on a probe */
+  health_stop();
+  CoapClientFree();
+  resolve_stop();
+  publish_stop();
+  index_free();
+  psk_store_free();
+  device_forget(NULL);
+}
+
+/* Discovery callback; proposes the end devices found to the SDK */
+static void coap_discover(void *impl) {
+  discover_devices((coap_driver *)impl);
+}
+
+/* Reconfiguration callback; reloads per-device PSKs from the secret store */
+static void coap_reconfigure(void *impl, const iot_data_t *config) {
   coap_driver *driver = (coap_driver *)impl;
-  pthread_mutex_destroy(&driver->mutex);
+  (void)config;
+  if (driver->security_mode == SECURITY_MODE_PSK) {
+    psk_store_load(driver);
+  }
+}
+
+/*
+ * Device listeners; cached resource lookups are reloaded on next use, and
+ * observations are renewed
+ */
+static void coap_device_added(void *impl, const char *devname,
+                              const devsdk_protocols *protocols,
+                              const devsdk_device_resources *resources,
+                              bool adminEnabled) {
+  index_invalidate(devname);
+  device_changed((coap_driver *)impl, devname, protocols, adminEnabled);
+  observe_device_byname((coap_driver *)impl, devname);
+}
+
+/*
+ * Health and observations are renewed only if the device is reached
+ * differently, or locked or unlocked. The SDK also calls this when the
+ * operating state reported by the health monitor changes, which must not
+ * reset it.
+ */
+static void coap_device_updated(void *impl, const char *devname,
+                                const devsdk_protocols *protocols,
+                                bool adminEnabled) {
+  index_invalidate(devname);
+  if (device_changed((coap_driver *)impl, devname, protocols, adminEnabled)) {
+    health_forget(devname, false);
+    observe_device_byname((coap_driver *)impl, devname);
+  }
+}
+
+static void coap_device_removed(void *impl, const char *devname,
+                                const devsdk_protocols *protocols) {
+  index_forget(devname);
+  health_forget(devname, true);
+  device_forget(devname);
+  CoapObserveCancel(devname);
 }
 
 static devsdk_address_t coap_create_address(void *impl,
@@ -235,12 +529,20 @@ static devsdk_address_t coap_create_address(void *impl,
   bool res = false;
   coap_driver *driver = (coap_driver *)impl;
   end_dev_params *end_dev_params_ptr =
-      (end_dev_params *)malloc(sizeof(end_dev_params));
+      (end_dev_params *)calloc(1, sizeof(end_dev_params));
   if (end_dev_params_ptr != NULL) {
     res = GetEndDeviceProtocolProperties(
         protocols, "COAP", exception, end_dev_params_ptr, (coap_driver *)impl);
     if (res == false) {
       iot_log_error(driver->lc, "COAP: protocol property for device is null");
+    } else {
+      /* resolved once here; the client refreshes it without blocking */
+      end_dev_params_ptr->addr_resolved = resolve_host(
+          end_dev_params_ptr->end_dev_addr, &end_dev_params_ptr->addr);
+      if (!end_dev_params_ptr->addr_resolved) {
+        iot_log_warn(driver->lc, "COAP: cannot resolve device address %s yet",
+                     end_dev_params_ptr->end_dev_addr);
+      }
     }
   }
   return (devsdk_address_t)end_dev_params_ptr;
@@ -263,6 +565,17 @@ static devsdk_resource_attr_t coap_create_resource_attr(
 static void coap_free_resource_attr(void *impl, devsdk_resource_attr_t attr) {}
 
 int main(int argc, char *argv[]) {
+  /*
+   * Only the thread running the CoAP server takes SIGINT and SIGTERM; the
+   * threads the SDK and driver start inherit this mask. run_server()
+   * unblocks them again.
+   */
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
   impl = malloc(sizeof(coap_driver));
   memset(impl, 0, sizeof(coap_driver));
 
@@ -274,6 +587,10 @@ int main(int argc, char *argv[]) {
       devsdk_callbacks_init(coap_init, coap_get_handler, coap_put_handler,
                             coap_stop, coap_create_address, coap_free_address,
                             coap_create_resource_attr, coap_free_resource_attr);
+  devsdk_callbacks_set_listeners(coapImpls, coap_device_added,
+                                 coap_device_updated, coap_device_removed);
+  devsdk_callbacks_set_reconfiguration(coapImpls, coap_reconfigure);
+  devsdk_callbacks_set_discovery(coapImpls, coap_discover, NULL);
 
   /* Initialize a new device service */
   devsdk_service_t *service = devsdk_service_new("device-coap", VERSION, impl,
@@ -302,6 +619,50 @@ int main(int argc, char *argv[]) {
                           iot_data_alloc_string("NoSec", IOT_DATA_REF));
   iot_data_string_map_add(driver_map, PSK_KEY_KEY,
                           iot_data_alloc_string("", IOT_DATA_REF));
+  iot_data_string_map_add(driver_map, SESSION_MAX_KEY,
+                          iot_data_alloc_string("64", IOT_DATA_REF));
+  iot_data_string_map_add(driver_map, SESSION_IDLE_KEY,
+                          iot_data_alloc_string("300", IOT_DATA_REF));
+  iot_data_string_map_add(driver_map, HANDSHAKE_MAX_KEY,
+                          iot_data_alloc_string("8", IOT_DATA_REF));
+  iot_data_string_map_add(driver_map, RESOLVE_TTL_KEY,
+                          iot_data_alloc_string("300", IOT_DATA_REF));
+  iot_data_string_map_add(driver_map, FAILURE_THRESHOLD_KEY,
+                          iot_data_alloc_string("3", IOT_DATA_REF));
+  iot_data_string_map_add(driver_map, PUBLISH_THREADS_KEY,
+                          iot_data_alloc_string("2", IOT_DATA_REF));
+  iot_data_string_map_add(driver_map, PUBLISH_QUEUE_KEY,
+                          iot_data_alloc_string("1024", IOT_DATA_REF));
+  iot_data_string_map_add(driver_map, BUSY_MAX_AGE_KEY,
+                          iot_data_alloc_string("5", IOT_DATA_REF));
+  iot_data_string_map_add(driver_map, COALESCE_WINDOW_KEY,
+                          iot_data_alloc_string("0", IOT_DATA_REF));
+  iot_data_string_map_add(driver_map, COALESCE_MAX_KEY,
+                          iot_data_alloc_string("16", IOT_DATA_REF));
+  iot_data_string_map_add(driver_map, STRING_REFS_KEY,
+                          iot_data_alloc_string("false", IOT_DATA_REF));
+  iot_data_string_map_add(driver_map, BLOCK_MAX_BODY_KEY,
+                          iot_data_alloc_string("65536", IOT_DATA_REF));
+  iot_data_string_map_add(driver_map, BLOCK_MAX_PEER_KEY,
+                          iot_data_alloc_string("131072", IOT_DATA_REF));
+  iot_data_string_map_add(driver_map, TRACE_PDUS_KEY,
+                          iot_data_alloc_string("0", IOT_DATA_REF));
+  iot_data_string_map_add(driver_map, SERVE_METRICS_KEY,
+                          iot_data_alloc_string("false", IOT_DATA_REF));
+  iot_data_string_map_add(driver_map, SERVE_VALUES_KEY,
+                          iot_data_alloc_string("false", IOT_DATA_REF));
+  iot_data_string_map_add(driver_map, SERVER_SHARDS_KEY,
+                          iot_data_alloc_string("1", IOT_DATA_REF));
+  iot_data_string_map_add(driver_map, SERVER_BATCH_SIZE_KEY,
+                          iot_data_alloc_string("0", IOT_DATA_REF));
+  iot_data_string_map_add(driver_map, DISCOVERY_SUBNETS_KEY,
+                          iot_data_alloc_string("", IOT_DATA_REF));
+  iot_data_string_map_add(driver_map, DISCOVERY_GROUPS_KEY,
+                          iot_data_alloc_string("", IOT_DATA_REF));
+  iot_data_string_map_add(driver_map, DISCOVERY_MAX_INFLIGHT_KEY,
+                          iot_data_alloc_string("64", IOT_DATA_REF));
+  iot_data_string_map_add(driver_map, DISCOVERY_TIMEOUT_KEY,
+                          iot_data_alloc_string("1000", IOT_DATA_REF));
 
   devsdk_service_start(service, driver_map, &e);
   ERR_CHECK(e);
@@ -316,6 +677,8 @@ int main(int argc, char *argv[]) {
   iot_data_free(driver_map);
   iot_data_free(impl->coap_bind_addr);
   iot_data_free(impl->psk_key);
+  iot_data_free(impl->discovery_subnets);
+  iot_data_free(impl->discovery_groups);
   free(impl);
   puts("Exiting gracefully");
   return 0;
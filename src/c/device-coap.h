@@ -37,7 +37,28 @@ typedef struct coap_driver {
   iot_data_t *coap_bind_addr; /**< Address server binds to, for incoming data */
   coap_security_mode_t security_mode; /**< CoAP transport security mode */
   iot_data_t *psk_key; /**< PSK key as uint8_t array; unused if not PSK mode */
-  pthread_mutex_t mutex; //for synchronization
+  uint32_t session_max;  /**< max pooled client sessions to end devices */
+  uint32_t session_idle_secs; /**< idle secs before pooled session evicted */
+  uint32_t handshake_max; /**< max DTLS handshakes in progress; 0 no limit */
+  uint32_t resolve_ttl_secs; /**< secs before end device address refreshed */
+  uint32_t failure_threshold; /**< failures that mark a device DOWN; 0 off */
+  uint32_t publish_threads;    /**< threads posting received readings */
+  uint32_t publish_queue_size; /**< readings queued for publisher threads */
+  uint32_t busy_max_age;       /**< Max-Age secs sent with 5.03 when full */
+  uint32_t coalesce_window;    /**< msecs to coalesce readings per device */
+  uint32_t coalesce_max_readings; /**< flush coalesced readings at this count */
+  bool string_refs;  /**< string readings reference the request if inline */
+  uint32_t block_max_body;     /**< max bytes of a body sent in blocks */
+  uint32_t block_max_peer;     /**< max reassembly bytes held for one peer */
+  uint32_t trace_pdus;  /**< dump 1 in this many PDUs to the log; 0 off */
+  bool serve_metrics;   /**< server serves metrics at /metrics */
+  bool serve_values;    /**< server serves last values of resources */
+  uint32_t server_shards; /**< server threads, each on its own socket */
+  uint32_t server_batch_size; /**< datagrams per receive call; 0 off */
+  iot_data_t *discovery_subnets; /**< IPv4 CIDRs probed by discovery */
+  iot_data_t *discovery_groups;  /**< multicast groups queried by discovery */
+  uint32_t discovery_max_inflight; /**< hosts probed at once by discovery */
+  uint32_t discovery_timeout_msecs; /**< msecs to wait for a discovery probe */
 } coap_driver;
 
 extern coap_driver *impl;